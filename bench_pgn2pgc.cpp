@@ -0,0 +1,334 @@
+///////////////////////////////////////////////////////////////////////////////
+//	bench_pgn2pgc.cpp
+//
+//	Microbenchmarks of the hot paths of the converter.
+//
+//	Usage: bench_pgn2pgc [file.pgn [filter]]
+//
+//	The positions, moves and games come from a fixed set of FEN positions
+//	and the games of the PGN file (pgngames.pgn by default), so runs on the
+//	same input measure the same work.  A benchmark repeats its pass over all
+//	of them for at least kMinTime and reports the fastest pass as ns/op,
+//	with the allocations per op counted by newcount.cpp.  With a filter only
+//	the benchmarks whose name contains it are run.
+//
+//	The functions of the converter are internal to pgnpgc3.cpp, so it is
+//	compiled into this file, without its main.
+//
+///////////////////////////////////////////////////////////////////////////////
+#pragma GCC diagnostic push
+#pragma GCC diagnostic ignored "-Wunused-function" // what only its main uses
+#include "pgnpgc3.cpp"
+#pragma GCC diagnostic pop
+
+#include "pgcreader.h"
+#include <cstdio>
+
+namespace {
+    using namespace std::chrono_literals;
+    using Chess::ChessMove;
+    using Chess::ChessMoveSAN;
+
+    static constexpr auto kMinTime = 500ms; // per benchmark
+    static constexpr auto kMinPass = 20ms;  // passes are repeated up to this
+
+    static constexpr std::string_view kFenPositions[] = {
+        "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+    };
+
+    // what the benchmarks work on
+    struct Corpus {
+        std::string                  pgn;        // the source, '\0' terminated
+        std::vector<char const*>     gameStarts; // the '[' of every game
+        std::vector<Board>           positions;  // before every move of the games, and the FEN positions
+        std::vector<OrderedMoveList> legal;      // of positions
+        std::vector<ChessMoveSAN>    played;     // the move played in positions[i], for those of the games
+        std::vector<DeferredMoves>   mainLines;  // of the games without variations, as --batched has them
+    };
+
+    // collects the positions and moves of the converted games
+    struct Collector : GameVisitor {
+        Corpus& corpus;
+        explicit Collector(Corpus& c) : corpus(c) {}
+
+        void move(Board const& board, ChessMoveSAN const& move, unsigned) override {
+            corpus.positions.push_back(board);
+            corpus.played.push_back(move);
+        }
+    };
+
+    Corpus LoadCorpus(fs::path const& name) {
+        Corpus        corpus;
+        std::ifstream is(name, std::ios::binary);
+        if (!is)
+            throw std::runtime_error("Unable to open " + name.string());
+        corpus.pgn.assign(std::istreambuf_iterator<char>(is), {});
+
+        std::istringstream source(corpus.pgn);
+        ScanPgnTags(source, [&](uint64_t offset, uint32_t, Index::KeyTagViews const&) {
+            corpus.gameStarts.push_back(corpus.pgn.c_str() + offset);
+        });
+
+        std::vector<PGNTag> tags;
+        GameDecoder         decoder;
+        Collector           collector(corpus);
+        for (auto start : corpus.gameStarts) {
+            std::ostringstream pgc(std::ios::binary);
+            char const*        end = nullptr;
+            if (PgnToPgc(start, end, pgc, tags, {}) == illegalMove)
+                continue;
+
+            DeferredMoves      moves;
+            std::ostringstream deferred(std::ios::binary);
+            if (PgnToPgc(start, end, deferred, tags, {}, std::pmr::get_default_resource(), &moves) !=
+                notDeferred)
+                corpus.mainLines.push_back(std::move(moves));
+
+            auto const  record = pgc.view();
+            char const* p      = record.data();
+            decoder.decode(p, record.data() + record.size(), collector);
+        }
+
+        for (auto fen : kFenPositions) {
+            corpus.positions.emplace_back();
+            if (!corpus.positions.back().processFEN(fen))
+                throw std::runtime_error("Invalid FEN " + std::string(fen));
+        }
+
+        for (auto& position : corpus.positions)
+            corpus.legal.push_back(Board(position).genLegalMoveSet());
+        return corpus;
+    }
+
+    // times passes of run(), ops operations each; prepare() is called before every pass, untimed
+    template <typename Run, typename Prepare>
+    void Bench(std::string_view name, std::string_view filter, size_t ops, Prepare prepare, Run run) {
+        if (name.find(filter) == std::string_view::npos || !ops)
+            return;
+
+        using Clock = std::chrono::steady_clock;
+        Clock::duration best = Clock::duration::max(), total{};
+        uint64_t        passes = 0, allocs = 0, bytes = 0;
+
+        while (total < kMinTime || passes < 3) {
+            prepare();
+            auto const before  = support::LocalAllocs();
+            auto const started = Clock::now();
+            run();
+            auto const elapsed = Clock::now() - started;
+            auto const after   = support::LocalAllocs();
+
+            best = std::min(best, elapsed);
+            total += std::max<Clock::duration>(elapsed, kMinPass); // a pass is never too short to count
+            allocs += after.allocs - before.allocs;
+            bytes += after.bytes - before.bytes;
+            ++passes;
+        }
+
+        double const n = double(passes) * ops;
+        std::printf("%-29.*s %10.1f ns/op %9.2f allocs/op %10.1f B/op %9zu ops\n", int(name.size()),
+                    name.data(), std::chrono::duration<double, std::nano>(best).count() / ops, allocs / n,
+                    bytes / n, ops);
+    }
+
+    template <typename Run>
+    void Bench(std::string_view name, std::string_view filter, size_t ops, Run run) {
+        Bench(name, filter, ops, [] {}, run);
+    }
+
+    // keeps the optimizer from dropping the work
+    template <typename T> void Keep(T const& value) { asm volatile("" : : "r,m"(value) : "memory"); }
+} // namespace
+
+int main(int argc, char* argv[]) try {
+    if (argc > 3) {
+        std::cout << "Usage: bench_pgn2pgc [file.pgn [filter]]\n";
+        return 2;
+    }
+    std::string_view const filter = argc > 2 ? argv[2] : "";
+    auto const             corpus = LoadCorpus(argc > 1 ? argv[1] : "pgngames.pgn");
+
+    auto const& positions = corpus.positions;
+    auto const& legal     = corpus.legal;
+    auto const& played    = corpus.played; // one per position, but for the FEN positions at the end
+    auto const  games     = corpus.gameStarts.size();
+    std::printf("%zu games, %zu positions, %zu moves\n\n", games, positions.size(), played.size());
+
+    std::vector<Board> boards(positions.size());
+    auto const         resetBoards = [&] { std::ranges::copy(positions, boards.begin()); };
+
+    Bench("Board::genLegalMoveSet", filter, positions.size(), resetBoards, [&] {
+        for (auto& board : boards)
+            Keep(board.genLegalMoveSet());
+    });
+
+    Bench("Board::resolveSAN", filter, played.size(), [&] {
+        for (size_t i = 0; i < played.size(); ++i)
+            Keep(positions[i].resolveSAN(played[i].SAN(), legal[i].list));
+    });
+
+    Bench("Board::toSAN", filter, played.size(), [&] {
+        for (size_t i = 0; i < played.size(); ++i)
+            Keep(positions[i].toSAN(played[i].move(), legal[i].list));
+    });
+
+    // the move lists as genLegalMoves leaves them, before the SAN of the moves is disambiguated
+    std::vector<OrderedMoveList> ambiguous(legal.size());
+    Bench(
+        "OrderedMoveList::disambiguate", filter, legal.size(),
+        [&] {
+            for (size_t i = 0; i < legal.size(); ++i) {
+                ambiguous[i] = legal[i];
+                for (auto& move : ambiguous[i].bysan)
+                    move.SAN() = move.move().ambiguousSAN();
+            }
+        },
+        [&] {
+            for (auto& list : ambiguous)
+                list.disambiguate();
+        });
+
+    Bench("Board::processMove", filter, played.size(), resetBoards, [&] {
+        for (size_t i = 0; i < played.size(); ++i)
+            Keep(boards[i].processMove(played[i].move()));
+    });
+
+    Bench("Positions::Hash", filter, positions.size(), [&] {
+        for (auto const& position : positions)
+            Keep(Positions::Hash(position));
+    });
+
+    // the positions as one game, in an index of their own
+    auto const indexName = fs::temp_directory_path() / "bench_pgn2pgc.pgcp";
+    {
+        std::vector<uint64_t> hashes;
+        for (auto const& position : positions)
+            hashes.push_back(Positions::Hash(position));
+        Positions::PositionWriter writer(indexName);
+        writer.add(0, hashes);
+        writer.finish();
+    }
+    {
+        Positions::PositionIndex index(indexName);
+        Bench("PositionIndex::find", filter, positions.size(), [&] {
+            for (auto const& position : positions)
+                Keep(index.find(position));
+        });
+    }
+    fs::remove(indexName);
+
+    // the moves played, as lines of the plies of a tree, each added as a game
+    {
+        std::vector<uint64_t> hashes;
+        std::string           ordinals;
+        for (size_t i = 0; i < played.size(); ++i) {
+            auto moves = legal[i];
+            hashes.push_back(Positions::Hash(positions[i]));
+            ordinals.push_back(static_cast<char>(FindElement(played[i].SAN(), moves)));
+        }
+        hashes.push_back(0); // after the last move, which has none in the tree
+        Bench("TreeBuilder, 30 plies", filter, played.size(), [&] {
+            Openings::TreeBuilder builder(Openings::kDefaultPlies);
+            for (size_t i = 0; i < played.size(); i += Openings::kDefaultPlies)
+                builder.add(std::span(hashes).subspan(i), std::string_view(ordinals).substr(i),
+                            Openings::Result(i % 4));
+            std::ostringstream tree(std::ios::binary);
+            builder.write(tree);
+            Keep(tree.tellp());
+        });
+    }
+
+    Bench("ParsePGNTags", filter, games, [&] {
+        std::vector<PGNTag> tags;
+        for (auto start : corpus.gameStarts) {
+            tags.clear();
+            Keep(ParsePGNTags(start, tags));
+        }
+    });
+
+    Bench("PgnToPgc", filter, games, [&] {
+        std::vector<PGNTag> tags;
+        for (auto start : corpus.gameStarts) {
+            std::ostringstream pgc(std::ios::binary);
+            char const*        end = nullptr;
+            Keep(PgnToPgc(start, end, pgc, tags, {}));
+        }
+    });
+
+    // as PgnToPgcDataBase does it
+    Bench("PgnToPgc, arena per game", filter, games, [&] {
+        std::vector<PGNTag>                 tags;
+        std::vector<std::byte>              storage(0x10000);
+        std::pmr::monotonic_buffer_resource arena(storage.data(), storage.size());
+        for (auto start : corpus.gameStarts) {
+            arena.release();
+            GameRecord  pgc(std::ios::binary, &arena);
+            char const* end = nullptr;
+            Keep(PgnToPgc(start, end, pgc, tags, {}, &arena));
+        }
+    });
+
+    // as --prefix-trie has it, the trie filled by the pass
+    Bench("PgnToPgc, prefix trie", filter, games, [&] {
+        std::vector<PGNTag>                 tags;
+        std::vector<std::byte>              storage(0x10000);
+        std::pmr::monotonic_buffer_resource arena(storage.data(), storage.size());
+        PrefixTrie                          prefixes;
+        MainLine                            line{&prefixes};
+        for (auto start : corpus.gameStarts) {
+            arena.release();
+            GameRecord  pgc(std::ios::binary, &arena);
+            char const* end = nullptr;
+            Keep(PgnToPgc(start, end, pgc, tags, {}, &arena, nullptr, &line));
+        }
+    });
+
+    // the main lines of the games without variations, one move after the other as the converter does it, and
+    // by Batch::Replay with the kernels of the build
+    std::vector<std::string_view> sans;
+    for (auto const& line : corpus.mainLines)
+        for (uint32_t begin = 0; auto end : line.ends) {
+            sans.push_back(std::string_view(line.san).substr(begin, end - begin));
+            begin = end;
+        }
+    std::vector<uint8_t>     ordinals(sans.size());
+    std::vector<Batch::Game> replays;
+    for (size_t first = 0; auto const& line : corpus.mainLines) {
+        replays.push_back({line.start, std::span(sans).subspan(first, line.ends.size()),
+                           std::span(ordinals).subspan(first, line.ends.size())});
+        first += line.ends.size();
+    }
+
+    Bench("Board, move by move", filter, sans.size(), [&] {
+        for (auto const& game : replays) {
+            Board board = game.start;
+            for (auto san : game.moves) {
+                std::array<std::byte, kPositionScratch> scratch;
+                std::pmr::monotonic_buffer_resource     position(scratch.data(), scratch.size());
+                OrderedMoveList                         legal = board.genLegalMoveSet(&position);
+                auto const                              move  = board.resolveSAN(san, legal.list);
+                Keep(FindElement(board.toSAN(move, legal.list), legal));
+                board.processMove(move, &position);
+            }
+        }
+    });
+
+    for (auto [kernel, name] : {std::pair{Batch::Kernel::scalar, "Batch::Replay, scalar"},
+                                std::pair{Batch::Kernel::avx2, "Batch::Replay, AVX2"},
+                                std::pair{Batch::Kernel::avx512, "Batch::Replay, AVX-512"}})
+        if (Batch::IsSupported(kernel))
+            Bench(name, filter, sans.size(), [&] {
+                Batch::Replay(replays, kernel);
+                Keep(ordinals.back());
+            });
+
+    std::cout << "\n"; // the timings of the TIMED call sites follow
+} catch (std::exception const& e) {
+    std::cerr << e.what() << "\n";
+    return 1;
+}
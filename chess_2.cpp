@@ -1,8 +1,12 @@
 // vim: spell :
+#include <algorithm>
+#include <bit>
 #include <cstddef>
 #include <cstring>
 #include <iostream>
 #include <ranges>
+#include <span>
+#include <stdexcept>
 
 #include "chess_2.h"
 #include "stpwatch.h"
@@ -10,24 +14,6 @@
 namespace pgn2pgc::Chess {
     using enum Occupant;
 
-    static void RemoveWhiteSpace(std::string& s) {
-        if (auto b = s.find_first_not_of(" \t\n\f\r"), e = s.find_last_not_of(" \t\n\f\r");
-            b == std::string::npos) {
-            s.clear();
-        } else {
-            s = s.substr(b, e - b + 1);
-        }
-    }
-
-    static void RemoveChars(std::string& s, std::string_view remove) {
-        for (size_t p = 0; p < s.size(); ++p) {
-            if (remove.contains(s[p])) {
-                s.erase(p, 1);
-                --p;
-            }
-        }
-    }
-
     static constexpr inline char FileToChar(unsigned file) { return file + 'a'; }
     static constexpr inline char RankToChar(unsigned rank) { return rank + '1'; }
     static constexpr inline int  CharToFile(char file) { return file - 'a'; }
@@ -36,15 +22,6 @@ namespace pgn2pgc::Chess {
         return os << FileToChar(f.file) << RankToChar(f.rank);
     }
 
-    // case insensitive
-    inline static constexpr int NumCharsInStr(std::string_view str, char c) {
-        int count = 0;
-        for (auto ch : str)
-            if (toupper(ch) == toupper(c))
-                ++count;
-        return count;
-    }
-
     static constexpr inline char PieceToChar(Occupant pc) {
         switch (pc) {
             case whitePawn: return 'P';
@@ -132,6 +109,10 @@ namespace pgn2pgc::Chess {
                         }
                         --i;
                     }
+                    computeMaps();
+#if PGN2PGC_CHECK_ATTACKS
+                    checkMaps();
+#endif
 
                     break;
                 case 2: // to move
@@ -234,49 +215,185 @@ namespace pgn2pgc::Chess {
             return false;
         }
 
-        at(move.to())   = at(move.from());
-        at(move.from()) = noPiece;
+        Square piece = at(move.from());
+        switch (move.type()) {
+            case ChessMove::promoQueen:
+                assert(move.to().rank == gRanks - 1 || move.to().rank == 0);
+                piece = MakeOccupant(piece.color(), PieceType::queen);
+                break;
+            case ChessMove::promoKnight: piece = MakeOccupant(piece.color(), PieceType::knight); break;
+            case ChessMove::promoRook: piece = MakeOccupant(piece.color(), PieceType::rook); break;
+            case ChessMove::promoBishop: piece = MakeOccupant(piece.color(), PieceType::bishop); break;
+#if ALLOW_KING_PROMOTION
+            case ChessMove::promoKing: piece = MakeOccupant(piece.color(), PieceType::king); break;
+#endif
+            default: break; // do Nothing
+        }
+
+        setAt(move.to(), piece);
+        setAt(move.from(), noPiece);
 
         switch (move.type()) {
-            case ChessMove::whiteEnPassant: at(move.to() - RankFile{1, 0}) = noPiece; break;
-            case ChessMove::blackEnPassant: at(move.to() + RankFile{1, 0}) = noPiece; break;
+            case ChessMove::whiteEnPassant: setAt(move.to() - RankFile{1, 0}, noPiece); break;
+            case ChessMove::blackEnPassant: setAt(move.to() + RankFile{1, 0}, noPiece); break;
             case ChessMove::whiteCastleKS:
-                at(0, gFiles - 1)         = noPiece;
-                at(0, move.to().file - 1) = whiteRook;
+                setAt({0, gFiles - 1}, noPiece);
+                setAt({0, move.to().file - 1}, whiteRook);
                 break;
             case ChessMove::whiteCastleQS:
-                at(0, 0)                  = noPiece;
-                at(0, move.to().file + 1) = whiteRook;
+                setAt({0, 0}, noPiece);
+                setAt({0, move.to().file + 1}, whiteRook);
                 break;
             case ChessMove::blackCastleKS:
-                at(gRanks - 1, gFiles - 1)         = noPiece;
-                at(gRanks - 1, move.to().file - 1) = blackRook;
+                setAt({gRanks - 1, gFiles - 1}, noPiece);
+                setAt({gRanks - 1, move.to().file - 1}, blackRook);
                 break;
             case ChessMove::blackCastleQS:
-                at(gRanks - 1, 0)                  = noPiece;
-                at(gRanks - 1, move.to().file + 1) = blackRook;
-                break;
-            case ChessMove::promoQueen:
-                assert(move.to().rank == gRanks - 1 || move.to().rank == 0);
-                at(move.to()) = at(move.to()).isWhite() ? whiteQueen : blackQueen;
+                setAt({gRanks - 1, 0}, noPiece);
+                setAt({gRanks - 1, move.to().file + 1}, blackRook);
                 break;
-            case ChessMove::promoKnight:
-                at(move.to()) = at(move.to()).isWhite() ? whiteKnight : blackKnight;
-                break;
-            case ChessMove::promoRook: at(move.to()) = at(move.to()).isWhite() ? whiteRook : blackRook; break;
-            case ChessMove::promoBishop:
-                at(move.to()) = at(move.to()).isWhite() ? whiteBishop : blackBishop;
-                break;
-#if ALLOW_KING_PROMOTION
-            case ChessMove::promoKing: at(move.to()) = at(move.to()).isWhite() ? whiteKing : blackKing; break;
-#endif
             default: break; // do Nothing
         }
 
+#if PGN2PGC_CHECK_ATTACKS
+        checkMaps();
+#endif
         return true;
     }
 
-    bool Board::processMove(ChessMove const& m) {
+    static constexpr RankFile kKnightSteps[] = {{1, 2},  {2, 1},  {-1, 2},  {-2, 1},
+                                                {1, -2}, {2, -1}, {-1, -2}, {-2, -1}};
+    static constexpr RankFile kDiagonals[]   = {{1, 1}, {-1, 1}, {-1, -1}, {1, -1}};
+    static constexpr RankFile kStraights[]   = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+    static constexpr RankFile kDirections[]  = {{1, 1}, {-1, 1}, {-1, -1}, {1, -1},
+                                                {1, 0}, {0, 1},  {-1, 0},  {0, -1}};
+
+    static constexpr bool IsOnBoard(RankFile rf) {
+        return rf.rank >= 0 && rf.rank < gRanks && rf.file >= 0 && rf.file < gFiles;
+    }
+
+    // the line from a to b, {0, 0} if they are not on one
+    static constexpr RankFile Direction(RankFile a, RankFile b) {
+        int const dr = b.rank - a.rank, df = b.file - a.file;
+        if ((dr == 0 && df == 0) || (dr != 0 && df != 0 && abs(dr) != abs(df)))
+            return {};
+        return {(dr > 0) - (dr < 0), (df > 0) - (df < 0)};
+    }
+
+    // whether the piece moves along the line, as far as it goes
+    static constexpr bool IsSliderOf(Square piece, RankFile direction) {
+        return piece.type() == PieceType::queen ||
+            piece.type() == (direction.rank && direction.file ? PieceType::bishop : PieceType::rook);
+    }
+
+    void Board::setAt(RankFile rf, Square square) {
+        Square const old = at(rf);
+        if (old == square)
+            return;
+
+        uint64_t const bit = uint64_t(1) << (rf.rank * files() + rf.file);
+        if (!old.isEmpty()) {
+            addAttacks(rf, old, -1);
+            pieces_[old.isBlack()] &= ~bit;
+            kings_[old.isBlack()] &= ~bit;
+        }
+        if (old.isEmpty() != square.isEmpty())
+            extendRays(rf, old.isEmpty() ? -1 : 1); // blocked or opened
+        at(rf) = square;
+        if (!square.isEmpty()) {
+            addAttacks(rf, square, 1);
+            pieces_[square.isBlack()] |= bit;
+            if (square.type() == PieceType::king)
+                kings_[square.isBlack()] |= bit;
+        }
+    }
+
+    void Board::addAttacks(RankFile rf, Square piece, int delta) {
+        auto&      map    = attacks_[piece.isBlack()];
+        auto const attack = [&](RankFile to) { map[to.rank * files() + to.file] += delta; };
+        auto const slide  = [&](std::span<RankFile const> directions) {
+            for (auto d : directions)
+                for (RankFile to = rf + d; IsOnBoard(to); to = to + d) {
+                    attack(to);
+                    if (!at(to).isEmpty())
+                        break;
+                }
+        };
+        auto const step = [&](std::span<RankFile const> steps) {
+            for (auto d : steps)
+                if (IsOnBoard(rf + d))
+                    attack(rf + d);
+        };
+
+        switch (piece.type()) {
+            case PieceType::pawn: {
+                int const forward = piece.isWhite() ? 1 : -1;
+                step(std::array<RankFile, 2>{{{forward, -1}, {forward, 1}}});
+                break;
+            }
+            case PieceType::knight: step(kKnightSteps); break;
+            case PieceType::bishop: slide(kDiagonals); break;
+            case PieceType::rook: slide(kStraights); break;
+            case PieceType::queen: slide(kDirections); break;
+            case PieceType::king: step(kDirections); break;
+            default: assert(0); // not Reached
+        }
+    }
+
+    void Board::extendRays(RankFile rf, int delta) {
+        for (auto d : kDirections) {
+            RankFile from = rf + d;
+            while (IsOnBoard(from) && at(from).isEmpty())
+                from = from + d;
+            if (!IsOnBoard(from))
+                continue;
+
+            Square const slider = at(from);
+            if (!IsSliderOf(slider, d))
+                continue;
+
+            auto& map = attacks_[slider.isBlack()];
+            for (RankFile to = rf - d; IsOnBoard(to); to = to - d) {
+                map[to.rank * files() + to.file] += delta;
+                if (!at(to).isEmpty())
+                    break;
+            }
+        }
+    }
+
+    void Board::computeMaps() {
+        attacks_ = {};
+        pieces_  = {};
+        kings_   = {};
+        for (int r = 0; r < ranks(); ++r)
+            for (int f = 0; f < files(); ++f)
+                if (Square const square = at(r, f); !square.isEmpty()) {
+                    uint64_t const bit = uint64_t(1) << (r * files() + f);
+                    addAttacks({r, f}, square, 1);
+                    pieces_[square.isBlack()] |= bit;
+                    if (square.type() == PieceType::king)
+                        kings_[square.isBlack()] |= bit;
+                }
+    }
+
+    void Board::checkMaps() const {
+        Board scanned = *this;
+        scanned.computeMaps();
+        if (pieces_ != scanned.pieces_ || kings_ != scanned.kings_)
+            throw std::logic_error("Piece sets out of date");
+
+        for (int r = 0; r < ranks(); ++r)
+            for (int f = 0; f < files(); ++f) {
+                int const i = r * files() + f;
+                if (attacks_[0][i] != scanned.attacks_[0][i] || attacks_[1][i] != scanned.attacks_[1][i] ||
+                    canCaptureSquare<Color::white>({r, f}) != canCaptureSquareByScan<Color::white>({r, f}) ||
+                    canCaptureSquare<Color::black>({r, f}) != canCaptureSquareByScan<Color::black>({r, f}))
+                    throw std::logic_error(std::string("Attack map out of date at ") + FileToChar(f) +
+                                           RankToChar(r));
+            }
+    }
+
+    bool Board::processMove(ChessMove const& m, std::pmr::memory_resource* mr) {
         auto& source = at(m.from());
         auto& target = at(m.to());
 
@@ -322,7 +439,7 @@ namespace pgn2pgc::Chess {
                     ++moveNumber_;
                 }
 
-                MoveList list = genLegalMoves<MoveList>();
+                MoveList list = genLegalMoves<MoveList>(mr);
                 status_       = CheckStatus(list);
             } else {
                 toMove_ = ToMove::endOfGame;
@@ -333,8 +450,8 @@ namespace pgn2pgc::Chess {
         }
     }
 
-    std::string Board::toSAN(ChessMove const& move, MoveList const& list) const {
-        std::ostringstream o;
+    SANString Board::toSAN(ChessMove const& move, MoveList const& list) const {
+        SANString o;
 
         bool conflict = false, fileConflict = false,
              rankConflict = false; // use the file in case of a conflict, and rank if no file
@@ -344,18 +461,18 @@ namespace pgn2pgc::Chess {
             case whitePawn:
             case blackPawn:
 
-                o << FileToChar(move.from().file);
+                o.push_back(FileToChar(move.from().file));
                 if (move.from().file != move.to().file) {
-                    o << 'x' << move.to(); // Capture; use style "exd5"
-                } else {
-                    o << RankToChar(move.to().rank); // Non-capture; use style "e5"
+                    o.push_back('x'); // Capture; use style "exd5"
+                    o.push_back(FileToChar(move.to().file));
                 }
+                o.push_back(RankToChar(move.to().rank)); // Non-capture; use style "e5"
                 switch (move.type()) {
-                    case ChessMove::promoBishop: o << "=B"; break;
-                    case ChessMove::promoKnight: o << "=N"; break;
-                    case ChessMove::promoRook: o << "=R"; break;
-                    case ChessMove::promoQueen: o << "=Q"; break;
-                    case ChessMove::promoKing: o << "=K"; break;
+                    case ChessMove::promoBishop: o.append("=B"); break;
+                    case ChessMove::promoKnight: o.append("=N"); break;
+                    case ChessMove::promoRook: o.append("=R"); break;
+                    case ChessMove::promoQueen: o.append("=Q"); break;
+                    case ChessMove::promoKing: o.append("=K"); break;
                     default: // do nothing
                         break;
                 }
@@ -367,17 +484,17 @@ namespace pgn2pgc::Chess {
                 if (move.from().rank == move.to().rank &&
                     (move.from().rank == (Square(move.actor()).isWhite() ? 0 : ranks() - 1))) {
                     if (move.from().file - move.to().file < -1) {
-                        o << "O-O";
+                        o.append("O-O");
                         break;
                     } else if (move.from().file - move.to().file > 1) {
-                        o << "O-O-O";
+                        o.append("O-O-O");
                         break;
                     }
                 }
 
                 [[fallthrough]];
             default:
-                o << (char)toupper(Square(move.actor()).pieceToChar());
+                o.push_back((char)toupper(Square(move.actor()).pieceToChar()));
 
                 for (ChessMove const& alt : list) {
                     if (alt != move && // not the same move
@@ -395,180 +512,177 @@ namespace pgn2pgc::Chess {
                 // resolve if the piece is on same file of rank (if there are three same
                 // pieces then use file and rank)
                 if (conflict && !rankConflict && !fileConflict) {
-                    o << FileToChar(move.from().file);
+                    o.push_back(FileToChar(move.from().file));
                 } else if (conflict && !rankConflict) {
-                    o << RankToChar(move.from().rank);
+                    o.push_back(RankToChar(move.from().rank));
                 } else if (fileConflict && rankConflict) {
-                    o << FileToChar(move.from().file) << RankToChar(move.from().rank);
+                    o.push_back(FileToChar(move.from().file));
+                    o.push_back(RankToChar(move.from().rank));
                 } else if (rankConflict) {
-                    o << FileToChar(move.from().file);
+                    o.push_back(FileToChar(move.from().file));
                 }
 
                 // determine if it's a capture
                 if (!at(move.to()).isEmpty()) {
-                    o << 'x';
+                    o.push_back('x');
                 }
 
                 // destination square
-                o << FileToChar(move.to().file) << RankToChar(move.to().rank);
+                o.push_back(FileToChar(move.to().file));
+                o.push_back(RankToChar(move.to().rank));
 
                 // Check or Checkmate
                 //??! Removed for speed, and compatibility with genLegalMoveSet()
         }
-        return o.str();
+        return o;
     }
 
-    // throws EmptyMove, IllegalMove, InvalidSAN
-    ChessMove Board::resolveSAN(std::string_view constSAN, MoveList const& list) const {
-        ChessMove   move;
-        std::string san(constSAN);
-
-        RemoveWhiteSpace(san);
-        // remove unnecessary chars
-        RemoveChars(san, "+#x=!? ");
+    // throws EmptyMove, InvalidSAN
+    SANMove SANMove::parse(std::string_view san) {
+        // the characters that say something, "exd8=Q+!" has "ed8Q"; a longer SAN is not a move, but for
+        // castling, which is told by the number of O's, or o's
+        std::array<char, 5> said;
+        size_t              length = 0, castles = 0;
+        for (char c : san) {
+            switch (c) {
+                case ' ':
+                case '\t':
+                case '\n':
+                case '\f':
+                case '\r':
+                case '+':
+                case '#':
+                case 'x':
+                case '=':
+                case '!':
+                case '?': continue;
+                case 'O':
+                case 'o': ++castles; [[fallthrough]];
+                default:
+                    if (length < said.size())
+                        said[length] = c;
+                    ++length;
+            }
+        }
 
-        if (san.empty())
+        if (length == 0)
             throw EmptyMove{};
 
-        // get piece type, look for
-        Occupant piece;
-        switch (san[0]) {
+        SANMove move;
+        switch (said[0]) {
+            case 'O':
+            case 'o': move.kind = castles > 2 ? castleQS : castleKS; return move;
             case 'N':
-            case 'n': piece = isWhiteToMove() ? whiteKnight : blackKnight; break;
-            case 'B': piece = isWhiteToMove() ? whiteBishop : blackBishop; break;
+            case 'n':
+            case 'B':
             case 'R':
-            case 'r': piece = isWhiteToMove() ? whiteRook : blackRook; break;
+            case 'r':
             case 'Q':
-            case 'q': piece = isWhiteToMove() ? whiteQueen : blackQueen; break;
+            case 'q':
             case 'K':
-            case 'k': piece = isWhiteToMove() ? whiteKing : blackKing; break;
-            case 'O':
-            case 'o': // castling
-                if (NumCharsInStr(san, 'O') > 2) {
-                    for (auto& match : list)
-                        if (match.type() == ChessMove::whiteCastleQS ||
-                            match.type() == ChessMove::blackCastleQS) {
-                            assert((isWhiteToMove() && match.type() == ChessMove::whiteCastleQS) ||
-                                   (isBlackToMove() && match.type() == ChessMove::blackCastleQS));
-                            return match;
-                        }
-                    throw IllegalMove{constSAN};
-                } else {
-                    for (auto& match : list)
-                        if (match.type() == ChessMove::whiteCastleKS ||
-                            match.type() == ChessMove::blackCastleKS) {
-                            assert((isWhiteToMove() && match.type() == ChessMove::whiteCastleKS) ||
-                                   (isBlackToMove() && match.type() == ChessMove::blackCastleKS));
-                            return match;
-                        }
-                    throw IllegalMove{constSAN};
-                }
-
-            default: piece = isWhiteToMove() ? whitePawn : blackPawn; break;
+            case 'k': // but 'b', which is a file
+                move.kind   = piece;
+                move.letter = (char)toupper(said[0]);
+                break;
+            default: break; // a pawn
         }
 
-        move.type() = ChessMove::normal;
-
-        if (piece == whitePawn || piece == blackPawn) {
-            // is it a promotion?
-            if (IsPromoChar(san.back())) //!!? Lower case b is not counted as Bishop
-            {
-                switch (toupper(san.back())) {
-                    case 'N': move.type() = ChessMove::promoKnight; break;
-                    case 'B': move.type() = ChessMove::promoBishop; break;
-                    case 'R': move.type() = ChessMove::promoRook; break;
-                    case 'Q': move.type() = ChessMove::promoQueen; break;
-#ifdef ALLOW_KING_PROMOTION
-                    case 'K': move.type() = ChessMove::promoKing; break;
-#endif
-                    default: assert(0); // not Reached
-                }
-                san.pop_back();
-                if (san.empty())
-                    throw IllegalMove{constSAN};
+        // a pawn's promotion piece, 'b' is not counted as a bishop
+        if (move.kind == pawn && length > 1 && length <= said.size() && IsPromoChar(said[length - 1])) {
+            switch (toupper(said[--length])) {
+                case 'N': move.promotion = ChessMove::promoKnight; break;
+                case 'B': move.promotion = ChessMove::promoBishop; break;
+                case 'R': move.promotion = ChessMove::promoRook; break;
+                case 'Q': move.promotion = ChessMove::promoQueen; break;
+                case 'K': move.promotion = ChessMove::promoKing; break;
+                default: assert(0); // not Reached
             }
-            // possibilities: "f", "f4", "ef (e.p.)", "ef4", "exf4 (e.p.)", "e3f4
-            // (e.p.)", "e3xf4" (e.p.) all x's have been removed, e.p. is taken care of
-            if (san.empty())
-                throw IllegalMove{constSAN};
-
-            if (san.length() == 1) // f
-            {
-                for (auto& match : list)
-                    if (match.from().file == CharToFile(san[0]) &&
-                        (move.isPromo() ? move.type() == match.type() : true) && at(match.from()) == piece) {
-                        return match;
-                    }
-            } else if (san.length() == 2 && isdigit(san[1])) // f4
-            {
-                for (auto& match : list)
-                    if (match.from().file == CharToFile(san[0]) && match.to().rank == CharToRank(san[1]) &&
-                        (move.isPromo() ? move.type() == match.type() : true) && at(match.from()) == piece) {
-                        return match;
-                    }
+        }
 
-            } else if (san.length() == 2) // ef
-            {
-                assert(!isdigit(san[1]));
-                for (auto& match : list)
-                    if (match.from().file == CharToFile(san[0]) && match.to().file == CharToFile(san[1]) &&
-                        (move.isPromo() ? move.type() == match.type() : true) && at(match.from()) == piece) {
-                        return match;
-                    }
-            } else if (san.length() == 3) // ef4
-            {
-                for (auto& match : list)
-                    if (match.from().file == CharToFile(san[0]) && match.to().file == CharToFile(san[1]) &&
-                        match.to().rank == CharToRank(san[2]) &&
-                        (move.isPromo() ? move.type() == match.type() : true) && at(match.from()) == piece) {
-                        return match;
-                    }
-            } else if (san.length() == 4) // e3f4
-            {
-                for (auto& match : list)
-                    if (match.from().file == CharToFile(san[0]) && match.from().rank == CharToRank(san[1]) &&
-                        match.to().file == CharToFile(san[2]) && match.to().rank == CharToRank(san[3]) &&
-                        (move.isPromo() ? move.type() == match.type() : true) && at(match.from()) == piece) {
-                        return match;
-                    }
+        auto const file = [&](size_t i) {
+            if (said[i] < 'a' || said[i] >= 'a' + gFiles)
+                throw InvalidSAN{san};
+            return static_cast<int8_t>(CharToFile(said[i]));
+        };
+        auto const rank = [&](size_t i) {
+            if (said[i] < '1' || said[i] >= '1' + gRanks)
+                throw InvalidSAN{san};
+            return static_cast<int8_t>(CharToRank(said[i]));
+        };
+
+        if (move.kind == piece) {
+            switch (length) {
+                case 5: // Ng1f3
+                    move.fromFile = file(1);
+                    move.fromRank = rank(2);
+                    break;
+                case 4: // N1f3, Ngf3
+                    if (isdigit(static_cast<unsigned char>(said[1])))
+                        move.fromRank = rank(1);
+                    else
+                        move.fromFile = file(1);
+                    break;
+                case 3: break; // Nf3
+                default: throw InvalidSAN{san};
             }
-        } else {
-            size_t const sanLength = san.length();
-            if (sanLength < 3)
-                throw InvalidSAN{constSAN};
+            move.toFile = file(length - 2);
+            move.toRank = rank(length - 1);
+            return move;
+        }
 
+        // all x's have been skipped, e.p. is taken care of
+        switch (length) {
+            case 1: // f
+                move.fromFile = file(0);
+                break;
+            case 2:
+                move.fromFile = file(0);
+                if (isdigit(static_cast<unsigned char>(said[1])))
+                    move.toRank = rank(1); // f4
+                else
+                    move.toFile = file(1); // ef (e.p.)
+                break;
+            case 3: // ef4 (e.p.)
+                move.fromFile = file(0);
+                move.toFile   = file(1);
+                move.toRank   = rank(2);
+                break;
+            case 4: // e3f4 (e.p.)
+                move.fromFile = file(0);
+                move.fromRank = rank(1);
+                move.toFile   = file(2);
+                move.toRank   = rank(3);
+                break;
+            default: throw InvalidSAN{san};
+        }
+        return move;
+    }
+
+    // throws EmptyMove, IllegalMove, InvalidSAN
+    ChessMove Board::resolveSAN(std::string_view san, MoveList const& list) const {
+        auto const move = SANMove::parse(san);
+
+        if (move.kind == SANMove::castleKS || move.kind == SANMove::castleQS) {
+            auto const castle = move.kind == SANMove::castleKS
+                ? (isWhiteToMove() ? ChessMove::whiteCastleKS : ChessMove::blackCastleKS)
+                : (isWhiteToMove() ? ChessMove::whiteCastleQS : ChessMove::blackCastleQS);
             for (auto& match : list)
-                if (match.to().file == CharToFile(san[sanLength - 2]) &&
-                    match.to().rank == CharToRank(san[sanLength - 1]) && at(match.from()) == piece) {
-                    switch (sanLength) {
-                        case 3: return match; // Nf3
-                        case 4:
-                            if (isdigit(san[1]) && match.from().rank == CharToRank(san[1])) // N1f3
-                            {
-                                return match;
-                            } else if (match.from().file == CharToFile(san[1])) // Ngf3
-                            {
-                                return match;
-                            }
-                            break;
-                        case 5:
-                            if (match.from().file == CharToFile(san[1]) &&
-                                match.from().rank == CharToRank(san[2])) // Ng1f3
-                            {
-                                return match;
-                            }
-                            break;
-                        default: throw InvalidSAN{constSAN};
-                    }
-                }
+                if (match.type() == castle)
+                    return match;
+            throw IllegalMove{san};
         }
 
-        throw IllegalMove{constSAN};
+        Occupant const piece = LetterToOccupant(isWhiteToMove() ? move.letter : (char)tolower(move.letter));
+        for (auto& match : list)
+            if (move.matches(match) && at(match.from()) == piece)
+                return match;
+
+        throw IllegalMove{san};
     }
 
-    OrderedMoveList Board::genLegalMoveSet() {
+    OrderedMoveList Board::genLegalMoveSet(std::pmr::memory_resource* mr) {
         // should combine genLegalMoves and toSAN efficiently
-        auto moves = genLegalMoves<OrderedMoveList>();
+        auto moves = genLegalMoves<OrderedMoveList>(mr);
         moves.disambiguate();
         return moves;
     }
@@ -591,57 +705,56 @@ namespace pgn2pgc::Chess {
         moves.bysan.push_back({mv, mv.ambiguousSAN()});
     }
 
-    void Board::removeIllegalMoves(OrderedMoveList& moves) const {
+    template <Color side>
+    void Board::removeIllegalMoves(OrderedMoveList& moves, RankFile king, bool inCheck) const {
         auto& [list, allSAN] = moves;
-        bool     isFound     = false;
-        Occupant activeKing  = toMove() == ToMove::white ? whiteKing : blackKing;
-
-        RankFile kingLocation;
-
-        for (int r = 0; r < ranks() && !isFound; ++r)
-            for (int f = 0; f < files() && !isFound; ++f) {
-                if (at(r, f) == activeKing) {
-                    kingLocation = {r, f};
-                    isFound      = true;
-                }
-            }
-
-        if (!isFound) {
-            return; // there is no king on the board
-        }
 
         assert(list.size() == allSAN.size());
         auto lit = list.begin();
         auto sit = allSAN.begin();
-        for (Board b = *this; lit != list.end(); b = *this) {
-            ChessMove const& m = *lit;
-            b.applyMove(m);
-            b.switchMove();
-
-            assert(m == sit->move());
-            if (b.at(m.to()) == whiteKing || b.at(m.to()) == blackKing) {
-                if (b.canCaptureSquare(m.to())) {
-                    list.erase(lit);
-                    allSAN.erase(sit);
-                } else {
-                    ++lit;
-                    ++sit;
-                }
+        while (lit != list.end()) {
+            assert(*lit == sit->move());
+            if (!isLegal<side>(*lit, king, inCheck)) {
+                lit = list.erase(lit);
+                sit = allSAN.erase(sit);
             } else {
-                if (b.canCaptureSquare(kingLocation)) {
-                    list.erase(lit);
-                    allSAN.erase(sit);
-                } else {
-                    ++lit;
-                    ++sit;
-                }
+                ++lit;
+                ++sit;
             }
         }
     }
 
+    // the attack maps tell whether the king can go to a square, and a piece can only leave the king in check
+    // if it is pinned to it; the move is made on a copy of the board only in check and for en passant,
+    // which takes a second piece off the board
+    template <Color side>
+    bool Board::isLegal(ChessMove const& m, RankFile king, bool inCheck) const {
+        constexpr Color other = Opponent(side);
+
+        if (inCheck || m.isEnPassant())
+            return !WillBeInCheck<side>(m);
+        if (m.from() == king)
+            return !canCaptureSquare<other>(m.to()); // no slider sees through the king, it is not in check
+
+        RankFile const line = Direction(king, m.from());
+        if (line == RankFile{})
+            return true;
+        for (RankFile rf = king + line; rf != m.from(); rf = rf + line)
+            if (!at(rf).isEmpty())
+                return true;
+
+        RankFile pinner = m.from() + line;
+        while (IsOnBoard(pinner) && at(pinner).isEmpty())
+            pinner = pinner + line;
+        if (!IsOnBoard(pinner) || !at(pinner).is(other) || !IsSliderOf(at(pinner), line))
+            return true;
+
+        return Direction(king, m.to()) == line; // along the pin, up to the pinner
+    }
+
     // doesn't worry about any ambiguities, nor does it indicate check
     // or checkmate status (which don't alter sort order anyway)
-    constexpr std::string ChessMove::ambiguousSAN() const {
+    std::string ChessMove::ambiguousSAN() const {
         using namespace std::string_view_literals;
         std::array<char, 10> buf{};
         size_t               i = 0;
@@ -723,282 +836,215 @@ namespace pgn2pgc::Chess {
     //
     // pseudoLegal: not castling, and not worrying about being left in check
     //
-    template <typename Moves>
+    template <typename Moves, Color side>
         requires std::is_base_of_v<MoveList, Moves> || std::is_base_of_v<OrderedMoveList, Moves>
-    Moves Board::genPseudoLegalMoves() const {
-        Moves moves;
-        if (toMove() == ToMove::endOfGame)
-            return moves;
+    Moves Board::genPseudoLegalMoves(std::pmr::memory_resource* mr) const {
+        constexpr bool white     = side == Color::white;
+        constexpr int  forward   = white ? 1 : -1;
+        constexpr int  start     = white ? 1 : gRanks - 2; // of the pawns
+        constexpr int  last      = white ? gRanks - 2 : 1; // the rank the pawns promote from
+        constexpr int  passing   = white ? gRanks - 4 : 3; // the rank the pawns capture en passant from
+        constexpr auto enemyPawn = MakeOccupant(Opponent(side), PieceType::pawn);
+        constexpr auto byPassing = white ? ChessMove::whiteEnPassant : ChessMove::blackEnPassant;
+
+        Moves moves(mr);
+
+        for (uint64_t pieces = pieces_[side == Color::black]; pieces; pieces &= pieces - 1) {
+            int const   rf = std::countr_zero(pieces) / files(), ff = std::countr_zero(pieces) % files();
+            auto const& source = at(rf, ff);
+
+            auto const actor      = source.contents();
+            auto const promotions = [&](int rt, int ft) {
+                addMove({actor, rf, ff, rt, ft, ChessMove::promoQueen}, moves);
+                addMove({actor, rf, ff, rt, ft, ChessMove::promoKnight}, moves);
+                addMove({actor, rf, ff, rt, ft, ChessMove::promoBishop}, moves);
+                addMove({actor, rf, ff, rt, ft, ChessMove::promoRook}, moves);
+                addMove({actor, rf, ff, rt, ft, ChessMove::promoKing}, moves);
+            };
 
-        for (int rf = 0; rf < ranks(); ++rf)
-            for (int ff = 0; ff < files(); ++ff) {
-                auto& source = at(rf, ff);
-                if ((source.isBlack() && toMove() == ToMove::white) ||
-                    (source.isWhite() && toMove() == ToMove::black)) {
-                    continue;
-                }
-                switch (auto actor = source.contents()) {
-                    case whitePawn:
-                        if (rf < 7 && at(rf + 1, ff).isEmpty()) {
-                            if (rf == ranks() - 2) // promotion
-                            {
-                                addMove({actor, rf, ff, rf + 1, ff, ChessMove::promoQueen}, moves);
-                                addMove({actor, rf, ff, rf + 1, ff, ChessMove::promoBishop}, moves);
-                                addMove({actor, rf, ff, rf + 1, ff, ChessMove::promoKnight}, moves);
-                                addMove({actor, rf, ff, rf + 1, ff, ChessMove::promoRook}, moves);
-                                addMove({actor, rf, ff, rf + 1, ff, ChessMove::promoKing}, moves);
-                            } else {
-                                addMove({actor, rf, ff, rf + 1, ff}, moves);
-                            }
-                        }
-                        if (rf == 1 && at(2, ff).isEmpty() && at(3, ff).isEmpty()) {
-                            addMove({actor, rf, ff, 3, ff}, moves);
-                        }
-                        for (int s = -1; s <= 1; s += 2) {
-                            if (rf < 7 && ff + s >= 0 && ff + s <= 7 && at(rf + 1, ff + s).isBlack()) {
-                                if (rf == ranks() - 2) // promotion
-                                {
-                                    addMove({actor, rf, ff, rf + 1, ff + s, ChessMove::promoQueen}, moves);
-                                    addMove({actor, rf, ff, rf + 1, ff + s, ChessMove::promoKnight}, moves);
-                                    addMove({actor, rf, ff, rf + 1, ff + s, ChessMove::promoBishop}, moves);
-                                    addMove({actor, rf, ff, rf + 1, ff + s, ChessMove::promoRook}, moves);
-                                    addMove({actor, rf, ff, rf + 1, ff + s, ChessMove::promoKing}, moves);
-                                } else {
-                                    addMove({actor, rf, ff, rf + 1, ff + s}, moves);
-                                }
-                            }
-                            if (rf == ranks() - 4) {
-                                if (ff + s >= 0 && ff + s <= 7 &&
-                                    (enPassant() == ff + s || enPassant() == Board::allCaptures) &&
-                                    at(ranks() - 4, ff + s).contents() == blackPawn &&
-                                    at(ranks() - 3, ff + s).isEmpty()) {
-
-                                    addMove({actor, rf, ff, ranks() - 3, ff + s, ChessMove::whiteEnPassant},
-                                            moves);
-                                }
-                            }
-                        }
+            switch (source.type()) {
+                case PieceType::pawn: {
+                    int const rt = rf + forward;
+                    if (rt < 0 || rt > ranks() - 1)
                         break;
 
-                    case blackPawn:
-                        if (rf > 0 && at(rf - 1, ff).isEmpty()) {
-                            if (rf == 1) // promotion
-                            {
-                                addMove({actor, rf, ff, rf - 1, ff, ChessMove::promoQueen}, moves);
-                                addMove({actor, rf, ff, rf - 1, ff, ChessMove::promoKnight}, moves);
-                                addMove({actor, rf, ff, rf - 1, ff, ChessMove::promoBishop}, moves);
-                                addMove({actor, rf, ff, rf - 1, ff, ChessMove::promoRook}, moves);
-                                addMove({actor, rf, ff, rf - 1, ff, ChessMove::promoKing}, moves);
-                            } else {
-                                addMove({actor, rf, ff, rf - 1, ff}, moves);
-                            }
-                        }
-                        if (rf == ranks() - 2 && at(ranks() - 3, ff).isEmpty() &&
-                            at(ranks() - 4, ff).isEmpty()) {
-                            addMove({actor, rf, ff, ranks() - 4, ff}, moves);
+                    if (at(rt, ff).isEmpty()) {
+                        if (rf == last)
+                            promotions(rt, ff);
+                        else
+                            addMove({actor, rf, ff, rt, ff}, moves);
+                    }
+                    if (rf == start && at(rt, ff).isEmpty() && at(rt + forward, ff).isEmpty()) {
+                        addMove({actor, rf, ff, rt + forward, ff}, moves);
+                    }
+                    for (int s = -1; s <= 1; s += 2) {
+                        if (ff + s < 0 || ff + s > files() - 1)
+                            continue;
+                        if (at(rt, ff + s).is(Opponent(side))) {
+                            if (rf == last)
+                                promotions(rt, ff + s);
+                            else
+                                addMove({actor, rf, ff, rt, ff + s}, moves);
                         }
-                        for (int s = -1; s <= 1; s += 2) {
-                            if (rf > 0 && ff + s >= 0 && ff + s <= 7 && at(rf - 1, ff + s).isWhite()) {
-                                if (rf == 1) // promotion
-                                {
-                                    addMove({actor, rf, ff, rf - 1, ff + s, ChessMove::promoQueen}, moves);
-                                    addMove({actor, rf, ff, rf - 1, ff + s, ChessMove::promoKnight}, moves);
-                                    addMove({actor, rf, ff, rf - 1, ff + s, ChessMove::promoBishop}, moves);
-                                    addMove({actor, rf, ff, rf - 1, ff + s, ChessMove::promoRook}, moves);
-                                    addMove({actor, rf, ff, rf - 1, ff + s, ChessMove::promoKing}, moves);
-                                } else {
-                                    addMove({actor, rf, ff, rf - 1, ff + s}, moves);
-                                }
-                            }
-                            if (rf == 3) {
-                                if (ff + s >= 0 && ff + s <= 7 &&
-                                    (enPassant() == ff + s || enPassant() == Board::allCaptures) &&
-                                    at(3, ff + s).contents() == whitePawn && at(2, ff + s).isEmpty()) {
-                                    addMove({actor, rf, ff, 2, ff + s, ChessMove::blackEnPassant}, moves);
-                                }
-                            }
+                        if (rf == passing && (enPassant() == ff + s || enPassant() == Board::allCaptures) &&
+                            at(rf, ff + s) == enemyPawn && at(rt, ff + s).isEmpty()) {
+                            addMove({actor, rf, ff, rt, ff + s, byPassing}, moves);
                         }
-                        break;
-
-                    case whiteKnight:
-                    case blackKnight:
-                        for (int i = -1; i <= 1; i += 2)
-                            for (int j = -1; j <= 1; j += 2)
-                                for (int s = 1; s <= 2; s++) {
-                                    int rt = rf + i * s;
-                                    int ft = ff + j * (3 - s);
-                                    if (rt < 0 || rt > ranks() - 1 || ft < 0 || ft > files() - 1)
-                                        continue;
-
-                                    if (IsSameColor(at(rf, ff), at(rt, ft)))
-                                        continue;
-
-                                    addMove({actor, rf, ff, rt, ft}, moves);
-                                }
-                        break;
-
-                    case whiteBishop:
-                    case blackBishop:
-                        for (int rs = -1; rs <= 1; rs += 2)
-                            for (int fs = -1; fs <= 1; fs += 2)
-                                for (int i = 1;; i++) {
-                                    int rt = rf + (i * rs);
-                                    int ft = ff + (i * fs);
-                                    if (rt < 0 || rt > ranks() - 1 || ft < 0 || ft > files() - 1)
-                                        break;
-                                    if (IsSameColor(at(rf, ff), at(rt, ft)))
-                                        break;
+                    }
+                    break;
+                }
 
-                                    addMove({actor, rf, ff, rt, ft}, moves);
+                case PieceType::knight:
+                    for (int i = -1; i <= 1; i += 2)
+                        for (int j = -1; j <= 1; j += 2)
+                            for (int s = 1; s <= 2; s++) {
+                                int rt = rf + i * s;
+                                int ft = ff + j * (3 - s);
+                                if (rt < 0 || rt > ranks() - 1 || ft < 0 || ft > files() - 1)
+                                    continue;
 
-                                    if (!at(rt, ft).isEmpty())
-                                        break;
-                                }
-                        break;
+                                if (at(rt, ft).is(side))
+                                    continue;
 
-                    case whiteRook:
-                    case blackRook:
-                        for (int d = 0; d <= 1; d++)
-                            for (int s = -1; s <= 1; s += 2)
-                                for (int i = 1;; i++) {
-                                    int rt = rf + (i * s) * d;
-                                    int ft = ff + (i * s) * (1 - d);
-                                    if (rt < 0 || rt > ranks() - 1 || ft < 0 || ft > files() - 1)
-                                        break;
-                                    if (IsSameColor(at(rf, ff), at(rt, ft)))
-                                        break;
+                                addMove({actor, rf, ff, rt, ft}, moves);
+                            }
+                    break;
 
-                                    addMove({actor, rf, ff, rt, ft}, moves);
+                case PieceType::bishop:
+                    for (int rs = -1; rs <= 1; rs += 2)
+                        for (int fs = -1; fs <= 1; fs += 2)
+                            for (int i = 1;; i++) {
+                                int rt = rf + (i * rs);
+                                int ft = ff + (i * fs);
+                                if (rt < 0 || rt > ranks() - 1 || ft < 0 || ft > files() - 1)
+                                    break;
+                                if (at(rt, ft).is(side))
+                                    break;
 
-                                    if (!at(rt, ft).isEmpty())
-                                        break;
-                                }
-                        break;
+                                addMove({actor, rf, ff, rt, ft}, moves);
 
-                    case whiteQueen:
-                    case blackQueen:
-                        for (int rs = -1; rs <= 1; rs++)
-                            for (int fs = -1; fs <= 1; fs++) {
-                                if (rs == 0 && fs == 0)
-                                    continue;
-                                for (int i = 1;; i++) {
-                                    int rt = rf + (i * rs);
-                                    int ft = ff + (i * fs);
+                                if (!at(rt, ft).isEmpty())
+                                    break;
+                            }
+                    break;
 
-                                    if (rt < 0 || rt > 7 || ft < 0 || ft > 7)
-                                        break;
-                                    if (IsSameColor(at(rf, ff), at(rt, ft)))
-                                        break;
+                case PieceType::rook:
+                    for (int d = 0; d <= 1; d++)
+                        for (int s = -1; s <= 1; s += 2)
+                            for (int i = 1;; i++) {
+                                int rt = rf + (i * s) * d;
+                                int ft = ff + (i * s) * (1 - d);
+                                if (rt < 0 || rt > ranks() - 1 || ft < 0 || ft > files() - 1)
+                                    break;
+                                if (at(rt, ft).is(side))
+                                    break;
 
-                                    addMove({actor, rf, ff, rt, ft}, moves);
+                                addMove({actor, rf, ff, rt, ft}, moves);
 
-                                    if (!at(rt, ft).isEmpty())
-                                        break;
-                                }
+                                if (!at(rt, ft).isEmpty())
+                                    break;
                             }
-                        break;
+                    break;
+
+                case PieceType::queen:
+                    for (int rs = -1; rs <= 1; rs++)
+                        for (int fs = -1; fs <= 1; fs++) {
+                            if (rs == 0 && fs == 0)
+                                continue;
+                            for (int i = 1;; i++) {
+                                int rt = rf + (i * rs);
+                                int ft = ff + (i * fs);
 
-                    case whiteKing:
-                    case blackKing:
-                        for (int i = -1; i <= 1; i++)
-                            for (int j = -1; j <= 1; j++) {
-                                if (i == 0 && j == 0)
-                                    continue;
-                                int rt = rf + i;
-                                int ft = ff + j;
                                 if (rt < 0 || rt > 7 || ft < 0 || ft > 7)
-                                    continue;
-                                if (IsSameColor(at(rf, ff), at(rt, ft)))
-                                    continue;
+                                    break;
+                                if (at(rt, ft).is(side))
+                                    break;
 
                                 addMove({actor, rf, ff, rt, ft}, moves);
+
+                                if (!at(rt, ft).isEmpty())
+                                    break;
                             }
-                        break;
+                        }
+                    break;
 
-                    case noPiece: break;
+                case PieceType::king:
+                    for (int i = -1; i <= 1; i++)
+                        for (int j = -1; j <= 1; j++) {
+                            if (i == 0 && j == 0)
+                                continue;
+                            int rt = rf + i;
+                            int ft = ff + j;
+                            if (rt < 0 || rt > 7 || ft < 0 || ft > 7)
+                                continue;
+                            if (at(rt, ft).is(side))
+                                continue;
+
+                            addMove({actor, rf, ff, rt, ft}, moves);
+                        }
+                    break;
 
-                    default: assert(0); // not Reached
-                }
+                default: assert(0); // not Reached
             }
+        }
 
         return moves;
     }
 
-    // all legal moves are added to the list, including castling
     template <typename Moves>
         requires std::is_base_of_v<MoveList, Moves> || std::is_base_of_v<OrderedMoveList, Moves>
-    inline Moves Board::genLegalMoves() const {
-        auto moves = genPseudoLegalMoves<Moves>();
-
-        // castling moves
-        if (isWhiteToMove() && (getCastle() & (whiteKS | whiteQS))) {
-            // search for king on first rank
-            for (int file = 0; file < files(); ++file) {
-                if (at(0, file) == whiteKing) {
-                    if (getCastle() & whiteKS) {
-                        bool pieceInWay = false;
-                        for (int j = file + 1; j < files() - 1; ++j)
-                            if (!at(0, j).isEmpty())
-                                pieceInWay = true;
-
-                        if (!pieceInWay && at(0, files() - 1) == whiteRook && file + 2 < files()) {
-                            if (!IsInCheck() && !WillBeInCheck({Occupant::whiteKing, 0, file, 0, file + 1}))
-                                addMove({Occupant::whiteKing, 0, file, 0, file + 2, ChessMove::whiteCastleKS},
-                                        moves);
-                        }
-                    }
-                    if (getCastle() & whiteQS) {
-                        bool pieceInWay = false;
-                        for (int j = file - 1; j > 0; --j)
-                            if (!at(0, j).isEmpty())
-                                pieceInWay = true;
-
-                        if (!pieceInWay && at(0, 0) == whiteRook && file - 2 > 0) {
-                            if (!IsInCheck() &&
-                                !WillBeInCheck(
-                                    {Occupant::whiteKing, 0, file, 0, file - 1})) // cannot castle through
-                                                                                  // check, or when in check
-                                addMove({Occupant::whiteKing, 0, file, 0, file - 2, ChessMove::whiteCastleQS},
-                                        moves);
-                        }
-                    }
-                    break;
-                }
-            }
+    inline Moves Board::genLegalMoves(std::pmr::memory_resource* mr) const {
+        switch (toMove()) {
+            case ToMove::white: return genLegalMoves<Moves, Color::white>(mr);
+            case ToMove::black: return genLegalMoves<Moves, Color::black>(mr);
+            default: return Moves(mr);
+        }
+    }
 
-        } else if (isBlackToMove() && (getCastle() & (blackKS | blackQS))) {
+    // all legal moves are added to the list, including castling
+    template <typename Moves, Color side>
+        requires std::is_base_of_v<MoveList, Moves> || std::is_base_of_v<OrderedMoveList, Moves>
+    Moves Board::genLegalMoves(std::pmr::memory_resource* mr) const {
+        constexpr bool     white    = side == Color::white;
+        constexpr int      back     = white ? 0 : gRanks - 1; // the rank of the king and the rooks
+        constexpr unsigned kside    = white ? whiteKS : blackKS;
+        constexpr unsigned qside    = white ? whiteQS : blackQS;
+        constexpr auto     king     = MakeOccupant(side, PieceType::king);
+        constexpr auto     rook     = MakeOccupant(side, PieceType::rook);
+        constexpr auto     castleKS = white ? ChessMove::whiteCastleKS : ChessMove::blackCastleKS;
+        constexpr auto     castleQS = white ? ChessMove::whiteCastleQS : ChessMove::blackCastleQS;
+
+        auto moves = genPseudoLegalMoves<Moves, side>(mr);
+
+        RankFile   kingSquare;
+        bool const hasKing = findKing<side>(kingSquare);
+        bool const inCheck = hasKing && canCaptureSquare<Opponent(side)>(kingSquare);
+
+        // castling moves, not through check, nor when in check
+        if (!inCheck && (getCastle() & (kside | qside))) {
             // search for king on back rank
             for (int file = 0; file < files(); ++file) {
-                if (at(ranks() - 1, file) == blackKing) {
-                    if (getCastle() & blackKS) {
+                if (at(back, file) == king) {
+                    if (getCastle() & kside) {
                         bool pieceInWay = false;
                         for (int j = file + 1; j < files() - 1; ++j)
-                            if (!at(ranks() - 1, j).isEmpty())
+                            if (!at(back, j).isEmpty())
                                 pieceInWay = true;
 
-                        if (!pieceInWay && at(ranks() - 1, files() - 1) == blackRook && file + 2 < files()) {
-                            if (!IsInCheck() &&
-                                !WillBeInCheck(
-                                    {Occupant::blackKing, ranks() - 1, file, ranks() - 1, file + 1})) {
-                                addMove({Occupant::blackKing, ranks() - 1, file, ranks() - 1, file + 2,
-                                         ChessMove::blackCastleKS},
-                                        moves);
-                            }
+                        if (!pieceInWay && at(back, files() - 1) == rook && file + 2 < files()) {
+                            if (!canCaptureSquare<Opponent(side)>({back, file + 1}))
+                                addMove({king, back, file, back, file + 2, castleKS}, moves);
                         }
                     }
-                    if (getCastle() & blackQS) {
+                    if (getCastle() & qside) {
                         bool pieceInWay = false;
                         for (int j = file - 1; j > 0; --j)
-                            if (!at(ranks() - 1, j).isEmpty())
+                            if (!at(back, j).isEmpty())
                                 pieceInWay = true;
 
-                        if (!pieceInWay && at(ranks() - 1, 0) == blackRook && file - 2 > 0) {
-                            if (!IsInCheck() &&
-                                !WillBeInCheck(
-                                    {Occupant::blackKing, ranks() - 1, file, ranks() - 1, file - 1}))
-                                addMove({Occupant::blackKing, ranks() - 1, file, ranks() - 1, file - 2,
-                                         ChessMove::blackCastleQS},
-                                        moves);
+                        if (!pieceInWay && at(back, 0) == rook && file - 2 > 0) {
+                            if (!canCaptureSquare<Opponent(side)>({back, file - 1}))
+                                addMove({king, back, file, back, file - 2, castleQS}, moves);
                         }
                     }
                     break;
@@ -1006,65 +1052,48 @@ namespace pgn2pgc::Chess {
             }
         }
 
-        if constexpr (std::is_same_v<Moves, MoveList>) {
-            for (int file = 0; file < ssize(moves);) {
-                if (WillBeInCheck(moves[file]))
-                    moves.remove(file);
-                else
-                    ++file;
-            };
+        if (!hasKing) {
+            // there is no king on the board
+        } else if constexpr (std::is_same_v<Moves, MoveList>) {
+            std::erase_if(moves, [&](ChessMove const& m) { return !isLegal<side>(m, kingSquare, inCheck); });
         } else {
-            TIMED(removeIllegalMoves(moves));
+            TIMED(removeIllegalMoves<side>(moves, kingSquare, inCheck));
         }
 
         return moves;
     }
 
-    // all moves that capture the square, square can be same color as person to move
-    bool Board::canCaptureSquare(RankFile target) const {
+    // all moves of side that capture the square, square can be of either color
+    template <Color side>
+    bool Board::canCaptureSquareByScan(RankFile target) const {
         assert(target.rank < ranks());
         assert(target.file < files());
 
-        if (toMove() == ToMove::endOfGame)
-            return false;
+        constexpr int forward = side == Color::white ? 1 : -1;
 
         for (int rf = 0; rf < ranks(); ++rf)
             for (int ff = 0; ff < files(); ++ff) {
-                if ((at(rf, ff).isBlack() && toMove() == ToMove::white) ||
-                    (at(rf, ff).isWhite() && toMove() == ToMove::black)) {
+                if (!at(rf, ff).is(side))
                     continue;
-                }
-                switch (at(rf, ff).contents()) {
 
-                    case whitePawn:
-
-                        if (rf + 1 == target.rank && (ff - 1 == target.file || ff + 1 == target.file))
-                            return true;
-                        break;
-
-                    case blackPawn:
-
-                        if (rf - 1 == target.rank && (ff - 1 == target.file || ff + 1 == target.file))
+                switch (at(rf, ff).type()) {
+                    case PieceType::pawn:
+                        if (rf + forward == target.rank && (ff - 1 == target.file || ff + 1 == target.file))
                             return true;
                         break;
 
-                    case whiteKnight:
-                    case blackKnight:
+                    case PieceType::knight:
                         for (int i = -1; i <= 1; i += 2)
                             for (int j = -1; j <= 1; j += 2)
                                 for (int s = 1; s <= 2; s++) {
                                     int rt = rf + i * s;
                                     int ft = ff + j * (3 - s);
-                                    if (rt != target.rank || ft != target.file)
-                                        continue;
-
                                     if (rt == target.rank && ft == target.file)
                                         return true;
                                 }
                         break;
 
-                    case whiteBishop:
-                    case blackBishop:
+                    case PieceType::bishop:
                         for (int rs = -1; rs <= 1; rs += 2)
                             for (int fs = -1; fs <= 1; fs += 2)
                                 for (int i = 1;; i++) {
@@ -1081,8 +1110,7 @@ namespace pgn2pgc::Chess {
                                 }
                         break;
 
-                    case whiteRook:
-                    case blackRook:
+                    case PieceType::rook:
                         for (int d = 0; d <= 1; d++)
                             for (int s = -1; s <= 1; s += 2)
                                 for (int i = 1;; i++) {
@@ -1099,8 +1127,7 @@ namespace pgn2pgc::Chess {
                                 }
                         break;
 
-                    case whiteQueen:
-                    case blackQueen:
+                    case PieceType::queen:
                         for (int rs = -1; rs <= 1; rs++)
                             for (int fs = -1; fs <= 1; fs++) {
                                 if (rs == 0 && fs == 0)
@@ -1121,25 +1148,12 @@ namespace pgn2pgc::Chess {
                             }
                         break;
 
-                    case whiteKing:
-                    case blackKing:
-
-                        for (int i = -1; i <= 1; i++)
-                            for (int j = -1; j <= 1; j++) {
-                                if (i == 0 && j == 0)
-                                    continue;
-                                int rt = rf + i;
-                                int ft = ff + j;
-                                if (rt != target.rank || ft != target.file)
-                                    continue;
-
-                                if (rt == target.rank && ft == target.file)
-                                    return true;
-                            }
+                    case PieceType::king:
+                        if (abs(rf - target.rank) <= 1 && abs(ff - target.file) <= 1 &&
+                            (rf != target.rank || ff != target.file))
+                            return true;
                         break;
 
-                    case noPiece: break;
-
                     default: assert(0); // not Reached
                 }
             }
@@ -1148,7 +1162,11 @@ namespace pgn2pgc::Chess {
     }
 
     void OrderedMoveList::disambiguate() {
-        std::stable_sort(bysan.begin(), bysan.end());
+        // moves of the same SAN are generated in the order of their from square, keep that order without the
+        // buffer of a stable sort
+        std::ranges::sort(bysan, [](ChessMoveSAN const& a, ChessMoveSAN const& b) {
+            return a.SAN() != b.SAN() ? a.SAN() < b.SAN() : a.move().from() < b.move().from();
+        });
         auto match = [](ChessMoveSAN const& a, ChessMoveSAN const& b) { return a.SAN() == b.SAN(); };
 
         for (auto&& group : std::views::chunk_by(bysan, match))
@@ -1189,34 +1207,36 @@ namespace pgn2pgc::Chess {
 
     // returns if the person to move is in check
     bool Board::IsInCheck() const {
-        // scan a1,a2,...,h8 only test first king found
-        bool     isFound = false;
-        Occupant target  = toMove() == ToMove::white ? whiteKing : blackKing;
-
-        RankFile targetSquare;
+        switch (toMove()) {
+            case ToMove::white: return IsInCheck<Color::white>();
+            case ToMove::black: return IsInCheck<Color::black>();
+            default: return false;
+        }
+    }
 
-        for (int r = 0; r < ranks() && !isFound; ++r)
-            for (int f = 0; f < files() && !isFound; ++f) {
-                if (at(r, f).contents() == target) {
-                    targetSquare = {r, f};
-                    isFound      = true;
-                }
-            }
+    template <Color side>
+    bool Board::IsInCheck() const {
+        RankFile king;
+        return findKing<side>(king) && canCaptureSquare<Opponent(side)>(king);
+    }
 
-        if (!isFound) {
+    // the first king in the order a1, b1, ..., h8, as a scan would find it
+    template <Color side>
+    bool Board::findKing(RankFile& king) const {
+        uint64_t const kings = kings_[side == Color::black];
+        if (!kings)
             return false; // there is no king on the board
-        }
 
-        Board b = *this;
-        b.switchMove();
-        return b.canCaptureSquare(targetSquare);
+        king = {std::countr_zero(kings) / files(), std::countr_zero(kings) % files()};
+        return true;
     }
 
     // if the move is made what will you be left in check?
+    template <Color side>
     bool Board::WillBeInCheck(ChessMove const& move) const {
         Board b = *this;
         b.applyMove(move);
-        return b.IsInCheck();
+        return b.IsInCheck<side>();
     }
 
     // if the move is made will you be giving check?
@@ -1269,12 +1289,12 @@ int main() {
         if (buf == "end")
             break;
 
-        auto        move = b.resolveSAN(buf, moves.list); // TODO handle MoveError
-        std::string SAN  = b.toSAN(move, moves.list);
+        auto move = b.resolveSAN(buf, moves.list); // TODO handle MoveError
+        auto SAN  = b.toSAN(move, moves.list);
 
         b.processMove(move);
 
-        std::cout << "\n Moved: '" << SAN.c_str() << "' ";
+        std::cout << "\n Moved: '" << SAN.view() << "' ";
     }
 }
 
@@ -4,8 +4,12 @@
 ///////////////////////////////////////////////////////////////////////////////
 #include <array>
 #include <cassert>
+#include <cstdint>
+#include <memory_resource>
 #include <stdexcept>
 #include <string>
+#include <string_view>
+#include <utility>
 #include <vector>
 
 //!!? Rank and file mean row (y) and column (x) in chess
@@ -14,53 +18,66 @@
     #define ALLOW_KING_PROMOTION false
 #endif
 
+// checks the attack maps and piece sets of Board against a scan of the board after every change, slow
+#ifndef PGN2PGC_CHECK_ATTACKS
+    #define PGN2PGC_CHECK_ATTACKS false
+#endif
+
 namespace pgn2pgc::Chess {
     static constexpr int gRanks = 8, gFiles = 8;
 
-    enum class Occupant {
+    enum class Color : uint8_t { white = 0x08, black = 0x10 };
+    enum class PieceType : uint8_t { pawn = 1, knight, bishop, rook, queen, king };
+
+    constexpr Color Opponent(Color c) { return c == Color::white ? Color::black : Color::white; }
+
+    // the color and the type of the piece are bit fields
+    enum class Occupant : uint8_t {
         noPiece,
-        whiteBishop,
-        whiteKing,
+        whitePawn = std::to_underlying(Color::white) | std::to_underlying(PieceType::pawn),
         whiteKnight,
-        whitePawn,
-        whiteQueen,
+        whiteBishop,
         whiteRook,
-        blackBishop,
-        blackKing,
+        whiteQueen,
+        whiteKing,
+        blackPawn = std::to_underlying(Color::black) | std::to_underlying(PieceType::pawn),
         blackKnight,
-        blackPawn,
-        blackQueen,
+        blackBishop,
         blackRook,
+        blackQueen,
+        blackKing,
     };
 
+    constexpr Occupant MakeOccupant(Color c, PieceType type) {
+        return Occupant(std::to_underlying(c) | std::to_underlying(type));
+    }
+
     struct Square {
       public:
         constexpr Square(Occupant contents = Occupant::noPiece) : occ_(contents) {}
 
-        constexpr bool isWhite() const {
-            using enum Occupant;
-            return occ_ == whitePawn || occ_ == whiteKnight || occ_ == whiteBishop || occ_ == whiteRook ||
-                occ_ == whiteQueen || occ_ == whiteKing;
-        }
-        constexpr bool isBlack() const {
-            using enum Occupant;
-            return occ_ == blackPawn || occ_ == blackKnight || occ_ == blackBishop || occ_ == blackRook ||
-                occ_ == blackQueen || occ_ == blackKing;
-        }
-        constexpr bool isEmpty() const { return occ_ == Occupant::noPiece; }
-        constexpr bool isPawn() const { return occ_ == Occupant::blackPawn || occ_ == Occupant::whitePawn; }
-        constexpr Occupant contents() const { return occ_; }
+        constexpr bool      is(Color c) const { return std::to_underlying(occ_) & std::to_underlying(c); }
+        constexpr bool      isWhite() const { return is(Color::white); }
+        constexpr bool      isBlack() const { return is(Color::black); }
+        constexpr bool      isEmpty() const { return occ_ == Occupant::noPiece; }
+        constexpr bool      isPawn() const { return type() == PieceType::pawn; }
+        constexpr Color     color() const { return Color(std::to_underlying(occ_) & ~kTypeBits); }
+        constexpr PieceType type() const { return PieceType(std::to_underlying(occ_) & kTypeBits); }
+        constexpr Occupant  contents() const { return occ_; }
 
         constexpr auto operator<=>(Square const& rhs) const = default;
 
         constexpr char pieceToChar() const;
 
       private:
+        static constexpr uint8_t kTypeBits = 0x07;
+
         Occupant occ_;
     };
 
-    inline bool IsSameColor(Square a, Square b) {
-        return (a.isWhite() && b.isWhite()) || (a.isBlack() && b.isBlack());
+    constexpr bool IsSameColor(Square a, Square b) {
+        return std::to_underlying(a.contents()) & std::to_underlying(b.contents()) &
+            (std::to_underlying(Color::white) | std::to_underlying(Color::black));
     }
 
     struct RankFile {
@@ -112,7 +129,7 @@ namespace pgn2pgc::Chess {
         constexpr bool const& isCapture() const { return capture_; }
         constexpr bool&       isCapture() { return capture_; }
 
-        constexpr std::string ambiguousSAN() const;
+        std::string ambiguousSAN() const; // without the disambiguation of OrderedMoveList
 
       private:
         // row from, file from, row to, file to //!?? Keep signed int so that can
@@ -123,6 +140,61 @@ namespace pgn2pgc::Chess {
         Type     type_ = normal;
     };
 
+    // the SAN of a move as Board::toSAN writes it, without a check mark: at most 7 characters, e.g. "Qa1xb2"
+    // or "exd8=Q", held in place
+    class SANString {
+      public:
+        static constexpr size_t kCapacity = 7;
+
+        constexpr void push_back(char c) {
+            assert(size_ < kCapacity);
+            chars_[size_++] = c;
+        }
+        constexpr void append(std::string_view s) {
+            for (char c : s)
+                push_back(c);
+        }
+
+        constexpr size_t           size() const { return size_; }
+        constexpr std::string_view view() const { return {chars_.data(), size_}; }
+        constexpr operator std::string_view() const { return view(); }
+        std::string                str() const { return std::string(view()); }
+
+        friend constexpr bool operator==(SANString const& a, std::string_view b) { return a.view() == b; }
+
+      private:
+        std::array<char, kCapacity> chars_{};
+        uint8_t                     size_ = 0;
+    };
+    static_assert(sizeof(SANString) == 8);
+
+    // a SAN move as written, without regard to a position: what it says of the piece, the squares and the
+    // promotion, check, capture and promotion marks, annotations and spaces skipped
+    struct SANMove {
+        enum Kind : uint8_t { pawn, piece, castleKS, castleQS };
+
+        Kind            kind      = pawn;
+        char            letter    = 'P'; // of the piece, upper case
+        int8_t          fromFile  = -1;  // -1 if not given
+        int8_t          fromRank  = -1;
+        int8_t          toFile    = -1;
+        int8_t          toRank    = -1;
+        ChessMove::Type promotion = ChessMove::normal;
+
+        // one pass from left to right; castling is read in either case, "o-o-o" as well as "O-O-O", as the
+        // case 'o' has always been castling
+        // throws EmptyMove, InvalidSAN
+        static SANMove parse(std::string_view san);
+
+        // true if the move is one the SAN can mean, the piece and castling not considered
+        constexpr bool matches(ChessMove const& m) const {
+            return (fromFile < 0 || m.from().file == fromFile) &&
+                (fromRank < 0 || m.from().rank == fromRank) && (toFile < 0 || m.to().file == toFile) &&
+                (toRank < 0 || m.to().rank == toRank) &&
+                (promotion == ChessMove::normal || m.type() == promotion);
+        }
+    };
+
     class ChessMoveSAN {
       public:
         ChessMoveSAN(ChessMove mv = {}, std::string SAN = {}) : move_(std::move(mv)), SAN_(std::move(SAN)) {}
@@ -136,15 +208,22 @@ namespace pgn2pgc::Chess {
         std::string SAN_{};
     };
 
-    struct MoveList : std::vector<ChessMove> {
+    // the move lists allocate from the memory resource they are made with, e.g. an arena of the converter
+    struct MoveList : std::pmr::vector<ChessMove> {
+        using std::pmr::vector<ChessMove>::vector;
+
         void add(ChessMove v) { push_back(std::move(v)); }
         void remove(size_t index) { erase(begin() + index); }
         void makeEmpty() { clear(); }
     };
 
     struct OrderedMoveList {
-        MoveList list;
-        std::vector<ChessMoveSAN> bysan;
+        explicit OrderedMoveList(std::pmr::memory_resource* mr = std::pmr::get_default_resource())
+            : list(mr)
+            , bysan(mr) {}
+
+        MoveList                       list;
+        std::pmr::vector<ChessMoveSAN> bysan;
 
         void disambiguate();
     };
@@ -183,22 +262,30 @@ namespace pgn2pgc::Chess {
         bool processFEN(std::string_view FEN); // true if valid position, false otherwise
 
         // adds the moves to the list and the SAN representations to the queue
-        OrderedMoveList genLegalMoveSet();
+        OrderedMoveList genLegalMoveSet(std::pmr::memory_resource* mr = std::pmr::get_default_resource());
 
         // throws EmptyMove, IllegalMove, InvalidSAN
         ChessMove resolveSAN(std::string_view san, MoveList const& legal) const;
 
         // no ambiguities, move is not checked for legality
-        std::string toSAN(ChessMove const&, MoveList const&) const;
+        SANString toSAN(ChessMove const&, MoveList const&) const;
 
-        bool processMove(ChessMove const& m);
+        // mr is for the moves generated to find the status of the position, they are freed before it returns
+        bool processMove(ChessMove const& m,
+                         std::pmr::memory_resource* mr = std::pmr::get_default_resource());
 
         void display() const;
 
         GameStatus Status() const { return status_; }
 
+        Square squareAt(RankFile rf) const { return at(rf); }
+
+        // what of the position is not on the squares, e.g. for Batch::Replay
+        ToMove   toMove() const { return toMove_; }
+        unsigned getCastle() const { return castle_; }
+        int      enPassant() const { return enPassantFile_; }
+
       private:
-        ToMove toMove() const { return toMove_; }
 
         void switchMove() {
             if (toMove_ == ToMove::black)
@@ -212,15 +299,9 @@ namespace pgn2pgc::Chess {
         bool isWhiteToMove() const { return toMove_ == ToMove::white; }
         bool isBlackToMove() const { return toMove_ == ToMove::black; }
 
-        unsigned getCastle() const { return castle_; }
-
-        int enPassant() const { return enPassantFile_; }
-
         static constexpr int ranks() { return gRanks; }
         static constexpr int files() { return gFiles; }
 
-        bool canCaptureSquare(RankFile) const;
-
 #ifdef NDEBUG
         Square const& at(int rank, int file) const { return fBoard[rank][file]; }
         Square const& at(RankFile rf) const { return fBoard[rf.rank][rf.file]; }
@@ -234,16 +315,35 @@ namespace pgn2pgc::Chess {
 #endif
 
       private:
+        // changes a square, and the attack maps and piece sets with it
+        void setAt(RankFile, Square);
+
+        // adds delta to the attack map of the side of piece for the squares it attacks from rf
+        void addAttacks(RankFile rf, Square piece, int delta);
+
+        // adds delta for the squares past rf that the sliders aiming at rf would attack through it
+        void extendRays(RankFile rf, int delta);
+
+        // the attack maps and piece sets of the squares
+        void computeMaps();
+
         void addMove(ChessMove, MoveList& moves) const;
         void addMove(ChessMove, OrderedMoveList& moves) const;
 
-        void removeIllegalMoves(OrderedMoveList&) const;
-
         static constexpr int gRanks = 8, gFiles = 8;
         using Rank   = std::array<Square, gFiles>;
         using Fields = std::array<Rank, gRanks>;
         Fields fBoard{};
 
+        // the number of pieces of each side that attack a square, [black][rank * gFiles + file]; kept with
+        // the board by setAt, so that canCaptureSquare is a look up
+        using AttackMap = std::array<uint8_t, gRanks * gFiles>;
+        std::array<AttackMap, 2> attacks_{};
+
+        // the squares of the pieces, and of the kings, of each side, [black] bit rank * gFiles + file; kept
+        // by setAt, so that the generators visit the pieces only, in the order of the squares
+        std::array<uint64_t, 2> pieces_{}, kings_{};
+
         ToMove     toMove_        = ToMove::endOfGame;
         GameStatus status_        = GameStatus::notInCheck;
         unsigned   castle_        = noCastle;
@@ -255,17 +355,50 @@ namespace pgn2pgc::Chess {
         // all legal moves are added to the list, including castling
         template <typename Moves>
             requires std::is_base_of_v<MoveList, Moves> || std::is_base_of_v<OrderedMoveList, Moves>
-        inline Moves genLegalMoves() const;
+        inline Moves genLegalMoves(std::pmr::memory_resource* mr) const;
+
+        // the generators for a side to move, chosen once per position by genLegalMoves and IsInCheck
+        template <typename Moves, Color side>
+            requires std::is_base_of_v<MoveList, Moves> || std::is_base_of_v<OrderedMoveList, Moves>
+        Moves genLegalMoves(std::pmr::memory_resource* mr) const;
 
         // pseudoLegal: not castling, and not worrying about being left in check
-        template <typename Moves>
+        template <typename Moves, Color side>
             requires std::is_base_of_v<MoveList, Moves> || std::is_base_of_v<OrderedMoveList, Moves>
-        Moves genPseudoLegalMoves() const;
+        Moves genPseudoLegalMoves(std::pmr::memory_resource* mr) const;
+
+        template <Color side>
+        void removeIllegalMoves(OrderedMoveList&, RankFile king, bool inCheck) const;
+
+        // whether the move leaves the king of side, on king, out of check
+        template <Color side>
+        bool isLegal(ChessMove const&, RankFile king, bool inCheck) const;
+
+        // false if side has no king
+        template <Color side>
+        bool findKing(RankFile& king) const;
+
+        // whether a piece of side attacks the square, whoever is to move
+        template <Color side>
+        bool canCaptureSquare(RankFile rf) const {
+            return attacks_[side == Color::black][rf.rank * gFiles + rf.file] != 0;
+        }
+
+        // the same by a scan of the board, for checkMaps
+        template <Color side>
+        bool canCaptureSquareByScan(RankFile) const;
+
+        // throws std::logic_error if the attack maps or the piece sets are not those of the position
+        void checkMaps() const;
 
         // returns if the person to move is in check
         bool IsInCheck() const;
 
+        template <Color side>
+        bool IsInCheck() const;
+
         // if the move is made what will you be left in check?
+        template <Color side>
         bool WillBeInCheck(ChessMove const& move) const;
 
         // if the move is made will you be giving check?
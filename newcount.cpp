@@ -0,0 +1,32 @@
+#include "stpwatch.h"
+#include <cstdlib>
+#include <new>
+
+// Counting replacement of the global operator new, linked into the
+// PGN2PGC_COUNT_ALLOCS build and the benchmarks.  Every allocation is
+// counted in LocalAllocs() of the allocating thread.
+
+// the array and nothrow forms of new and delete call these
+void* operator new(std::size_t size) {
+    auto& counts = pgn2pgc::support::LocalAllocs();
+    ++counts.allocs;
+    counts.bytes += size;
+    if (void* p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, std::align_val_t align) {
+    auto& counts = pgn2pgc::support::LocalAllocs();
+    ++counts.allocs;
+    counts.bytes += size;
+    auto const alignment = static_cast<std::size_t>(align);
+    if (void* p = std::aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+void operator delete(void* p, std::align_val_t) noexcept { std::free(p); }
+void operator delete(void* p, std::size_t, std::align_val_t) noexcept { std::free(p); }
@@ -0,0 +1,174 @@
+///////////////////////////////////////////////////////////////////////////////
+//	perft.cpp
+//
+//	Counts the leaf nodes of the legal move tree, to validate the move
+//	generator and measure its speed.
+//
+//	Usage: perft [--depth=n] [--threads=n] [FEN ...]
+//
+//	Without a FEN the standard perft suite is run up to depth n (default 4)
+//	and every count is checked against the published one; the exit code is 1
+//	if any differs.  With FENs the counts for depths 1 to n are printed.
+//	The moves at the root are shared out over the threads (default: one per
+//	hardware thread), so the nodes/s also measure the move generator.
+//
+//	A wrong count means a wrong legal move set, and with it wrong move
+//	ordinals in the .pgc files.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <charconv>
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+#include "chess_2.h"
+
+namespace {
+    using namespace pgn2pgc;
+    using Chess::Board;
+    using Chess::ChessMove;
+
+    struct PerftCase {
+        std::string_view        name, fen;
+        std::array<uint64_t, 6> nodes; // at depth 1.., 0 if not known
+    };
+
+    // https://www.chessprogramming.org/Perft_Results
+    static constexpr PerftCase kSuite[] = {
+        {"initial", "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - 0 1",
+         {20, 400, 8902, 197281, 4865609, 119060324}},
+        {"kiwipete", "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+         {48, 2039, 97862, 4085603, 193690690}},
+        {"position 3", "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1", {14, 191, 2812, 43238, 674624, 11030083}},
+        {"position 4", "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+         {6, 264, 9467, 422333, 15833292}},
+        {"position 4b", "r2q1rk1/pP1p2pp/Q4n2/bbp1p3/Np6/1B3NBn/pPPP1PPP/R3K2R b KQ - 0 1",
+         {6, 264, 9467, 422333, 15833292}},
+        {"position 5", "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+         {44, 1486, 62379, 2103487}},
+        {"position 6", "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+         {46, 2079, 89890, 3894594}},
+    };
+
+    // leaf nodes at depth, the last ply is counted without being played
+    uint64_t Perft(Board& board, unsigned depth) {
+        auto const moves = board.genLegalMoveSet().list;
+        if (depth <= 1)
+            return depth ? moves.size() : 1;
+
+        uint64_t nodes = 0;
+        for (auto const& move : moves) {
+            Board next = board;
+            next.processMove(move);
+            nodes += Perft(next, depth - 1);
+        }
+        return nodes;
+    }
+
+    // the subtrees of the root moves are taken by the threads one at a time
+    uint64_t ParallelPerft(Board board, unsigned depth, unsigned threads) {
+        if (depth <= 2)
+            return Perft(board, depth);
+
+        auto const            moves = board.genLegalMoveSet().list;
+        std::atomic<size_t>   next{0};
+        std::atomic<uint64_t> nodes{0};
+
+        auto const worker = [&] {
+            for (size_t i; (i = next++) < moves.size();) {
+                Board child = board;
+                child.processMove(moves[i]);
+                nodes += Perft(child, depth - 1);
+            }
+        };
+
+        std::vector<std::jthread> pool;
+        for (unsigned t = 1; t < std::min<size_t>(threads, moves.size()); ++t)
+            pool.emplace_back(worker);
+        worker();
+        pool.clear(); // joins
+        return nodes;
+    }
+
+    // prints a line for the count and returns it
+    uint64_t Run(std::string_view name, Board const& board, unsigned depth, unsigned threads) {
+        auto const     started = std::chrono::steady_clock::now();
+        uint64_t const nodes   = ParallelPerft(board, depth, threads);
+        std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - started;
+
+        std::printf("%-12.*s %2u %12llu nodes %10.1f ms %8.2f Mnodes/s", int(name.size()), name.data(), depth,
+                    static_cast<unsigned long long>(nodes), elapsed.count() * 1e3,
+                    elapsed.count() > 0 ? nodes / elapsed.count() / 1e6 : 0.0);
+        return nodes;
+    }
+
+    // parses the number of --name=number, false if arg is not that switch or not a positive number
+    bool ParseCount(std::string_view arg, std::string_view name, unsigned& count) {
+        if (!arg.starts_with(name))
+            return false;
+        arg.remove_prefix(name.size());
+        auto const [end, ec] = std::from_chars(arg.data(), arg.data() + arg.size(), count);
+        return ec == std::errc{} && end == arg.data() + arg.size() && count > 0;
+    }
+} // namespace
+
+int main(int argc, char* argv[]) {
+    unsigned                      depth   = 4;
+    unsigned                      threads = std::max(std::thread::hardware_concurrency(), 1u);
+    std::vector<std::string_view> fens;
+
+    for (int i = 1; i < argc; ++i) {
+        std::string_view const arg = argv[i];
+        if (!arg.starts_with("--"))
+            fens.push_back(arg);
+        else if (!ParseCount(arg, "--depth=", depth) && !ParseCount(arg, "--threads=", threads)) {
+            std::cout << "Usage: perft [--depth=n] [--threads=n] [FEN ...]\n";
+            return 2;
+        }
+    }
+
+    bool     failed = false;
+    uint64_t total  = 0;
+    auto const started = std::chrono::steady_clock::now();
+
+    if (fens.empty()) {
+        for (auto& [name, fen, expected] : kSuite) {
+            Board board;
+            board.processFEN(fen);
+            for (unsigned d = 1; d <= std::min<size_t>(depth, expected.size()) && expected[d - 1]; ++d) {
+                uint64_t const nodes = Run(name, board, d, threads);
+                total += nodes;
+                if (nodes == expected[d - 1]) {
+                    std::printf("  ok\n");
+                } else {
+                    std::printf("  expected %llu\n", static_cast<unsigned long long>(expected[d - 1]));
+                    failed = true;
+                }
+            }
+        }
+    } else {
+        for (auto fen : fens) {
+            Board board;
+            if (!board.processFEN(fen)) {
+                std::cerr << "Invalid FEN: " << fen << "\n";
+                return 2;
+            }
+            for (unsigned d = 1; d <= depth; ++d) {
+                total += Run(fen.substr(0, fen.find(' ')), board, d, threads);
+                std::printf("\n");
+            }
+        }
+    }
+
+    std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - started;
+    std::printf("\n%llu nodes in %.2f s, %.2f Mnodes/s with %u threads%s\n\n",
+                static_cast<unsigned long long>(total), elapsed.count(), total / elapsed.count() / 1e6,
+                threads, failed ? ", WRONG COUNTS" : "");
+    return failed ? 1 : 0;
+}
@@ -0,0 +1,782 @@
+#include "pgcbatch.h"
+#include <algorithm>
+#include <bit>
+#include <cstdlib>
+#include <utility>
+
+#if defined(__AVX512F__) || defined(__AVX2__)
+    #include <immintrin.h>
+#endif
+
+namespace pgn2pgc::Batch {
+    using Chess::ChessMove;
+    using Chess::Color;
+    using Chess::PieceType;
+    using Chess::SANMove;
+
+    // bit rank * 8 + file
+    static constexpr uint64_t kAll   = ~uint64_t{0};
+    static constexpr uint64_t kFileA = 0x0101010101010101, kFileH = kFileA << 7;
+    static constexpr uint64_t kNotA = ~kFileA, kNotH = ~kFileH, kNotAB = ~(kFileA | kFileA << 1),
+                              kNotGH = ~(kFileH | kFileH >> 1);
+    static constexpr uint64_t kRank1 = 0xff, kRank8 = kRank1 << 56;
+
+    // the shift of a step and the squares it cannot wrap to: N, E, NE, NW, then the opposite of d is d ^ 4
+    struct Direction {
+        int      shift;
+        uint64_t mask;
+        bool     diagonal;
+    };
+    static constexpr Direction kDirections[8] = {
+        {8, kAll, false},  {1, kNotA, false},  {9, kNotA, true},  {7, kNotH, true},
+        {-8, kAll, false}, {-1, kNotH, false}, {-9, kNotH, true}, {-7, kNotA, true},
+    };
+
+    // the positions of the lanes, struct of arrays
+    struct Lanes {
+        alignas(64) std::array<uint64_t, kLanes> white{}, black{}, pawns{}, knights{}, bishops{}, rooks{},
+            queens{}, kings{};
+        alignas(64) std::array<uint64_t, kLanes> blackToMove{}; // all bits set if black is to move
+        std::array<uint8_t, kLanes> castle{};                    // Board::Castlings
+        std::array<int8_t, kLanes>  enPassant{};                 // the file, -1 if there is no capture
+    };
+
+    // what makes the moves of the side to move legal
+    struct Masks {
+        alignas(64) std::array<uint64_t, kLanes> attacked{};  // by the other side, through the king
+        alignas(64) std::array<uint64_t, kLanes> checkers{};  // the pieces that give check
+        alignas(64) std::array<uint64_t, kLanes> checkMask{}; // the squares that capture or block a check
+        alignas(64) std::array<uint64_t, kLanes> pinned{};    // the pieces pinned to the king
+        alignas(64) std::array<uint64_t, kLanes> pinRays{};   // the lines from the king to the pinners
+    };
+
+    //-----------------------------------------------------------------------------
+    // the kernels: the masks of all lanes from a few operations on vectors of bitboards
+
+    // one bitboard a lane, a loop over the lanes
+    struct Scalar {
+        std::array<uint64_t, kLanes> v;
+
+        Scalar(uint64_t x) { v.fill(x); }
+        Scalar(std::array<uint64_t, kLanes> const& x) : v(x) {}
+
+        void store(std::array<uint64_t, kLanes>& to) const { to = v; }
+
+        template <int n>
+        Scalar shift() const {
+            Scalar r = *this;
+            for (auto& x : r.v)
+                x = n > 0 ? x << n : x >> -n;
+            return r;
+        }
+        Scalar nonzero() const {
+            Scalar r = *this;
+            for (auto& x : r.v)
+                x = x ? kAll : 0;
+            return r;
+        }
+
+        template <typename Op>
+        friend Scalar Apply(Scalar a, Scalar const& b, Op op) {
+            for (size_t i = 0; i < kLanes; ++i)
+                a.v[i] = op(a.v[i], b.v[i]);
+            return a;
+        }
+        friend Scalar operator&(Scalar const& a, Scalar const& b) { return Apply(a, b, std::bit_and{}); }
+        friend Scalar operator|(Scalar const& a, Scalar const& b) { return Apply(a, b, std::bit_or{}); }
+        friend Scalar operator^(Scalar const& a, Scalar const& b) { return Apply(a, b, std::bit_xor{}); }
+        friend Scalar AndNot(Scalar const& a, Scalar const& b) {
+            return Apply(a, b, [](uint64_t x, uint64_t y) { return x & ~y; });
+        }
+    };
+
+#if defined(__AVX2__)
+    // two __m256i of four bitboards
+    struct Avx2 {
+        __m256i lo, hi;
+
+        Avx2(__m256i l, __m256i h) : lo(l), hi(h) {}
+        Avx2(uint64_t x) : lo(_mm256_set1_epi64x(int64_t(x))), hi(lo) {}
+        Avx2(std::array<uint64_t, kLanes> const& x)
+            : lo(_mm256_load_si256(reinterpret_cast<__m256i const*>(x.data())))
+            , hi(_mm256_load_si256(reinterpret_cast<__m256i const*>(x.data() + 4))) {}
+
+        void store(std::array<uint64_t, kLanes>& to) const {
+            _mm256_store_si256(reinterpret_cast<__m256i*>(to.data()), lo);
+            _mm256_store_si256(reinterpret_cast<__m256i*>(to.data() + 4), hi);
+        }
+
+        template <int n>
+        Avx2 shift() const {
+            if constexpr (n > 0)
+                return {_mm256_slli_epi64(lo, n), _mm256_slli_epi64(hi, n)};
+            else
+                return {_mm256_srli_epi64(lo, -n), _mm256_srli_epi64(hi, -n)};
+        }
+        Avx2 nonzero() const {
+            __m256i const zero = _mm256_setzero_si256(), ones = _mm256_set1_epi64x(-1);
+            return {_mm256_xor_si256(_mm256_cmpeq_epi64(lo, zero), ones),
+                    _mm256_xor_si256(_mm256_cmpeq_epi64(hi, zero), ones)};
+        }
+
+        friend Avx2 operator&(Avx2 a, Avx2 b) {
+            return {_mm256_and_si256(a.lo, b.lo), _mm256_and_si256(a.hi, b.hi)};
+        }
+        friend Avx2 operator|(Avx2 a, Avx2 b) {
+            return {_mm256_or_si256(a.lo, b.lo), _mm256_or_si256(a.hi, b.hi)};
+        }
+        friend Avx2 operator^(Avx2 a, Avx2 b) {
+            return {_mm256_xor_si256(a.lo, b.lo), _mm256_xor_si256(a.hi, b.hi)};
+        }
+        friend Avx2 AndNot(Avx2 a, Avx2 b) {
+            return {_mm256_andnot_si256(b.lo, a.lo), _mm256_andnot_si256(b.hi, a.hi)};
+        }
+    };
+#endif
+
+#if defined(__AVX512F__)
+    // GCC 12 warns of the _mm512_undefined_epi32() of the intrinsics, whose lanes the mask of all ones
+    // overwrites
+    #pragma GCC diagnostic ignored "-Wuninitialized"
+
+    // one __m512i of eight bitboards
+    struct Avx512 {
+        __m512i v;
+
+        Avx512(__m512i x) : v(x) {}
+        Avx512(uint64_t x) : v(_mm512_set1_epi64(int64_t(x))) {}
+        Avx512(std::array<uint64_t, kLanes> const& x) : v(_mm512_load_si512(x.data())) {}
+
+        void store(std::array<uint64_t, kLanes>& to) const { _mm512_store_si512(to.data(), v); }
+
+        template <int n>
+        Avx512 shift() const {
+            if constexpr (n > 0)
+                return _mm512_slli_epi64(v, n);
+            else
+                return _mm512_srli_epi64(v, -n);
+        }
+        Avx512 nonzero() const { return _mm512_maskz_set1_epi64(_mm512_test_epi64_mask(v, v), -1); }
+
+        friend Avx512 operator&(Avx512 a, Avx512 b) { return _mm512_and_si512(a.v, b.v); }
+        friend Avx512 operator|(Avx512 a, Avx512 b) { return _mm512_or_si512(a.v, b.v); }
+        friend Avx512 operator^(Avx512 a, Avx512 b) { return _mm512_xor_si512(a.v, b.v); }
+        friend Avx512 AndNot(Avx512 a, Avx512 b) { return _mm512_andnot_si512(b.v, a.v); }
+    };
+#endif
+
+    // a if mask, else b
+    template <typename V>
+    static V Select(V const& mask, V const& a, V const& b) {
+        return (a & mask) | AndNot(b, mask);
+    }
+
+    // a step in direction d, what leaves the board on one side is masked off by the caller
+    template <size_t d, typename V>
+    static V Step(V const& x) {
+        return x.template shift<kDirections[d].shift>();
+    }
+
+    // the squares gen attacks in direction d, up to and including the first that is not in empty: a
+    // Kogge-Stone fill of empty, then a step
+    template <size_t d, typename V>
+    static V Rays(V gen, V empty) {
+        constexpr int      s    = kDirections[d].shift;
+        constexpr uint64_t mask = kDirections[d].mask;
+        empty                   = empty & V(mask);
+        gen                     = gen | (empty & gen.template shift<s>());
+        empty                   = empty & empty.template shift<s>();
+        gen                     = gen | (empty & gen.template shift<2 * s>());
+        empty                   = empty & empty.template shift<2 * s>();
+        gen                     = gen | (empty & gen.template shift<4 * s>());
+        return Step<d>(gen) & V(mask);
+    }
+
+    template <typename V>
+    static V KnightAttacks(V const& x) {
+        V const one = (x.template shift<1>() & V(kNotA)) | (x.template shift<-1>() & V(kNotH));
+        V const two = (x.template shift<2>() & V(kNotAB)) | (x.template shift<-2>() & V(kNotGH));
+        return one.template shift<16>() | one.template shift<-16>() | two.template shift<8>() |
+            two.template shift<-8>();
+    }
+
+    template <typename V>
+    static V KingAttacks(V const& x) {
+        V const side = (x.template shift<1>() & V(kNotA)) | (x.template shift<-1>() & V(kNotH));
+        V const row  = x | side;
+        return side | row.template shift<8>() | row.template shift<-8>();
+    }
+
+    // of the pawns of x, white if white, else black
+    template <typename V>
+    static V PawnAttacks(V const& x, V const& white) {
+        V const up   = (x.template shift<9>() & V(kNotA)) | (x.template shift<7>() & V(kNotH));
+        V const down = (x.template shift<-7>() & V(kNotA)) | (x.template shift<-9>() & V(kNotH));
+        return Select(white, up, down);
+    }
+
+    template <typename V>
+    static void FindMasks(Lanes const& lanes, Masks& masks) {
+        V const black = lanes.blackToMove, white = lanes.white, blacks = lanes.black;
+        V const us = Select(black, blacks, white), them = Select(black, white, blacks);
+        V const empty = AndNot(V(kAll), us | them);
+        V const king  = V(lanes.kings) & us;
+        V const queens = lanes.queens;
+
+        V const diagonal = (V(lanes.bishops) | queens) & them, straight = (V(lanes.rooks) | queens) & them;
+        V const pawns = V(lanes.pawns) & them, knights = V(lanes.knights) & them;
+
+        // the king does not hide the squares behind it from a slider that gives check
+        V attacked = PawnAttacks(pawns, black) | KnightAttacks(knights) | KingAttacks(V(lanes.kings) & them);
+        V checkers = (PawnAttacks(king, AndNot(V(kAll), black)) & pawns) | (KnightAttacks(king) & knights);
+        V checkMask = checkers, pinned = V(0), pinRays = V(0);
+
+        [&]<size_t... d>(std::index_sequence<d...>) {
+            (
+                [&] {
+                    V const sliders = kDirections[d].diagonal ? diagonal : straight;
+                    attacked        = attacked | Rays<d>(sliders, empty | king);
+
+                    V const ray = Rays<d>(king, empty); // up to the first piece
+                    V const hit = ray & sliders;
+                    checkers    = checkers | hit;
+                    checkMask   = checkMask | (ray & hit.nonzero());
+
+                    // a piece of ours the king and a slider see from either side
+                    V const pin = ray & Rays<d ^ 4>(sliders, empty) & us;
+                    pinned      = pinned | pin;
+                    pinRays     = pinRays | (Rays<d>(king, empty | pin) & pin.nonzero());
+                }(),
+                ...);
+        }(std::make_index_sequence<std::size(kDirections)>{});
+
+        attacked.store(masks.attacked);
+        checkers.store(masks.checkers);
+        checkMask.store(masks.checkMask);
+        pinned.store(masks.pinned);
+        pinRays.store(masks.pinRays);
+    }
+
+    Kernel NativeKernel() {
+#if defined(__AVX512F__)
+        return Kernel::avx512;
+#elif defined(__AVX2__)
+        return Kernel::avx2;
+#else
+        return Kernel::scalar;
+#endif
+    }
+
+    bool IsSupported(Kernel kernel) {
+        switch (kernel) {
+            case Kernel::scalar: return true;
+#if defined(__AVX2__)
+            case Kernel::avx2: return true;
+#endif
+#if defined(__AVX512F__)
+            case Kernel::avx512: return true;
+#endif
+            default: return false;
+        }
+    }
+
+    using MaskFinder = void (*)(Lanes const&, Masks&);
+
+    static MaskFinder Finder(Kernel kernel) {
+        switch (kernel) {
+            case Kernel::scalar: return FindMasks<Scalar>;
+#if defined(__AVX2__)
+            case Kernel::avx2: return FindMasks<Avx2>;
+#endif
+#if defined(__AVX512F__)
+            case Kernel::avx512: return FindMasks<Avx512>;
+#endif
+            default: throw std::invalid_argument("The kernel is not supported by this build");
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+    // a lane at a time: the moves, the SAN and the ordinal
+
+    // the squares from sq in direction d to the edge of the board
+    static constexpr auto kRays = [] {
+        std::array<std::array<uint64_t, 64>, 8> rays{};
+        for (size_t d = 0; d < 8; ++d)
+            for (int sq = 0; sq < 64; ++sq)
+                for (uint64_t x = uint64_t{1} << sq;;) {
+                    int const s = kDirections[d].shift;
+                    x           = (s > 0 ? x << s : x >> -s) & kDirections[d].mask;
+                    if (!x)
+                        break;
+                    rays[d][sq] |= x;
+                }
+        return rays;
+    }();
+
+    // the line through a and b, edge to edge, 0 if they are not on one
+    static constexpr auto kLines = [] {
+        std::array<std::array<uint64_t, 64>, 64> lines{};
+        for (int a = 0; a < 64; ++a)
+            for (size_t d = 0; d < 8; ++d)
+                for (uint64_t ray = kRays[d][a]; ray; ray &= ray - 1)
+                    lines[a][std::countr_zero(ray)] = kRays[d][a] | kRays[d ^ 4][a] | uint64_t{1} << a;
+        return lines;
+    }();
+
+    static constexpr auto kKnightAttacks = [] {
+        std::array<uint64_t, 64> attacks{};
+        for (int sq = 0; sq < 64; ++sq) {
+            uint64_t const x   = uint64_t{1} << sq;
+            uint64_t const one = (x << 1 & kNotA) | (x >> 1 & kNotH);
+            uint64_t const two = (x << 2 & kNotAB) | (x >> 2 & kNotGH);
+            attacks[sq]        = one << 16 | one >> 16 | two << 8 | two >> 8;
+        }
+        return attacks;
+    }();
+
+    static constexpr auto kKingAttacks = [] {
+        std::array<uint64_t, 64> attacks{};
+        for (int sq = 0; sq < 64; ++sq) {
+            uint64_t const x = uint64_t{1} << sq, side = (x << 1 & kNotA) | (x >> 1 & kNotH), row = x | side;
+            attacks[sq]      = side | row << 8 | row >> 8;
+        }
+        return attacks;
+    }();
+
+    // of a pawn on sq, [black]
+    static constexpr auto kPawnAttacks = [] {
+        std::array<std::array<uint64_t, 64>, 2> attacks{};
+        for (int sq = 0; sq < 64; ++sq) {
+            uint64_t const x = uint64_t{1} << sq;
+            attacks[0][sq]   = (x << 9 & kNotA) | (x << 7 & kNotH);
+            attacks[1][sq]   = (x >> 7 & kNotA) | (x >> 9 & kNotH);
+        }
+        return attacks;
+    }();
+
+    // the squares a slider on sq attacks in direction d, up to the first piece of occupied
+    static uint64_t Slide(size_t d, int sq, uint64_t occupied) {
+        uint64_t const ray      = kRays[d][sq];
+        uint64_t const blockers = ray & occupied;
+        if (!blockers)
+            return ray;
+        int const first =
+            kDirections[d].shift > 0 ? std::countr_zero(blockers) : 63 - std::countl_zero(blockers);
+        return ray ^ kRays[d][first];
+    }
+
+    static uint64_t Slides(int sq, uint64_t occupied, bool diagonal) {
+        uint64_t attacks = 0;
+        for (size_t d = 0; d < 8; ++d)
+            if (kDirections[d].diagonal == diagonal)
+                attacks |= Slide(d, sq, occupied);
+        return attacks;
+    }
+
+    // a legal move of a lane
+    struct Move {
+        uint8_t         from, to;
+        PieceType       piece;
+        ChessMove::Type type;
+        bool            capture; // a piece on to, not en passant
+    };
+
+    // the order of OrderedMoveList::bysan: the SAN of ChessMove::ambiguousSAN, up to 6 characters from the
+    // top byte down, then the from square in the lowest byte
+    static uint64_t SortKey(Move const& m) {
+        static constexpr char kLetters[] = " PNBRQK";
+
+        uint64_t key   = 0;
+        int      shift = 56;
+        auto     put   = [&](char c) {
+            key |= uint64_t(uint8_t(c)) << shift;
+            shift -= 8;
+        };
+        char const toFile = char('a' + m.to % 8), toRank = char('1' + m.to / 8);
+
+        switch (m.type) {
+            case ChessMove::whiteCastleKS:
+            case ChessMove::blackCastleKS:
+                for (char c : std::string_view("O-O"))
+                    put(c);
+                break;
+            case ChessMove::whiteCastleQS:
+            case ChessMove::blackCastleQS:
+                for (char c : std::string_view("O-O-O"))
+                    put(c);
+                break;
+            default:
+                if (m.piece == PieceType::pawn) {
+                    put(char('a' + m.from % 8));
+                    if (m.from % 8 != m.to % 8) {
+                        put('x');
+                        put(toFile);
+                    }
+                    put(toRank);
+                    if (m.type >= ChessMove::promoKnight && m.type <= ChessMove::promoKing) {
+                        put('=');
+                        put(kLetters[std::to_underlying(PieceType::knight) + m.type -
+                                     ChessMove::promoKnight]);
+                    }
+                } else {
+                    put(kLetters[std::to_underlying(m.piece)]);
+                    if (m.capture)
+                        put('x');
+                    put(toFile);
+                    put(toRank);
+                }
+        }
+        return key | m.from;
+    }
+
+    // the position of a lane, and its moves
+    class Position {
+      public:
+        Position(Lanes& lanes, Masks const& masks, size_t lane) : lanes_(lanes), masks_(masks), l_(lane) {}
+
+        // false if the position is not one Replay takes
+        bool load(Chess::Board const& board);
+
+        // the legal moves in the order of Board's move list, false if the position is not one Replay takes
+        bool generate();
+
+        // the first legal move the SAN can mean, as Board::resolveSAN finds it, nullptr if there is none
+        Move const* resolve(std::string_view san) const;
+
+        uint8_t ordinal(Move const& played) const;
+
+        void play(Move const& m);
+
+      private:
+        bool     black() const { return lanes_.blackToMove[l_] != 0; }
+        uint64_t& us() { return black() ? lanes_.black[l_] : lanes_.white[l_]; }
+        uint64_t& them() { return black() ? lanes_.white[l_] : lanes_.black[l_]; }
+        uint64_t& pieces(PieceType type);
+        PieceType typeAt(int sq);
+
+        void add(int from, int to, PieceType piece, ChessMove::Type type = ChessMove::normal) {
+            moves_[size_++] = {uint8_t(from), uint8_t(to), piece, type, (them() >> to & 1) != 0};
+        }
+
+        // whether the king is attacked after the en passant capture, which takes two pieces off their squares
+        bool exposesKing(int from, int to, int captured);
+
+        Lanes&       lanes_;
+        Masks const& masks_;
+        size_t       l_;
+
+        std::array<Move, 256> moves_; // at most 218 in a legal position
+        size_t                size_ = 0;
+    };
+
+    uint64_t& Position::pieces(PieceType type) {
+        switch (type) {
+            case PieceType::pawn: return lanes_.pawns[l_];
+            case PieceType::knight: return lanes_.knights[l_];
+            case PieceType::bishop: return lanes_.bishops[l_];
+            case PieceType::rook: return lanes_.rooks[l_];
+            case PieceType::queen: return lanes_.queens[l_];
+            default: return lanes_.kings[l_];
+        }
+    }
+
+    PieceType Position::typeAt(int sq) {
+        for (auto type :
+             {PieceType::pawn, PieceType::knight, PieceType::bishop, PieceType::rook, PieceType::queen})
+            if (pieces(type) >> sq & 1)
+                return type;
+        return PieceType::king;
+    }
+
+    bool Position::load(Chess::Board const& board) {
+        if (board.toMove() == Chess::Board::ToMove::endOfGame ||
+            board.enPassant() == Chess::Board::allCaptures)
+            return false;
+
+        lanes_.white[l_] = lanes_.black[l_] = 0;
+        for (auto type : {PieceType::pawn, PieceType::knight, PieceType::bishop, PieceType::rook,
+                          PieceType::queen, PieceType::king})
+            pieces(type) = 0;
+        for (int sq = 0; sq < 64; ++sq) {
+            auto const square = board.squareAt({sq / 8, sq % 8});
+            if (square.isEmpty())
+                continue;
+            (square.isWhite() ? lanes_.white[l_] : lanes_.black[l_]) |= uint64_t{1} << sq;
+            pieces(square.type()) |= uint64_t{1} << sq;
+        }
+        lanes_.blackToMove[l_] = board.toMove() == Chess::Board::ToMove::black ? kAll : 0;
+        lanes_.castle[l_]      = uint8_t(board.getCastle());
+        lanes_.enPassant[l_]   = int8_t(std::max(board.enPassant(), -1));
+        return !(lanes_.pawns[l_] & (kRank1 | kRank8));
+    }
+
+    bool Position::generate() {
+        size_ = 0;
+
+        uint64_t const own = us(), other = them(), occupied = own | other;
+        uint64_t const kings = lanes_.kings[l_] & own;
+        if (std::popcount(kings) != 1)
+            return false;
+        int const king = std::countr_zero(kings);
+
+        uint64_t const checkers = masks_.checkers[l_];
+        uint64_t const pinned   = masks_.pinned[l_];
+        bool const     blk      = black();
+
+        // where a piece other than the king can go: nowhere in double check, in check between the king and
+        // the checker
+        uint64_t const allowed = std::popcount(checkers) > 1 ? 0 : checkers ? masks_.checkMask[l_] : kAll;
+        auto const     targets = [&](int sq, uint64_t attacks) {
+            attacks &= ~own & allowed;
+            return pinned >> sq & 1 ? attacks & masks_.pinRays[l_] & kLines[king][sq] : attacks;
+        };
+
+        constexpr std::array<ChessMove::Type, 5> kPromotions = {ChessMove::promoQueen, ChessMove::promoKnight,
+                                                                ChessMove::promoBishop, ChessMove::promoRook,
+                                                                ChessMove::promoKing};
+        size_t const promotions = ALLOW_KING_PROMOTION ? 5 : 4;
+
+        int const forward = blk ? -8 : 8;
+        int const start = blk ? 6 : 1, last = blk ? 1 : 6, passing = blk ? 3 : 4; // ranks, as Board has them
+
+        for (uint64_t set = own; set; set &= set - 1) {
+            int const       from  = std::countr_zero(set);
+            PieceType const piece = typeAt(from);
+            switch (piece) {
+                case PieceType::pawn: {
+                    auto const push = [&](int to, ChessMove::Type type = ChessMove::normal) {
+                        if (!(targets(from, uint64_t{1} << to) >> to & 1))
+                            return;
+                        if (from / 8 == last)
+                            for (size_t p = 0; p < promotions; ++p)
+                                add(from, to, piece, kPromotions[p]);
+                        else
+                            add(from, to, piece, type);
+                    };
+
+                    int const one = from + forward;
+                    if (!(occupied >> one & 1)) {
+                        push(one);
+                        if (from / 8 == start && !(occupied >> (one + forward) & 1))
+                            push(one + forward);
+                    }
+                    for (int side = -1; side <= 1; side += 2) {
+                        if (from % 8 + side < 0 || from % 8 + side > 7)
+                            continue;
+                        int const to = one + side;
+                        if (other >> to & 1)
+                            push(to);
+                        if (from / 8 == passing && lanes_.enPassant[l_] == from % 8 + side &&
+                            (other & lanes_.pawns[l_]) >> (from + side) & 1 && !(occupied >> to & 1) &&
+                            !exposesKing(from, to, from + side))
+                            add(from, to, piece, blk ? ChessMove::blackEnPassant : ChessMove::whiteEnPassant);
+                    }
+                    break;
+                }
+                case PieceType::knight:
+                    for (uint64_t to = targets(from, kKnightAttacks[from]); to; to &= to - 1)
+                        add(from, std::countr_zero(to), piece);
+                    break;
+                case PieceType::bishop:
+                case PieceType::rook:
+                case PieceType::queen: {
+                    uint64_t attacks = 0;
+                    if (piece != PieceType::rook)
+                        attacks |= Slides(from, occupied, true);
+                    if (piece != PieceType::bishop)
+                        attacks |= Slides(from, occupied, false);
+                    for (uint64_t to = targets(from, attacks); to; to &= to - 1)
+                        add(from, std::countr_zero(to), piece);
+                    break;
+                }
+                default:
+                    for (uint64_t to = kKingAttacks[from] & ~own & ~masks_.attacked[l_]; to; to &= to - 1)
+                        add(from, std::countr_zero(to), piece);
+                    break;
+            }
+        }
+
+        // castling last, as Board adds it; the rights go with the king and the rook moving only, so the
+        // rook may be another one
+        unsigned const kside = blk ? Chess::Board::blackKS : Chess::Board::whiteKS;
+        unsigned const qside = blk ? Chess::Board::blackQS : Chess::Board::whiteQS;
+        int const      back  = blk ? 56 : 0;
+        if (lanes_.castle[l_] & (kside | qside) && king / 8 == back / 8) {
+            if (king != back + 4)
+                return false; // Board castles with the king anywhere on the back rank
+            uint64_t const rooks = lanes_.rooks[l_] & own, attacked = masks_.attacked[l_];
+            auto const     free  = [&](uint64_t squares) { return !((occupied | attacked) & squares); };
+            if (!checkers) {
+                if (lanes_.castle[l_] & kside && rooks >> (back + 7) & 1 && free(uint64_t{3} << (back + 5)))
+                    add(king, back + 6, PieceType::king,
+                        blk ? ChessMove::blackCastleKS : ChessMove::whiteCastleKS);
+                if (lanes_.castle[l_] & qside && rooks & 1ull << back && !(occupied >> (back + 1) & 1) &&
+                    free(uint64_t{3} << (back + 2)))
+                    add(king, back + 2, PieceType::king,
+                        blk ? ChessMove::blackCastleQS : ChessMove::whiteCastleQS);
+            }
+        }
+        return true;
+    }
+
+    bool Position::exposesKing(int from, int to, int captured) {
+        uint64_t const own = us(), other = them() & ~(uint64_t{1} << captured);
+        uint64_t const occupied = ((own | other) ^ (uint64_t{1} << from)) | uint64_t{1} << to;
+        int const      king     = std::countr_zero(lanes_.kings[l_] & own);
+
+        uint64_t const queens = lanes_.queens[l_];
+        return (kPawnAttacks[black()][king] & lanes_.pawns[l_] & other) ||
+            (kKnightAttacks[king] & lanes_.knights[l_] & other) ||
+            (kKingAttacks[king] & lanes_.kings[l_] & other) ||
+            (Slides(king, occupied, true) & (lanes_.bishops[l_] | queens) & other) ||
+            (Slides(king, occupied, false) & (lanes_.rooks[l_] | queens) & other);
+    }
+
+    Move const* Position::resolve(std::string_view san) const {
+        SANMove move;
+        try {
+            move = SANMove::parse(san);
+        } catch (Chess::MoveError const&) {
+            return nullptr;
+        }
+
+        auto const moves = std::span(moves_.data(), size_);
+        if (move.kind == SANMove::castleKS || move.kind == SANMove::castleQS) {
+            bool const kingside = move.kind == SANMove::castleKS;
+            auto const castle   = black() ? (kingside ? ChessMove::blackCastleKS : ChessMove::blackCastleQS)
+                                          : (kingside ? ChessMove::whiteCastleKS : ChessMove::whiteCastleQS);
+            auto const found    = std::ranges::find(moves, castle, &Move::type);
+            return found != moves.end() ? &*found : nullptr;
+        }
+
+        PieceType piece = PieceType::pawn;
+        switch (move.letter) {
+            case 'N': piece = PieceType::knight; break;
+            case 'B': piece = PieceType::bishop; break;
+            case 'R': piece = PieceType::rook; break;
+            case 'Q': piece = PieceType::queen; break;
+            case 'K': piece = PieceType::king; break;
+            default: break; // a pawn
+        }
+        for (auto const& m : moves)
+            if (m.piece == piece &&
+                move.matches(
+                    ChessMove(Chess::Occupant::noPiece, m.from / 8, m.from % 8, m.to / 8, m.to % 8, m.type)))
+                return &m;
+        return nullptr;
+    }
+
+    uint8_t Position::ordinal(Move const& played) const {
+        uint64_t const key = SortKey(played);
+        return uint8_t(std::ranges::count_if(std::span(moves_.data(), size_),
+                                             [&](Move const& m) { return SortKey(m) < key; }));
+    }
+
+    void Position::play(Move const& m) {
+        uint64_t const from = uint64_t{1} << m.from, to = uint64_t{1} << m.to;
+        bool const     blk  = black();
+
+        if (m.capture) {
+            pieces(typeAt(m.to)) &= ~to;
+            them() &= ~to;
+        }
+
+        PieceType placed = m.piece;
+        switch (m.type) {
+            case ChessMove::promoKnight: placed = PieceType::knight; break;
+            case ChessMove::promoBishop: placed = PieceType::bishop; break;
+            case ChessMove::promoRook: placed = PieceType::rook; break;
+            case ChessMove::promoQueen: placed = PieceType::queen; break;
+            case ChessMove::promoKing: placed = PieceType::king; break;
+            case ChessMove::whiteEnPassant:
+            case ChessMove::blackEnPassant: {
+                uint64_t const captured = blk ? to << 8 : to >> 8;
+                lanes_.pawns[l_] &= ~captured;
+                them() &= ~captured;
+                break;
+            }
+            case ChessMove::whiteCastleKS:
+            case ChessMove::blackCastleKS:
+            case ChessMove::whiteCastleQS:
+            case ChessMove::blackCastleQS: {
+                bool const     kingside = m.to > m.from;
+                uint64_t const rook     = kingside ? to << 1 | to >> 1 : to >> 2 | to << 1;
+                lanes_.rooks[l_] ^= rook;
+                us() ^= rook;
+                break;
+            }
+            default: break;
+        }
+        pieces(m.piece) &= ~from;
+        pieces(placed) |= to;
+        us() = (us() & ~from) | to;
+
+        // as Board::processMove has it
+        unsigned const back = blk ? 56 : 0;
+        if (m.piece == PieceType::king)
+            lanes_.castle[l_] &= blk ? ~(Chess::Board::blackKS | Chess::Board::blackQS)
+                                     : ~(Chess::Board::whiteKS | Chess::Board::whiteQS);
+        else if (m.piece == PieceType::rook && m.from == back)
+            lanes_.castle[l_] &= blk ? ~Chess::Board::blackQS : ~Chess::Board::whiteQS;
+        else if (m.piece == PieceType::rook && m.from == back + 7)
+            lanes_.castle[l_] &= blk ? ~Chess::Board::blackKS : ~Chess::Board::whiteKS;
+
+        lanes_.enPassant[l_]   =
+            int8_t(m.piece == PieceType::pawn && abs(m.to - m.from) == 16 ? m.to % 8 : -1);
+        lanes_.blackToMove[l_] = ~lanes_.blackToMove[l_];
+    }
+
+    //-----------------------------------------------------------------------------
+    void Replay(std::span<Game> games, Kernel kernel) {
+        MaskFinder const findMasks = Finder(kernel);
+        for (auto const& game : games)
+            if (game.ordinals.size() < game.moves.size())
+                throw std::invalid_argument("Fewer ordinals than moves");
+
+        Lanes                        lanes;
+        Masks                        masks;
+        std::array<Game*, kLanes>    playing{};
+        std::array<size_t, kLanes>   ply{};
+        size_t                       next = 0;
+
+        for (;;) {
+            // a lane takes the next game that it can start
+            size_t busy = 0;
+            for (size_t l = 0; l < kLanes; ++l) {
+                while (!playing[l] && next < games.size()) {
+                    Game& game    = games[next++];
+                    game.replayed = game.moves.empty();
+                    if (!game.replayed && Position(lanes, masks, l).load(game.start)) {
+                        playing[l] = &game;
+                        ply[l]     = 0;
+                    }
+                }
+                busy += playing[l] != nullptr;
+            }
+            if (!busy)
+                break;
+
+            findMasks(lanes, masks);
+
+            for (size_t l = 0; l < kLanes; ++l) {
+                if (!playing[l])
+                    continue;
+                Game&    game = *playing[l];
+                Position position(lanes, masks, l);
+
+                Move const* move = position.generate() ? position.resolve(game.moves[ply[l]]) : nullptr;
+                if (!move) {
+                    playing[l] = nullptr; // left to the converter
+                    continue;
+                }
+                game.ordinals[ply[l]] = position.ordinal(*move);
+                position.play(*move);
+
+                if (++ply[l] == game.moves.size()) {
+                    game.replayed = true;
+                    playing[l]    = nullptr;
+                }
+            }
+        }
+    }
+} // namespace pgn2pgc::Batch
@@ -0,0 +1,55 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////
+//	PgcBatch.h
+//
+//	Replays the moves of many games at once, experimental.
+//
+//	The converter finds the ordinal of a move one game at a time: Board
+//	generates the legal moves with their SAN, sorts them, resolves the SAN
+//	of the move and looks it up.  Replay advances kLanes games in lockstep
+//	instead, their positions held as bitboards in a struct of arrays.  What
+//	makes a move legal, the squares the other side attacks, the pieces that
+//	give check and the pieces that are pinned, is found for all lanes at once
+//	by Kogge-Stone fills, with AVX-512, AVX2, or a loop over the lanes.  The
+//	moves of each lane are then generated from these masks, the SAN resolved
+//	as Board::resolveSAN does it, and the ordinal is the number of legal
+//	moves whose SAN, and then from square, sort before that of the move, with
+//	no sort nor string.  A lane takes the next game when its game is done.
+//
+//	The ordinals are those of the converter, quirks of Board included, e.g.
+//	the castling rights are lost only by moving the king or the rook.  A game
+//	is left to the converter if one of its moves does not resolve, e.g. an
+//	illegal one, or if it gets to a position Replay does not take: a side to
+//	move without a king or with more than one, a pawn on the first or last
+//	rank, castling rights with the king on the back rank but not on its
+//	square, or en passant captures allowed on every file.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <cstdint>
+#include <span>
+#include <stdexcept>
+#include <string_view>
+
+#include "chess_2.h"
+
+namespace pgn2pgc::Batch {
+    static constexpr size_t kLanes = 8; // games in lockstep, one __m512i of bitboards
+
+    // how the masks of the lanes are found
+    enum class Kernel { scalar, avx2, avx512 };
+
+    // the best kernel of the build, which is compiled for the instruction sets -march enables
+    Kernel NativeKernel();
+    bool   IsSupported(Kernel);
+
+    struct Game {
+        Chess::Board                      start;            // the position before the first move
+        std::span<std::string_view const> moves;            // SAN, as the converter reads them
+        std::span<uint8_t>                ordinals;         // as many as moves, written by Replay
+        bool                              replayed = false; // set by Replay if all the ordinals were written
+    };
+
+    // throws std::invalid_argument if the kernel is not supported
+    void Replay(std::span<Game> games, Kernel kernel = NativeKernel());
+} // namespace pgn2pgc::Batch
@@ -0,0 +1,415 @@
+#include "pgccoder.h"
+#include <algorithm>
+#include <cassert>
+#include <numeric>
+#include <span>
+#include <utility>
+
+#include "pgcformat.h"
+
+namespace pgn2pgc::Pgc {
+    using namespace Chess;
+    using enum Occupant;
+
+    static constexpr uint32_t kTop = 1 << 24; // renormalize when the range drops below
+
+    void RangeEncoder::encode(uint32_t start, uint32_t size, uint32_t total) {
+        assert(size && start + size <= total && total <= kMaxTotal);
+        range_ /= total;
+        low_ += uint64_t(start) * range_;
+        range_ *= size;
+        while (range_ < kTop) {
+            range_ <<= 8;
+            shiftLow();
+        }
+    }
+
+    // propagates a pending carry into the cached bytes before writing them
+    void RangeEncoder::shiftLow() {
+        if (uint32_t(low_) < 0xFF000000u || (low_ >> 32) != 0) {
+            auto const carry = static_cast<uint8_t>(low_ >> 32);
+            auto       temp  = cache_;
+            do {
+                if (!std::exchange(first_, false))
+                    out_ += static_cast<char>(uint8_t(temp + carry));
+                temp = 0xFF;
+            } while (--cacheSize_ != 0);
+            cache_ = static_cast<uint8_t>(low_ >> 24);
+        }
+        ++cacheSize_;
+        low_ = (low_ & 0x00FFFFFF) << 8;
+    }
+
+    std::string RangeEncoder::finish() {
+        // any value in [low, low + range) will do, pick the one that ends in the most zero bytes;
+        // range >= kTop, so there always is a multiple of kTop
+        for (uint64_t mask = 0xFFFFFFFF;; mask >>= 8) {
+            if (uint64_t const v = (low_ + mask) & ~mask; v < low_ + range_) {
+                low_ = v;
+                break;
+            }
+        }
+        for (int i = 0; i < 5; ++i)
+            shiftLow();
+
+        while (!out_.empty() && out_.back() == '\0')
+            out_.pop_back();
+
+        auto coded = std::move(out_);
+        *this      = {};
+        return coded;
+    }
+
+    RangeDecoder::RangeDecoder(char const* begin, char const* end) : p_(begin), end_(end) {
+        for (int i = 0; i < 4; ++i)
+            code_ = (code_ << 8) | next();
+    }
+
+    uint32_t RangeDecoder::target(uint32_t total) {
+        range_ /= total;
+        return std::min(code_ / range_, total - 1);
+    }
+
+    void RangeDecoder::consume(uint32_t start, uint32_t size) {
+        code_ -= start * range_;
+        range_ *= size;
+        while (range_ < kTop) {
+            code_ = (code_ << 8) | next();
+            range_ <<= 8;
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+    static constexpr uint16_t kIncrement = 32;     // weight of an observed symbol
+    static constexpr uint32_t kRescale   = 60'000; // halve the counts above this total
+
+    MoveModel::MoveModel() {
+        for (auto& f : freq_)
+            for (unsigned r = 0; r < kSymbols; ++r)
+                f[r] = static_cast<uint16_t>(4096 / (r + 1));
+
+        total_.fill(std::accumulate(freq_[0].begin(), freq_[0].end(), 0u));
+    }
+
+    unsigned MoveModel::context(Board const& board, size_t legalMoves) {
+        bool const inCheck = board.Status() == GameStatus::inCheck;
+        return std::min<size_t>(legalMoves, 63) / 8 * 2 + inCheck;
+    }
+
+    static int PieceValue(Occupant pc) {
+        switch (pc) {
+            case whitePawn:
+            case blackPawn: return 1;
+            case whiteKnight:
+            case blackKnight:
+            case whiteBishop:
+            case blackBishop: return 3;
+            case whiteRook:
+            case blackRook: return 5;
+            case whiteQueen:
+            case blackQueen: return 9;
+            default: return 0;
+        }
+    }
+
+    // piece square tables from white's point of view, the 8th rank first; the values are those
+    // of the well known "simplified evaluation function", they only need to rank quiet moves
+    using SquareTable = std::array<int8_t, gRanks * gFiles>;
+
+    // clang-format off
+    static constexpr SquareTable kPawnSquares = {
+          0,   0,   0,   0,   0,   0,   0,   0,
+         50,  50,  50,  50,  50,  50,  50,  50,
+         10,  10,  20,  30,  30,  20,  10,  10,
+          5,   5,  10,  25,  25,  10,   5,   5,
+          0,   0,   0,  20,  20,   0,   0,   0,
+          5,  -5, -10,   0,   0, -10,  -5,   5,
+          5,  10,  10, -20, -20,  10,  10,   5,
+          0,   0,   0,   0,   0,   0,   0,   0,
+    };
+    static constexpr SquareTable kKnightSquares = {
+        -50, -40, -30, -30, -30, -30, -40, -50,
+        -40, -20,   0,   0,   0,   0, -20, -40,
+        -30,   0,  10,  15,  15,  10,   0, -30,
+        -30,   5,  15,  20,  20,  15,   5, -30,
+        -30,   0,  15,  20,  20,  15,   0, -30,
+        -30,   5,  10,  15,  15,  10,   5, -30,
+        -40, -20,   0,   5,   5,   0, -20, -40,
+        -50, -40, -30, -30, -30, -30, -40, -50,
+    };
+    static constexpr SquareTable kBishopSquares = {
+        -20, -10, -10, -10, -10, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,  10,  10,   5,   0, -10,
+        -10,   5,   5,  10,  10,   5,   5, -10,
+        -10,   0,  10,  10,  10,  10,   0, -10,
+        -10,  10,  10,  10,  10,  10,  10, -10,
+        -10,   5,   0,   0,   0,   0,   5, -10,
+        -20, -10, -10, -10, -10, -10, -10, -20,
+    };
+    static constexpr SquareTable kRookSquares = {
+          0,   0,   0,   0,   0,   0,   0,   0,
+          5,  10,  10,  10,  10,  10,  10,   5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+         -5,   0,   0,   0,   0,   0,   0,  -5,
+          0,   0,   0,   5,   5,   0,   0,   0,
+    };
+    static constexpr SquareTable kQueenSquares = {
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+        -10,   0,   0,   0,   0,   0,   0, -10,
+        -10,   0,   5,   5,   5,   5,   0, -10,
+         -5,   0,   5,   5,   5,   5,   0,  -5,
+          0,   0,   5,   5,   5,   5,   0,  -5,
+        -10,   5,   5,   5,   5,   5,   0, -10,
+        -10,   0,   5,   0,   0,   0,   0, -10,
+        -20, -10, -10,  -5,  -5, -10, -10, -20,
+    };
+    static constexpr SquareTable kKingSquares = {
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -30, -40, -40, -50, -50, -40, -40, -30,
+        -20, -30, -30, -40, -40, -30, -30, -20,
+        -10, -20, -20, -20, -20, -20, -20, -10,
+         20,  20,   0,   0,   0,   0,  20,  20,
+         20,  30,  10,   0,   0,  10,  30,  20,
+    };
+    // clang-format on
+
+    static int SquareValue(Occupant pc, RankFile rf) {
+        SquareTable const* table = nullptr;
+        switch (pc) {
+            case whitePawn:
+            case blackPawn: table = &kPawnSquares; break;
+            case whiteKnight:
+            case blackKnight: table = &kKnightSquares; break;
+            case whiteBishop:
+            case blackBishop: table = &kBishopSquares; break;
+            case whiteRook:
+            case blackRook: table = &kRookSquares; break;
+            case whiteQueen:
+            case blackQueen: table = &kQueenSquares; break;
+            case whiteKing:
+            case blackKing: table = &kKingSquares; break;
+            default: return 0;
+        }
+        int const row = Square(pc).isWhite() ? gRanks - 1 - rf.rank : rf.rank;
+        return (*table)[row * gFiles + rf.file];
+    }
+
+    // the value of the cheapest piece of each side that attacks a square, 0 if there is none
+    struct Attacks {
+        static constexpr int kKingValue = 20;
+
+        std::array<std::array<int8_t, gRanks * gFiles>, 2> cheapest{}; // [white][square]
+        std::array<RankFile, 2>                            king{};     // [white]
+
+        explicit Attacks(Board const& board) {
+            static constexpr RankFile kKnight[]   = {{1, 2}, {2, 1}, {-1, 2}, {-2, 1},
+                                                     {1, -2}, {2, -1}, {-1, -2}, {-2, -1}};
+            static constexpr RankFile kDiagonal[] = {{1, 1}, {-1, 1}, {-1, -1}, {1, -1}};
+            static constexpr RankFile kStraight[] = {{1, 0}, {0, 1}, {-1, 0}, {0, -1}};
+
+            for (int rank = 0; rank < gRanks; ++rank) {
+                for (int file = 0; file < gFiles; ++file) {
+                    RankFile const from{rank, file};
+                    Occupant const pc = board.squareAt(from).contents();
+                    if (pc == noPiece)
+                        continue;
+
+                    bool const white  = Square(pc).isWhite();
+                    bool const isKing = pc == whiteKing || pc == blackKing;
+                    int const  value  = isKing ? kKingValue : PieceValue(pc);
+                    if (isKing)
+                        king[white] = from;
+
+                    // returns whether a slider can go on
+                    auto const add = [&](RankFile to) {
+                        if (to.rank < 0 || to.rank >= gRanks || to.file < 0 || to.file >= gFiles)
+                            return false;
+                        auto& c = cheapest[white][to.rank * gFiles + to.file];
+                        if (c == 0 || c > value)
+                            c = static_cast<int8_t>(value);
+                        return board.squareAt(to).isEmpty();
+                    };
+                    auto const slide = [&](std::span<RankFile const> dirs, bool far) {
+                        for (auto d : dirs)
+                            for (RankFile to = from + d; add(to) && far; to = to + d) {}
+                    };
+
+                    switch (pc) {
+                        case whitePawn:
+                            add(from + RankFile{1, -1});
+                            add(from + RankFile{1, 1});
+                            break;
+                        case blackPawn:
+                            add(from + RankFile{-1, -1});
+                            add(from + RankFile{-1, 1});
+                            break;
+                        case whiteKnight:
+                        case blackKnight: slide(kKnight, false); break;
+                        case whiteBishop:
+                        case blackBishop: slide(kDiagonal, true); break;
+                        case whiteRook:
+                        case blackRook: slide(kStraight, true); break;
+                        default: // queen and king
+                            slide(kDiagonal, !isKing);
+                            slide(kStraight, !isKing);
+                            break;
+                    }
+                }
+            }
+        }
+
+        int by(bool white, RankFile rf) const { return cheapest[white][rf.rank * gFiles + rf.file]; }
+    };
+
+    // does the moved piece attack the enemy king from its new square? discovered checks are missed
+    static bool GivesCheck(Board const& board, ChessMove const& m, RankFile king) {
+        RankFile const d        = king - m.to();
+        RankFile const step     = {(d.rank > 0) - (d.rank < 0), (d.file > 0) - (d.file < 0)};
+        bool const     diagonal = d.rank != 0 && (d.rank == d.file || d.rank == -d.file);
+        bool const     straight = (d.rank == 0) != (d.file == 0);
+
+        auto const clear = [&] {
+            for (RankFile rf = m.to() + step; rf != king; rf = rf + step)
+                if (rf != m.from() && !board.squareAt(rf).isEmpty())
+                    return false;
+            return true;
+        };
+
+        switch (m.type() == ChessMove::promoQueen ? whiteQueen : m.actor()) {
+            case whitePawn: return d.rank == 1 && (d.file == 1 || d.file == -1);
+            case blackPawn: return d.rank == -1 && (d.file == 1 || d.file == -1);
+            case whiteKnight:
+            case blackKnight: return d.rank * d.rank + d.file * d.file == 5;
+            case whiteBishop:
+            case blackBishop: return diagonal && clear();
+            case whiteRook:
+            case blackRook: return straight && clear();
+            case whiteQueen:
+            case blackQueen: return (diagonal || straight) && clear();
+            default: return false;
+        }
+    }
+
+    // what the piece on rf, worth value, stands to lose there
+    static int Threat(Attacks const& attacks, bool white, RankFile rf, int value) {
+        int const enemy = attacks.by(!white, rf);
+        if (enemy == 0)
+            return 0;
+        if (attacks.by(white, rf) == 0)
+            return value;
+        return std::max(0, value - enemy);
+    }
+
+    // a static guess at how likely the move is to be played, higher is more likely
+    static int MoveScore(Board const& board, Attacks const& attacks, ChessMove const& m, RankFile lastTo) {
+        int const  attacker = PieceValue(m.actor());
+        bool const white    = Square(m.actor()).isWhite();
+        int        score    = 2 * (SquareValue(m.actor(), m.to()) - SquareValue(m.actor(), m.from()));
+
+        score +=
+            40 * Threat(attacks, white, m.from(), attacker) - 60 * Threat(attacks, white, m.to(), attacker);
+        if (GivesCheck(board, m, attacks.king[!white]))
+            score += 75;
+        if (m.isCapture()) {
+            int const victim = m.isEnPassant() ? 1 : PieceValue(board.squareAt(m.to()).contents());
+            score += 50 + victim * 50 + (m.to() == lastTo ? 100 : 0); // recaptures are likely
+        }
+
+        switch (m.type()) {
+            case ChessMove::promoQueen: return score + 800;
+            case ChessMove::whiteCastleKS:
+            case ChessMove::blackCastleKS: return score + 100;
+            case ChessMove::whiteCastleQS:
+            case ChessMove::blackCastleQS: return score + 20;
+            case ChessMove::normal:
+            case ChessMove::whiteEnPassant:
+            case ChessMove::blackEnPassant: return score;
+            default: return score - 300; // under promotion
+        }
+    }
+
+    void MoveModel::rank(Board const& board, OrderedMoveList const& legal, Order& order) const {
+        std::array<int, kSymbols> score;
+        auto const                n = legal.bysan.size();
+        Attacks const             attacks(board);
+        for (size_t i = 0; i < n; ++i) {
+            order[i] = static_cast<uint8_t>(i);
+            score[i] = MoveScore(board, attacks, legal.bysan[i].move(), lastTo_);
+        }
+        std::stable_sort(order.begin(), order.begin() + n,
+                         [&](uint8_t a, uint8_t b) { return score[a] > score[b]; });
+    }
+
+    void MoveModel::update(unsigned ctx, unsigned symbol) {
+        auto& f = freq_[ctx];
+        f[symbol] += kIncrement;
+        total_[ctx] += kIncrement;
+        if (total_[ctx] > kRescale) {
+            total_[ctx] = 0;
+            for (auto& v : f)
+                total_[ctx] += v = (v + 1) / 2;
+        }
+    }
+
+    void MoveModel::encode(RangeEncoder& rc, Board const& board, OrderedMoveList const& legal,
+                           unsigned ordinal) {
+        auto const n = legal.bysan.size();
+        assert(ordinal < n && n <= kSymbols);
+        if (n == 1) {
+            lastTo_ = legal.bysan[0].move().to();
+            return; // nothing to tell
+        }
+
+        Order order;
+        rank(board, legal, order);
+
+        auto const  ctx = context(board, n);
+        auto const& f   = freq_[ctx];
+
+        uint32_t start = 0, total = 0, r = 0;
+        for (unsigned i = 0; i < n; ++i) {
+            if (order[i] == ordinal) {
+                r     = i;
+                start = total;
+            }
+            total += f[i];
+        }
+        rc.encode(start, f[r], total);
+        update(ctx, r);
+        lastTo_ = legal.bysan[ordinal].move().to();
+    }
+
+    unsigned MoveModel::decode(RangeDecoder& rc, Board const& board, OrderedMoveList const& legal) {
+        auto const n = legal.bysan.size();
+        if (n == 0 || n > kSymbols)
+            throw FormatError("Coded move without legal moves");
+        if (n == 1) {
+            lastTo_ = legal.bysan[0].move().to();
+            return 0;
+        }
+
+        Order order;
+        rank(board, legal, order);
+
+        auto const  ctx   = context(board, n);
+        auto const& f     = freq_[ctx];
+        uint32_t    total = std::accumulate(f.begin(), f.begin() + n, 0u);
+
+        auto const target = rc.target(total);
+        uint32_t   start  = 0;
+        unsigned   r      = 0;
+        while (start + f[r] <= target)
+            start += f[r++];
+
+        rc.consume(start, f[r]);
+        update(ctx, r);
+        lastTo_ = legal.bysan[order[r]].move().to();
+        return order[r];
+    }
+} // namespace pgn2pgc::Pgc
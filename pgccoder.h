@@ -0,0 +1,84 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////
+//	PgcCoder.h
+//
+//	Entropy coding of move ordinals (kExtCodedMoves).
+//
+//	A plain PGC spends a byte per move, although the decoder knows the legal
+//	moves and most of them are rarely played.  MoveModel ranks the legal moves
+//	with a cheap static heuristic (piece square tables, captures, recaptures,
+//	checks, pieces left en prise) and codes the rank of the move played with an
+//	adaptive frequency table, chosen by the number of legal moves and whether
+//	the side to move is in check.  The model starts from the same prior for
+//	every game, so games still decode independently.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <array>
+#include <cstdint>
+#include <string>
+
+#include "chess_2.h"
+
+namespace pgn2pgc::Pgc {
+    // LZMA style range coder; the total of the frequencies must stay below kMaxTotal
+    class RangeEncoder {
+      public:
+        static constexpr uint32_t kMaxTotal = 1 << 16;
+
+        void encode(uint32_t start, uint32_t size, uint32_t total);
+
+        // the coded bytes, trailing zero bytes are left off (RangeDecoder supplies them)
+        std::string finish();
+
+      private:
+        void shiftLow();
+
+        uint64_t    low_       = 0;
+        uint32_t    range_     = 0xFFFFFFFF;
+        uint8_t     cache_     = 0;
+        uint64_t    cacheSize_ = 1;
+        bool        first_     = true; // the first byte is always 0 and not written
+        std::string out_;
+    };
+
+    class RangeDecoder {
+      public:
+        RangeDecoder(char const* begin, char const* end);
+
+        uint32_t target(uint32_t total); // the cumulative frequency of the next symbol
+        void     consume(uint32_t start, uint32_t size);
+
+      private:
+        uint8_t next() { return p_ != end_ ? static_cast<uint8_t>(*p_++) : 0; }
+
+        char const* p_;
+        char const* end_;
+        uint32_t    range_ = 0xFFFFFFFF;
+        uint32_t    code_  = 0;
+    };
+
+    class MoveModel {
+      public:
+        MoveModel();
+
+        // ordinal is the index of the move in legal.bysan
+        void     encode(RangeEncoder& rc, Chess::Board const& board, Chess::OrderedMoveList const& legal,
+                        unsigned ordinal);
+        unsigned decode(RangeDecoder& rc, Chess::Board const& board, Chess::OrderedMoveList const& legal);
+
+      private:
+        static constexpr unsigned kSymbols = 256, kContexts = 16;
+
+        using Order = std::array<uint8_t, kSymbols>; // rank -> ordinal
+
+        static unsigned context(Chess::Board const& board, size_t legalMoves);
+        void            rank(Chess::Board const& board, Chess::OrderedMoveList const& legal,
+                             Order& order) const;
+
+        void update(unsigned ctx, unsigned symbol);
+
+        std::array<std::array<uint16_t, kSymbols>, kContexts> freq_;
+        std::array<uint32_t, kContexts>                       total_; // of all kSymbols
+        Chess::RankFile                                      lastTo_{-1, -1}; // of the previous move
+    };
+} // namespace pgn2pgc::Pgc
@@ -0,0 +1,228 @@
+#include "pgcformat.h"
+#include <array>
+#include <charconv>
+#include <istream>
+#include <ostream>
+#include <ranges>
+#include <vector>
+
+namespace pgn2pgc::Pgc {
+    void PutVarint(std::ostream& os, uint64_t v) {
+        for (; v >= 0x80; v >>= 7)
+            os.put(static_cast<char>(v | 0x80));
+        os.put(static_cast<char>(v));
+    }
+
+    uint64_t GetVarint(char const*& p, char const* end) {
+        uint64_t v = 0;
+        for (unsigned shift = 0; shift < 64; shift += 7) {
+            if (p == end)
+                throw FormatError("Truncated varint");
+            auto const byte = static_cast<unsigned char>(*p++);
+            v |= uint64_t(byte & 0x7f) << shift;
+            if (!(byte & 0x80))
+                return v;
+        }
+        throw FormatError("Varint too long");
+    }
+
+    namespace {
+        constexpr uint8_t  kDateYear = 1, kDateMonth = 2, kDateDay = 4, kDateEscape = 0xff;
+        constexpr uint64_t kRoundEscape = 0, kRoundUnknown = 1, kRoundNone = 2;
+        constexpr uint8_t  kResultEscape = 0xff;
+
+        constexpr std::array<std::string_view, 4> kResults = {"*", "1-0", "0-1", "1/2-1/2"};
+
+        // only digits, or only question marks
+        // sets known if it is all digits
+        bool IsDateField(std::string_view field, bool& known) {
+            known = std::ranges::all_of(field, [](char c) { return c >= '0' && c <= '9'; });
+            return known || std::ranges::all_of(field, [](char c) { return c == '?'; });
+        }
+
+        unsigned ToNumber(std::string_view digits) {
+            unsigned n = 0;
+            std::from_chars(digits.data(), digits.data() + digits.size(), n);
+            return n;
+        }
+
+        // appends n, zero padded to width
+        void AppendNumber(std::string& s, uint64_t n, size_t width) {
+            char buf[20];
+            auto end = std::to_chars(buf, buf + sizeof(buf), n).ptr;
+            s.append(width > size_t(end - buf) ? width - (end - buf) : 0, '0').append(buf, end);
+        }
+
+        uint8_t GetByte(char const*& p, char const* end) {
+            if (p == end)
+                throw FormatError("Truncated compact tag");
+            return static_cast<uint8_t>(*p++);
+        }
+    } // namespace
+
+    // "yyyy.mm.dd", every field is either all digits or all question marks
+    bool PutCompactDate(std::ostream& os, std::string_view date) {
+        bool year = false, month = false, day = false;
+        if (date.size() != 10 || date[4] != '.' || date[7] != '.' || !IsDateField(date.substr(0, 4), year) ||
+            !IsDateField(date.substr(5, 2), month) || !IsDateField(date.substr(8, 2), day)) {
+            os.put(static_cast<char>(kDateEscape));
+            return false;
+        }
+
+        os.put(static_cast<char>((year ? kDateYear : 0) | (month ? kDateMonth : 0) | (day ? kDateDay : 0)));
+        if (year)
+            PutLE<uint16_t>(os, ToNumber(date.substr(0, 4)));
+        if (month)
+            os.put(static_cast<char>(ToNumber(date.substr(5, 2))));
+        if (day)
+            os.put(static_cast<char>(ToNumber(date.substr(8, 2))));
+        return true;
+    }
+
+    bool GetCompactDate(char const*& p, char const* end, std::string& date) {
+        auto const flags = GetByte(p, end);
+        if (flags == kDateEscape)
+            return false;
+        if (flags & ~(kDateYear | kDateMonth | kDateDay))
+            throw FormatError("Invalid compact date");
+
+        date.clear();
+        if (flags & kDateYear) {
+            if (end - p < 2)
+                throw FormatError("Truncated compact date");
+            AppendNumber(date, GetLE<uint16_t>(p), 4);
+            p += 2;
+        } else {
+            date += "????";
+        }
+        date += '.';
+        if (flags & kDateMonth)
+            AppendNumber(date, GetByte(p, end), 2);
+        else
+            date += "??";
+        date += '.';
+        if (flags & kDateDay)
+            AppendNumber(date, GetByte(p, end), 2);
+        else
+            date += "??";
+        return true;
+    }
+
+    // "?", "-" or dot separated numbers without leading zeros, e.g. "3.1"
+    bool PutCompactRound(std::ostream& os, std::string_view round) {
+        if (round == "?" || round == "-") {
+            PutVarint(os, round == "?" ? kRoundUnknown : kRoundNone);
+            return true;
+        }
+
+        std::vector<uint64_t> parts;
+        for (auto&& part : std::views::split(round, '.')) {
+            std::string_view digits(part.begin(), part.end());
+            uint64_t         n = 0;
+            if (digits.empty() || digits.size() > 18 || (digits.size() > 1 && digits[0] == '0') ||
+                std::from_chars(digits.data(), digits.data() + digits.size(), n).ptr !=
+                    digits.data() + digits.size()) {
+                PutVarint(os, kRoundEscape);
+                return false;
+            }
+            parts.push_back(n);
+        }
+        if (parts.empty()) { // empty string
+            PutVarint(os, kRoundEscape);
+            return false;
+        }
+
+        PutVarint(os, parts.size() + kRoundNone);
+        for (auto n : parts)
+            PutVarint(os, n);
+        return true;
+    }
+
+    bool GetCompactRound(char const*& p, char const* end, std::string& round) {
+        switch (auto const header = GetVarint(p, end)) {
+            case kRoundEscape: return false;
+            case kRoundUnknown: round.assign(1, '?'); return true;
+            case kRoundNone: round.assign(1, '-'); return true;
+            default:
+                round.clear();
+                for (auto n = header - kRoundNone; n--;) {
+                    AppendNumber(round, GetVarint(p, end), 1);
+                    if (n)
+                        round += '.';
+                }
+                return true;
+        }
+    }
+
+    bool PutCompactResult(std::ostream& os, std::string_view result) {
+        auto const it = std::ranges::find(kResults, result);
+        os.put(static_cast<char>(it == kResults.end() ? kResultEscape : it - kResults.begin()));
+        return it != kResults.end();
+    }
+
+    bool GetCompactResult(char const*& p, char const* end, std::string& result) {
+        auto const code = GetByte(p, end);
+        if (code == kResultEscape)
+            return false;
+        if (code >= kResults.size())
+            throw FormatError("Invalid compact result");
+        result = kResults[code];
+        return true;
+    }
+
+    uint32_t StringTable::id(std::string_view value) {
+        if (auto it = ids_.find(value); it != ids_.end())
+            return it->second;
+
+        auto const next = static_cast<uint32_t>(values_.size());
+        ids_.emplace(values_.emplace_back(value), next);
+        return next;
+    }
+
+    std::string const& StringTable::operator[](uint64_t id) const {
+        if (id >= values_.size())
+            throw FormatError("String id out of range");
+        return values_[id];
+    }
+
+    void StringTable::write(std::ostream& os, uint64_t offset) const {
+        os << kMarkerStringTable;
+        PutVarint(os, values_.size());
+        for (auto& value : values_) {
+            PutVarint(os, value.length());
+            os << value;
+        }
+        PutLE<uint64_t>(os, offset);
+        os.write(kMagic, sizeof(kMagic));
+    }
+
+    StringTable StringTable::read(std::istream& pgc) {
+        char footer[kFooterSize];
+        pgc.clear();
+        if (!pgc.seekg(-std::streamoff(kFooterSize), std::ios::end) || !pgc.read(footer, kFooterSize) ||
+            !std::equal(kMagic, kMagic + sizeof(kMagic), footer + 8))
+            throw FormatError("No string table");
+
+        auto const offset = GetLE<uint64_t>(footer);
+        auto const end    = static_cast<uint64_t>(pgc.tellg()) - kFooterSize;
+        if (offset >= end)
+            throw FormatError("Corrupt string table footer");
+
+        std::string raw(end - offset, '\0');
+        if (!pgc.seekg(offset) || !pgc.read(raw.data(), raw.size()) || raw[0] != kMarkerStringTable)
+            throw FormatError("Corrupt string table");
+
+        StringTable table;
+        char const* p = raw.data() + 1;
+        char const* e = raw.data() + raw.size();
+        for (auto count = GetVarint(p, e); count--;) {
+            auto const length = GetVarint(p, e);
+            if (length > size_t(e - p))
+                throw FormatError("Truncated string table");
+            table.id({p, length});
+            p += length;
+        }
+        pgc.clear();
+        return table;
+    }
+} // namespace pgn2pgc::Pgc
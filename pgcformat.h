@@ -0,0 +1,140 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////
+//	PgcFormat.h
+//
+//	Markers and building blocks of the PGC format, shared by the writer and
+//	the readers.
+//
+//	The standard format is what pgn2pgc writes by default.  The extended
+//	format is opt-in: a game starts with kMarkerGameDataBeginExt followed by
+//	a byte of Extension flags that says how the rest of that game record is
+//	encoded, so every game can still be decoded on its own.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <bit>
+#include <cstdint>
+#include <deque>
+#include <ostream>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace pgn2pgc::Pgc {
+    //!!? Possible expansion (not covered in PGN standard document):
+    //  support for comments
+    //  special markers for supplementary tags, instead of kMarkerTagPair
+    // additional markers for strings that now only can have 255 length or only 2
+    // byte length to have choice (like short and long move sequence) change result
+    // tag to one byte // remove length info as well remove date length info (it's
+    // always the same) and change to byte sequence (e.g. int-2 year int-2 month
+    // int-1 day)
+    //
+    // string tables and binary Date, Round and Result are now available in the
+    // extended format, see Extension
+
+    [[maybe_unused]] //
+    static int8_t const kMarkerBeginGameReduced  = 0x01;
+    static int8_t const kMarkerTagPair           = 0x02;
+    static int8_t const kMarkerShortMoveSequence = 0x03;
+    static int8_t const kMarkerLongMoveSequence  = 0x04;
+    static int8_t const kMarkerGameDataBegin     = 0x05;
+    static int8_t const kMarkerGameDataEnd       = 0x06;
+    static int8_t const kMarkerSimpleNAG         = 0x07;
+    static int8_t const kMarkerRAVBegin          = 0x08;
+    static int8_t const kMarkerRAVEnd            = 0x09;
+    static int8_t const kMarkerEscape            = 0x0a;
+    // extended format
+    // with kExtCodedMoves the count of a move sequence is followed by a varint
+    // byte length and the range coded ordinals instead of one byte per move
+    static int8_t const kMarkerGameDataBeginExt = 0x0b; // followed by the Extension flags
+    static int8_t const kMarkerStringTable      = 0x0c; // trailer, see StringTable
+
+    enum Extension : uint8_t {
+        kExtStringTable = 0x01, // tag names and values are varint ids into the file's StringTable
+        kExtCompactTags = 0x02, // Date, Round and Result are binary, see PutCompactDate() etc.
+        kExtCodedMoves  = 0x04, // move sequences are range coded, see MoveModel
+
+        kExtAll = kExtStringTable | kExtCompactTags | kExtCodedMoves,
+    };
+
+    struct FormatError : std::runtime_error {
+        FormatError(std::string_view msg) : std::runtime_error(std::string(msg)) {}
+    };
+
+    template <std::unsigned_integral T> void PutLE(std::ostream& os, T v) {
+        if constexpr (std::endian::native == std::endian::big)
+            v = std::byteswap(v);
+        os.write(reinterpret_cast<char const*>(&v), sizeof(v));
+    }
+
+    template <std::unsigned_integral T> T GetLE(char const* p) {
+        T v;
+        std::copy_n(p, sizeof(v), reinterpret_cast<char*>(&v));
+        if constexpr (std::endian::native == std::endian::big)
+            v = std::byteswap(v);
+        return v;
+    }
+
+    // LEB128: 7 bits per byte, least significant first, high bit set on all but the last
+    void     PutVarint(std::ostream& os, uint64_t v);
+    uint64_t GetVarint(char const*& p, char const* end); // throws FormatError
+
+    //-----------------------------------------------------------------------------
+    // kExtCompactTags
+    //
+    // Date:   u8 flags (1 year, 2 month, 4 day known) [u16 year] [u8 month] [u8 day]
+    // Round:  varint n: 1 "?", 2 "-", n > 2 is n - 2 dot separated varints
+    // Result: u8 0 "*", 1 "1-0", 2 "0-1", 3 "1/2-1/2"
+    //
+    // Only values that decode back to exactly the same text are made compact;
+    // for anything else an escape is written (0xff, 0, 0xff respectively) and
+    // the value follows as an ordinary string.
+    //
+    // The Put functions return false if they wrote the escape, the Get
+    // functions return false if they read it.
+    bool PutCompactDate(std::ostream& os, std::string_view date);
+    bool PutCompactRound(std::ostream& os, std::string_view round);
+    bool PutCompactResult(std::ostream& os, std::string_view result);
+
+    // throw FormatError
+    bool GetCompactDate(char const*& p, char const* end, std::string& date);
+    bool GetCompactRound(char const*& p, char const* end, std::string& round);
+    bool GetCompactResult(char const*& p, char const* end, std::string& result);
+
+    //-----------------------------------------------------------------------------
+    // Every distinct string gets an id in order of first use. The table is
+    // written once, after the last game:
+    //
+    //   kMarkerStringTable varint count count * { varint length, bytes }
+    //   u64 offset of kMarkerStringTable, "PGCS"
+    //
+    // so a reader with random access (see PgcIndex) loads it once from the end
+    // of the file and can then decode any game.
+    class StringTable {
+      public:
+        static constexpr char   kMagic[4]   = {'P', 'G', 'C', 'S'};
+        static constexpr size_t kFooterSize = 12;
+
+        uint32_t id(std::string_view value); // adds value if it is new
+
+        size_t             size() const { return values_.size(); }
+        void               clear() { values_.clear(), ids_.clear(); }
+        std::string const& operator[](uint64_t id) const; // throws FormatError
+
+        // offset is where the table starts in the output, i.e. the bytes written so far
+        void write(std::ostream& os, uint64_t offset) const;
+
+        // looks for the footer at the end of pgc, throws FormatError if there is none
+        static StringTable read(std::istream& pgc);
+
+      private:
+        struct Hash : std::hash<std::string_view> {
+            using is_transparent = void;
+        };
+
+        std::deque<std::string>                                              values_; // stable addresses
+        std::unordered_map<std::string_view, uint32_t, Hash, std::equal_to<>> ids_;
+    };
+} // namespace pgn2pgc::Pgc
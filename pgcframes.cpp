@@ -0,0 +1,312 @@
+#include "pgcframes.h"
+#include "pgcformat.h"
+#include "stpwatch.h"
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <sstream>
+#include <thread>
+
+namespace pgn2pgc::Frames {
+    using Pgc::GetLE;
+    using Pgc::GetVarint;
+    using Pgc::PutLE;
+    using Pgc::PutVarint;
+
+    //-----------------------------------------------------------------------------
+    // A sequence is a token (literal count << 4 | match length - kMinMatch), the
+    // literals, a u16 offset back from the current position and the match.  A
+    // count of 15 continues in the following bytes, 255 at a time.  The last
+    // sequence has literals only.
+    static constexpr size_t   kMinMatch     = 4;
+    static constexpr size_t   kLastLiterals = 5;  // no match ends this close to the end
+    static constexpr size_t   kMatchLimit   = 12; // and none starts this close, LZ4 decoders copy ahead
+    static constexpr size_t   kWindow       = 0xFFFF;
+    static constexpr unsigned kHashBits     = 14;
+
+    static uint32_t Read32(char const* p) {
+        uint32_t v;
+        std::memcpy(&v, p, sizeof(v));
+        return v;
+    }
+
+    static unsigned Hash(uint32_t v) { return (v * 2654435761u) >> (32 - kHashBits); }
+
+    static void PutLength(std::string& out, size_t length) {
+        for (; length >= 255; length -= 255)
+            out += '\xff';
+        out += static_cast<char>(length);
+    }
+
+    std::string Compress(std::string_view raw) {
+        std::string out;
+        out.reserve(raw.size() / 2 + 16);
+
+        auto const sequence = [&](char const* literals, size_t count, size_t offset, size_t match) {
+            size_t const m = match ? match - kMinMatch : 0;
+            out += static_cast<char>(std::min<size_t>(count, 15) << 4 | std::min<size_t>(m, 15));
+            if (count >= 15)
+                PutLength(out, count - 15);
+            out.append(literals, count);
+            if (!match)
+                return;
+            out += static_cast<char>(offset & 0xFF);
+            out += static_cast<char>(offset >> 8);
+            if (m >= 15)
+                PutLength(out, m - 15);
+        };
+
+        char const* const begin  = raw.data();
+        char const* const end    = begin + raw.size();
+        char const*       anchor = begin; // first literal not yet written
+
+        if (raw.size() > kMatchLimit) { // a smaller block is all literals
+            std::vector<uint32_t> table(size_t(1) << kHashBits, 0); // position + 1, 0 is empty
+            char const* const     limit     = end - kLastLiterals;
+            char const* const     lastMatch = end - kMatchLimit; // where the last match may start
+
+            for (char const* p = begin; p <= lastMatch;) {
+                uint32_t const v    = Read32(p);
+                auto&          slot = table[Hash(v)];
+                char const*    cand = slot ? begin + slot - 1 : nullptr;
+                slot                = static_cast<uint32_t>(p - begin + 1);
+
+                if (!cand || size_t(p - cand) > kWindow || Read32(cand) != v) {
+                    ++p;
+                    continue;
+                }
+
+                char const* q = p + kMinMatch;
+                for (char const* c = cand + kMinMatch; q < limit && *q == *c; ++q, ++c) {}
+
+                sequence(anchor, p - anchor, p - cand, q - p);
+                p = anchor = q;
+            }
+        }
+        sequence(anchor, end - anchor, 0, 0);
+        return out;
+    }
+
+    std::string Decompress(std::string_view compressed, size_t rawSize) {
+        std::string out;
+        out.reserve(rawSize);
+
+        char const* p   = compressed.data();
+        char const* end = p + compressed.size();
+
+        auto const byte = [&]() -> uint8_t {
+            if (p == end)
+                throw FramesError("Truncated frame");
+            return static_cast<uint8_t>(*p++);
+        };
+        auto const length = [&](size_t n) {
+            if (n == 15)
+                for (uint8_t b = 255; b == 255; n += b)
+                    b = byte();
+            return n;
+        };
+
+        while (p != end) {
+            uint8_t const token    = byte();
+            size_t const  literals = length(token >> 4);
+            if (literals > size_t(end - p) || out.size() + literals > rawSize)
+                throw FramesError("Corrupt frame");
+            out.append(p, literals);
+            p += literals;
+            if (p == end)
+                break;
+
+            size_t const offset = byte() | size_t(byte()) << 8;
+            size_t const match  = length(token & 0x0F) + kMinMatch;
+            if (offset == 0 || offset > out.size() || out.size() + match > rawSize)
+                throw FramesError("Corrupt frame");
+            for (size_t from = out.size() - offset, i = 0; i < match; ++i) // may overlap
+                out += out[from + i];
+        }
+
+        if (out.size() != rawSize)
+            throw FramesError("Corrupt frame");
+        return out;
+    }
+
+    //-----------------------------------------------------------------------------
+    static std::string Pack(std::string payload) {
+        auto compressed = TIMED(Compress(payload));
+        return compressed.size() < payload.size() ? compressed : payload;
+    }
+
+    FrameWriter::FrameWriter(std::ostream& os, size_t gamesPerFrame)
+        : os_(os)
+        , gamesPerFrame_(std::max<size_t>(gamesPerFrame, 1))
+        , maxPending_(std::max(std::thread::hardware_concurrency(), 1u)) {
+        os_.write(kMagic, sizeof(kMagic));
+        PutLE<uint32_t>(os_, kVersion);
+    }
+
+    void FrameWriter::add(std::string_view record) {
+        lengths_.push_back(static_cast<uint32_t>(record.size()));
+        records_ += record;
+        if (lengths_.size() == gamesPerFrame_)
+            flushFrame();
+    }
+
+    void FrameWriter::flushFrame() {
+        std::ostringstream payload(std::ios::binary);
+        PutVarint(payload, lengths_.size());
+        for (auto length : lengths_)
+            PutVarint(payload, length);
+        payload << records_;
+
+        Entry entry;
+        entry.firstGame = games_;
+        entry.games     = static_cast<uint32_t>(lengths_.size());
+        entry.rawSize   = static_cast<uint32_t>(payload.view().size());
+        if (entry.rawSize != payload.view().size())
+            throw FramesError("Frame too large, use fewer games per frame");
+
+        games_ += lengths_.size();
+        lengths_.clear();
+        records_.clear();
+
+        if (pending_.size() == maxPending_)
+            writeOldest();
+        pending_.push_back({entry, std::async(std::launch::async, Pack, std::move(payload).str())});
+    }
+
+    void FrameWriter::writeOldest() {
+        auto [entry, compressed] = std::move(pending_.front());
+        pending_.pop_front();
+
+        auto const frame = compressed.get();
+        entry.offset     = offset_;
+        entry.size       = static_cast<uint32_t>(frame.size());
+        os_ << frame;
+        offset_ += frame.size();
+        entries_.push_back(entry);
+    }
+
+    void FrameWriter::finish(std::string_view trailer) {
+        if (!lengths_.empty())
+            flushFrame();
+        if (!trailer.empty()) {
+            records_ = trailer; // a frame without games
+            flushFrame();
+        }
+        while (!pending_.empty())
+            writeOldest();
+
+        for (auto& [offset, size, rawSize, firstGame, games] : entries_) {
+            PutLE<uint64_t>(os_, offset);
+            PutLE<uint32_t>(os_, size);
+            PutLE<uint32_t>(os_, rawSize);
+            PutLE<uint64_t>(os_, firstGame);
+            PutLE<uint32_t>(os_, games);
+        }
+        PutLE<uint64_t>(os_, offset_);
+        PutLE<uint32_t>(os_, static_cast<uint32_t>(entries_.size()));
+        os_.write(kMagic, sizeof(kMagic));
+    }
+
+    //-----------------------------------------------------------------------------
+    PgcFrames::PgcFrames(std::filesystem::path const& name) {
+        std::ifstream is(name, std::ios::binary);
+        if (!is)
+            throw FramesError("Unable to open " + name.string());
+        *this = PgcFrames(is);
+    }
+
+    PgcFrames::PgcFrames(std::istream& is) {
+        char header[kHeaderSize], footer[kFooterSize];
+        is.clear();
+        if (!is.seekg(0) || !is.read(header, kHeaderSize) ||
+            !std::equal(kMagic, kMagic + sizeof(kMagic), header) ||
+            !is.seekg(-std::streamoff(kFooterSize), std::ios::end) || !is.read(footer, kFooterSize) ||
+            !std::equal(kMagic, kMagic + sizeof(kMagic), footer + 12))
+            throw FramesError("Not a PGC frame container");
+        if (GetLE<uint32_t>(header + 4) != kVersion)
+            throw FramesError("Unsupported PGC frame container version");
+
+        auto const table  = GetLE<uint64_t>(footer);
+        auto const frames = GetLE<uint32_t>(footer + 8);
+        auto const end    = static_cast<uint64_t>(is.tellg()) - kFooterSize;
+        if (table < kHeaderSize || table > end || (end - table) / kEntrySize != frames)
+            throw FramesError("Corrupt PGC frame table");
+
+        std::string raw(end - table, '\0');
+        if (!is.seekg(table) || !is.read(raw.data(), raw.size()))
+            throw FramesError("Corrupt PGC frame table");
+
+        entries_.resize(frames);
+        char const* p = raw.data();
+        for (auto& [offset, size, rawSize, firstGame, games] : entries_) {
+            offset    = GetLE<uint64_t>(p);
+            size      = GetLE<uint32_t>(p + 8);
+            rawSize   = GetLE<uint32_t>(p + 12);
+            firstGame = GetLE<uint64_t>(p + 16);
+            games     = GetLE<uint32_t>(p + 24);
+            if (firstGame != games_ || offset + size > table)
+                throw FramesError("Corrupt PGC frame table");
+            games_ += games;
+            p += kEntrySize;
+        }
+    }
+
+    size_t PgcFrames::frameOf(size_t game) const {
+        if (game >= games_)
+            throw FramesError("No game " + std::to_string(game) + " in PGC frame container");
+        // the trailer frame has no games and comes last, it is never found
+        return std::ranges::upper_bound(entries_, game, {}, &Entry::firstGame) - entries_.begin() - 1;
+    }
+
+    std::string PgcFrames::payload(std::istream& pgc, size_t frame) const {
+        auto const e = entry(frame);
+
+        std::string compressed(e.size, '\0');
+        pgc.clear();
+        if (!pgc.seekg(e.offset) || !pgc.read(compressed.data(), e.size))
+            throw FramesError("Unable to read frame " + std::to_string(frame));
+        return e.size == e.rawSize ? compressed : Decompress(compressed, e.rawSize);
+    }
+
+    std::vector<std::string> PgcFrames::readFrame(std::istream& pgc, size_t frame) const {
+        auto const  raw = payload(pgc, frame);
+        char const* p   = raw.data();
+        char const* end = p + raw.size();
+
+        auto const corrupt = [&] { return FramesError("Corrupt frame " + std::to_string(frame)); };
+        try {
+            if (GetVarint(p, end) != entry(frame).games)
+                throw corrupt();
+
+            std::vector<uint64_t> lengths(entry(frame).games);
+            for (auto& length : lengths)
+                length = GetVarint(p, end);
+
+            std::vector<std::string> records;
+            for (auto length : lengths) {
+                if (length > size_t(end - p))
+                    throw corrupt();
+                records.emplace_back(p, length);
+                p += length;
+            }
+            return records;
+        } catch (Pgc::FormatError const&) {
+            throw corrupt();
+        }
+    }
+
+    std::string PgcFrames::readGame(std::istream& pgc, size_t game) const {
+        auto const frame = frameOf(game);
+        return std::move(readFrame(pgc, frame).at(game - entry(frame).firstGame));
+    }
+
+    std::string PgcFrames::readTrailer(std::istream& pgc) const {
+        if (entries_.empty() || entries_.back().games != 0)
+            return {};
+        auto const raw = payload(pgc, entries_.size() - 1);
+        if (raw.empty() || raw[0] != 0) // varint 0 games
+            throw FramesError("Corrupt trailer frame");
+        return raw.substr(1);
+    }
+} // namespace pgn2pgc::Frames
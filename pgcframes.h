@@ -0,0 +1,117 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////
+//	PgcFrames.h
+//
+//	Seekable block compressed container for PGC databases.
+//
+//	Compressing a whole .pgc loses random access.  The container instead
+//	compresses frames of a fixed number of games independently, and a frame
+//	table at the end records where each frame starts and which game comes
+//	first in it, so one game costs decompressing a single frame.  Frames are
+//	compressed in parallel while the PGN is still being converted.
+//
+//	Layout (all integers little endian):
+//	  "PGCZ" u32 version
+//	  frames: compressed payload, or stored as is if that is not smaller
+//	  frame table: frames * { u64 offset, u32 size, u32 raw size,
+//	                          u64 first game, u32 games }   (kEntrySize bytes each)
+//	  u64 offset of the frame table, u32 frames, "PGCZ"    (kFooterSize bytes)
+//
+//	The payload of a frame is
+//	  varint games, games * varint record length, the game records
+//	and the last frame may hold no games but the trailer of the PGC stream,
+//	i.e. the string table of the extended format.  The trailer is written as
+//	a stream of its own, so StringTable::read works on it as it is.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pgn2pgc::Frames {
+    static constexpr char     kMagic[4]     = {'P', 'G', 'C', 'Z'};
+    static constexpr uint32_t kVersion      = 1;
+    static constexpr size_t   kHeaderSize   = 8;
+    static constexpr size_t   kEntrySize    = 28;
+    static constexpr size_t   kFooterSize   = 16;
+    static constexpr size_t   kDefaultGames = 1000; // per frame
+
+    struct FramesError : std::runtime_error {
+        FramesError(std::string_view msg) : std::runtime_error(std::string(msg)) {}
+    };
+
+    struct Entry {
+        uint64_t offset    = 0; // where the compressed frame starts
+        uint32_t size      = 0; // compressed size, the frame is stored if it equals rawSize
+        uint32_t rawSize   = 0; // size of the payload
+        uint64_t firstGame = 0; // number of the first game in the frame, counting from 0
+        uint32_t games     = 0;
+    };
+
+    // LZ77 with a 64 KiB window, in the block format of LZ4
+    std::string Compress(std::string_view raw);
+    std::string Decompress(std::string_view compressed, size_t rawSize); // throws FramesError
+
+    class FrameWriter {
+      public:
+        // the header is written right away
+        FrameWriter(std::ostream& os, size_t gamesPerFrame = kDefaultGames);
+
+        void add(std::string_view record);
+
+        // writes the remaining frames, trailer in a frame of its own, and the frame table
+        // throws FramesError
+        void finish(std::string_view trailer = {});
+
+      private:
+        void flushFrame();
+        void writeOldest(); // waits for the oldest pending frame
+
+        struct Pending {
+            Entry                    entry;
+            std::future<std::string> compressed;
+        };
+
+        std::ostream&         os_;
+        size_t                gamesPerFrame_;
+        size_t                maxPending_; // frames being compressed at the same time
+        uint64_t              offset_ = kHeaderSize;
+        uint64_t              games_  = 0;
+        std::vector<uint32_t> lengths_; // of the games in the current frame
+        std::string           records_;
+        std::deque<Pending>   pending_;
+        std::vector<Entry>    entries_;
+    };
+
+    // the frame table is held in memory, a game is found with a binary search
+    class PgcFrames {
+      public:
+        explicit PgcFrames(std::filesystem::path const& name); // throws FramesError
+        explicit PgcFrames(std::istream& is);                  // throws FramesError
+
+        size_t games() const { return games_; }
+        size_t frames() const { return entries_.size(); }
+        Entry  entry(size_t frame) const { return entries_.at(frame); }
+        size_t frameOf(size_t game) const; // throws FramesError
+
+        // throw FramesError
+        // the game records of a frame, in order
+        std::vector<std::string> readFrame(std::istream& pgc, size_t frame) const;
+        // decompresses the frame holding the game, returns the record including its markers
+        std::string readGame(std::istream& pgc, size_t game) const;
+        // what followed the last game in the PGC stream, empty if nothing did
+        std::string readTrailer(std::istream& pgc) const;
+
+      private:
+        std::string payload(std::istream& pgc, size_t frame) const;
+
+        std::vector<Entry> entries_;
+        uint64_t           games_ = 0;
+    };
+} // namespace pgn2pgc::Frames
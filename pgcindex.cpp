@@ -0,0 +1,91 @@
+#include "pgcindex.h"
+#include "pgcformat.h"
+#include <climits>
+#include <fstream>
+#include <iterator>
+
+namespace pgn2pgc::Index {
+    using Pgc::GetLE;
+    using Pgc::PutLE;
+
+    void IndexWriter::add(uint64_t offset, uint32_t length, KeyTagViews const& tags) {
+        entries_.push_back({offset, length, heap_.size()});
+        for (auto tag : tags) {
+            tag = tag.substr(0, UCHAR_MAX); // the .pgc has the same limitation
+            heap_ += static_cast<char>(tag.length());
+            heap_ += tag;
+        }
+    }
+
+    void IndexWriter::write(std::ostream& os) const {
+        os.write(kMagic, sizeof(kMagic));
+        PutLE<uint32_t>(os, kVersion);
+        PutLE<uint64_t>(os, entries_.size());
+        for (auto& [offset, length, tags] : entries_) {
+            PutLE<uint64_t>(os, offset);
+            PutLE<uint32_t>(os, length);
+            PutLE<uint64_t>(os, tags);
+        }
+        os << heap_;
+    }
+
+    void IndexWriter::write(std::filesystem::path const& name) const {
+        std::ofstream os(name, std::ios::trunc | std::ios::binary);
+        write(os);
+        if (!os.flush())
+            throw IndexError("Unable to write index " + name.string());
+    }
+
+    PgcIndex::PgcIndex(std::filesystem::path const& name) {
+        std::ifstream is(name, std::ios::binary);
+        if (!is)
+            throw IndexError("Unable to open index " + name.string());
+        *this = PgcIndex(is);
+    }
+
+    PgcIndex::PgcIndex(std::istream& is) {
+        std::string const raw{std::istreambuf_iterator<char>(is), {}};
+
+        if (raw.size() < kHeaderSize || !raw.starts_with(std::string_view(kMagic, sizeof(kMagic))))
+            throw IndexError("Not a PGC index");
+        if (GetLE<uint32_t>(raw.data() + 4) != kVersion)
+            throw IndexError("Unsupported PGC index version");
+
+        auto const games = GetLE<uint64_t>(raw.data() + 8);
+        if (games > (raw.size() - kHeaderSize) / kEntrySize)
+            throw IndexError("Truncated PGC index");
+
+        entries_.resize(games);
+        char const* p = raw.data() + kHeaderSize;
+        for (auto& [offset, length, tags] : entries_) {
+            offset = GetLE<uint64_t>(p);
+            length = GetLE<uint32_t>(p + 8);
+            tags   = GetLE<uint64_t>(p + 12);
+            p += kEntrySize;
+        }
+        heap_.assign(p, raw.data() + raw.size());
+    }
+
+    KeyTags PgcIndex::tags(size_t game) const {
+        KeyTags result;
+        size_t  pos = entry(game).tags;
+        for (auto& tag : result) {
+            if (pos >= heap_.size())
+                throw IndexError("Corrupt PGC index tag heap");
+            size_t const length = static_cast<unsigned char>(heap_[pos++]);
+            tag                 = heap_.substr(pos, length);
+            pos += length;
+        }
+        return result;
+    }
+
+    std::string PgcIndex::readGame(std::istream& pgc, size_t game) const {
+        auto const [offset, length, _] = entry(game);
+
+        std::string record(length, '\0');
+        pgc.clear();
+        if (!pgc.seekg(offset) || !pgc.read(record.data(), length))
+            throw IndexError("Unable to read game " + std::to_string(game) + " from PGC");
+        return record;
+    }
+} // namespace pgn2pgc::Index
@@ -0,0 +1,81 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////
+//	PgcIndex.h
+//
+//	Random access sidecar (.pgci) for PGC databases.
+//
+//	A .pgc file is a flat concatenation of game records, so finding game N
+//	means parsing every game before it.  The index records where each game
+//	record starts, how long it is, and the seven tag roster values so that
+//	catalogues can be built without touching the .pgc at all.
+//
+//	Layout (all integers little endian):
+//	  "PGCI" u32 version u64 games
+//	  games * { u64 offset, u32 length, u64 tags }   (kEntrySize bytes each)
+//	  tag heap: per game, kNumKeyTags * { u8 length, bytes }
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pgn2pgc::Index {
+    // the seven tag roster, in PGC output order
+    enum KeyTag { event, site, date, round, white, black, result, kNumKeyTags };
+
+    using KeyTags     = std::array<std::string, kNumKeyTags>;
+    using KeyTagViews = std::array<std::string_view, kNumKeyTags>;
+
+    static constexpr char     kMagic[4]   = {'P', 'G', 'C', 'I'};
+    static constexpr uint32_t kVersion    = 1;
+    static constexpr size_t   kHeaderSize = 16;
+    static constexpr size_t   kEntrySize  = 20;
+
+    struct IndexError : std::runtime_error {
+        IndexError(std::string_view msg) : std::runtime_error(std::string(msg)) {}
+    };
+
+    struct Entry {
+        uint64_t offset = 0; // where the game record starts
+        uint32_t length = 0; // size of the game record in bytes
+        uint64_t tags   = 0; // offset of the key tags in the tag heap
+    };
+
+    // collects entries during conversion, writes them out in one go at the end
+    class IndexWriter {
+      public:
+        void add(uint64_t offset, uint32_t length, KeyTagViews const& tags);
+
+        size_t size() const { return entries_.size(); }
+
+        void write(std::ostream& os) const;
+        void write(std::filesystem::path const& name) const; // throws IndexError
+
+      private:
+        std::vector<Entry> entries_;
+        std::string        heap_;
+    };
+
+    // the whole index is held in memory; every lookup is O(1)
+    class PgcIndex {
+      public:
+        explicit PgcIndex(std::filesystem::path const& name); // throws IndexError
+        explicit PgcIndex(std::istream& is);                  // throws IndexError
+
+        size_t  size() const { return entries_.size(); }
+        Entry   entry(size_t game) const { return entries_.at(game); }
+        KeyTags tags(size_t game) const;
+
+        // seeks straight to the game record, returns it including its markers
+        std::string readGame(std::istream& pgc, size_t game) const; // throws IndexError
+
+      private:
+        std::vector<Entry> entries_;
+        std::string        heap_;
+    };
+} // namespace pgn2pgc::Index
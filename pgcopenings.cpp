@@ -0,0 +1,243 @@
+#include "pgcopenings.h"
+#include "pgcformat.h"
+#include "pgcpositions.h"
+#include "stpwatch.h"
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <sstream>
+#include <thread>
+
+namespace pgn2pgc::Openings {
+    using Pgc::GetLE;
+    using Pgc::GetVarint;
+    using Pgc::PutLE;
+    using Pgc::PutVarint;
+
+    Result ParseResult(std::string_view result) {
+        if (result == "1-0")
+            return Result::white;
+        if (result == "0-1")
+            return Result::black;
+        if (result == "1/2-1/2")
+            return Result::draw;
+        return Result::other;
+    }
+
+    void Tally::add(Result result) {
+        switch (result) {
+            case Result::white: ++white; break;
+            case Result::draw: ++draws; break;
+            case Result::black: ++black; break;
+            case Result::other: ++other; break;
+        }
+    }
+
+    //-----------------------------------------------------------------------------
+    // the low bits of the hash, the top ones are the shard's; the ordinal spreads the moves of a position
+    static size_t SlotOf(uint64_t position, uint8_t ordinal, size_t mask) {
+        return (position + ordinal * 0x9E37'79B9'7F4A'7C15) & mask;
+    }
+
+    void TreeBuilder::Table::add(Record const& record) {
+        size_t const mask = slots_.size() - 1;
+        for (size_t i = SlotOf(record.position, record.ordinal, mask);; i = (i + 1) & mask) {
+            auto& slot = slots_[i];
+            if (slot.position == record.position && slot.ordinal == record.ordinal && slot.tally.games()) {
+                slot.tally.add(record.result);
+                return;
+            }
+            if (!slot.tally.games()) {
+                slot = {record.position, {}, record.ordinal};
+                slot.tally.add(record.result);
+                if (++used_ * 2 > slots_.size())
+                    grow();
+                return;
+            }
+        }
+    }
+
+    void TreeBuilder::Table::grow() {
+        std::vector<Slot> old(slots_.size() * 2);
+        old.swap(slots_);
+        size_t const mask = slots_.size() - 1;
+        for (auto const& slot : old)
+            if (slot.tally.games()) {
+                size_t i = SlotOf(slot.position, slot.ordinal, mask);
+                while (slots_[i].tally.games())
+                    i = (i + 1) & mask;
+                slots_[i] = slot;
+            }
+    }
+
+    std::vector<std::pair<uint64_t, MoveStats>> TreeBuilder::Table::sorted() {
+        std::vector<std::pair<uint64_t, MoveStats>> moves;
+        moves.reserve(used_);
+        for (auto const& slot : slots_)
+            if (slot.tally.games())
+                moves.push_back({slot.position, {slot.ordinal, slot.tally}});
+        slots_ = {};
+        used_  = 0;
+        std::ranges::sort(moves, {},
+                          [](auto const& move) { return std::pair(move.first, move.second.ordinal); });
+        return moves;
+    }
+
+    //-----------------------------------------------------------------------------
+    TreeBuilder::TreeBuilder(unsigned plies, size_t shards)
+        : plies_(plies)
+        , shards_(std::bit_ceil(shards ? shards : std::max(std::thread::hardware_concurrency(), 1u))) {
+        shift_ = 64 - std::countr_zero(shards_.size()); // 64 with one shard, which C++ does not shift by
+    }
+
+    TreeBuilder::~TreeBuilder() {
+        for (auto& shard : shards_)
+            if (shard.job.valid())
+                shard.job.wait(); // an exception is write's to report
+    }
+
+    void TreeBuilder::add(std::span<uint64_t const> positions, std::string_view ordinals, Result result) {
+        size_t const moves = std::min<size_t>(std::min(ordinals.size(), positions.size() - 1), plies_);
+        for (size_t ply = 0; ply < moves; ++ply) {
+            uint64_t const position = positions[ply];
+            auto&          shard    = shards_[shift_ < 64 ? position >> shift_ : 0];
+            shard.batch.push_back({position, static_cast<uint8_t>(ordinals[ply]), result});
+        }
+        buffered_ += moves;
+        ++games_;
+        if (buffered_ >= kBatchMoves)
+            flushBatches();
+    }
+
+    void TreeBuilder::flushBatches() {
+        for (auto& shard : shards_) {
+            if (shard.batch.empty())
+                continue;
+            if (shard.job.valid())
+                shard.job.get(); // the shard's table is the job's until then
+            shard.job = std::async(std::launch::async,
+                                   [&table = shard.table, batch = std::move(shard.batch)] {
+                                       for (auto const& record : batch)
+                                           table.add(record);
+                                   });
+            shard.batch = {};
+        }
+        buffered_ = 0;
+    }
+
+    void TreeBuilder::wait() {
+        flushBatches();
+        for (auto& shard : shards_)
+            if (shard.job.valid())
+                shard.job.get();
+    }
+
+    void TreeBuilder::write(std::filesystem::path const& name) {
+        std::ofstream os(name, std::ios::trunc | std::ios::binary);
+        write(os);
+        if (!os.flush())
+            throw OpeningsError("Unable to write opening tree " + name.string());
+    }
+
+    void TreeBuilder::write(std::ostream& os) {
+        TIMED(wait());
+
+        std::vector<std::vector<std::pair<uint64_t, MoveStats>>> sorted(shards_.size());
+        {
+            std::vector<std::jthread> pool;
+            for (size_t i = 1; i < shards_.size(); ++i)
+                pool.emplace_back([&, i] { sorted[i] = shards_[i].table.sorted(); });
+            sorted[0] = TIMED(shards_[0].table.sorted());
+        }
+
+        uint64_t positions = 0;
+        for (auto const& shard : sorted)
+            for (size_t i = 0; i < shard.size(); ++i)
+                positions += i == 0 || shard[i].first != shard[i - 1].first;
+
+        os.write(kMagic, sizeof(kMagic));
+        PutLE<uint32_t>(os, kVersion);
+        PutLE<uint32_t>(os, plies_);
+        PutLE<uint64_t>(os, positions);
+        for (auto const& shard : sorted) // the shards are in order of hash
+            for (auto first = shard.begin(); first != shard.end();) {
+                auto const last = std::find_if(first, shard.end(),
+                                               [&](auto const& move) { return move.first != first->first; });
+                PutLE<uint64_t>(os, first->first);
+                PutVarint(os, last - first);
+                for (; first != last; ++first) {
+                    auto const& [ordinal, tally] = first->second;
+                    os << static_cast<char>(ordinal);
+                    PutVarint(os, tally.white);
+                    PutVarint(os, tally.draws);
+                    PutVarint(os, tally.black);
+                    PutVarint(os, tally.other);
+                }
+            }
+    }
+
+    //-----------------------------------------------------------------------------
+    OpeningTree::OpeningTree(std::filesystem::path const& name) {
+        {
+            std::ifstream is(name, std::ios::binary);
+            if (!is)
+                throw OpeningsError("Unable to open opening tree " + name.string());
+            std::ostringstream data(std::ios::binary);
+            data << is.rdbuf();
+            data_ = std::move(data).str();
+        }
+        if (data_.size() < kHeaderSize || !std::equal(kMagic, kMagic + sizeof(kMagic), data_.data()))
+            throw OpeningsError("Not a PGC opening tree");
+        if (GetLE<uint32_t>(data_.data() + 4) != kVersion)
+            throw OpeningsError("Unsupported PGC opening tree version");
+        plies_                 = GetLE<uint32_t>(data_.data() + 8);
+        uint64_t const entries = GetLE<uint64_t>(data_.data() + 12);
+
+        // the moves are skipped here, and read when they are asked for
+        char const*       p   = data_.data() + kHeaderSize;
+        char const* const end = data_.data() + data_.size();
+        try {
+            for (uint64_t i = 0; i < entries; ++i) {
+                if (end - p < 8)
+                    throw OpeningsError("Truncated PGC opening tree");
+                uint64_t const hash = GetLE<uint64_t>(p);
+                p += 8;
+                if (!positions_.empty() && hash <= positions_.back().hash)
+                    throw OpeningsError("PGC opening tree out of order");
+                positions_.push_back({hash, static_cast<size_t>(p - data_.data())});
+                auto const moves = GetVarint(p, end);
+                for (uint64_t move = 0; move < moves; ++move) {
+                    if (p++ == end)
+                        throw OpeningsError("Truncated PGC opening tree");
+                    for (int count = 0; count < 4; ++count)
+                        GetVarint(p, end);
+                }
+            }
+        } catch (Pgc::FormatError const&) {
+            throw OpeningsError("Truncated PGC opening tree");
+        }
+    }
+
+    std::vector<MoveStats> OpeningTree::moves(uint64_t hash) const {
+        auto const position = std::ranges::lower_bound(positions_, hash, {}, &Position::hash);
+        if (position == positions_.end() || position->hash != hash)
+            return {};
+
+        // checked when the tree was read
+        char const*            p   = data_.data() + position->offset;
+        char const* const      end = data_.data() + data_.size();
+        std::vector<MoveStats> moves(GetVarint(p, end));
+        for (auto& [ordinal, tally] : moves) {
+            ordinal     = static_cast<uint8_t>(*p++);
+            tally.white = static_cast<uint32_t>(GetVarint(p, end));
+            tally.draws = static_cast<uint32_t>(GetVarint(p, end));
+            tally.black = static_cast<uint32_t>(GetVarint(p, end));
+            tally.other = static_cast<uint32_t>(GetVarint(p, end));
+        }
+        return moves;
+    }
+
+    std::vector<MoveStats> OpeningTree::moves(Chess::Board const& board) const {
+        return moves(Positions::Hash(board));
+    }
+} // namespace pgn2pgc::Openings
@@ -0,0 +1,165 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////
+//	PgcOpenings.h
+//
+//	Opening tree sidecar (.pgct) for PGC databases: for every position of
+//	the first plies of the games, the moves played in it, how often, and
+//	how the games went on by their Result tag.
+//
+//	The converter has the positions and the move ordinals of the main line
+//	of a game in hand as it writes the game, so the tree is added up in the
+//	same pass.  TreeBuilder takes a move as a record of the hash of the
+//	position (Positions::Hash), the ordinal of the move in it and the result
+//	of the game, and hands the records to its shards a batch at a time.  A
+//	shard has the positions whose hash has its top bits, a hash table of
+//	its own and a thread to add the records to it, so the tables need no
+//	locks.  At the end every shard sorts its table on its own thread, and as
+//	the shards hold ranges of hashes one after the other, putting them
+//	together in order is all the merging there is.
+//
+//	A move is known by its ordinal, the place of the move in the legal
+//	moves of the position in the order the converter generates them, as in
+//	the .pgc.
+//
+//	Layout (all integers little endian):
+//	  "PGCT" u32 version u32 plies u64 positions
+//	  positions * { u64 hash, varint moves,
+//	                moves * { u8 ordinal, varint white, varint draws, varint black, varint other } }
+//	the positions sorted by hash, the moves of a position by ordinal.  white,
+//	draws and black count the games with that result, other those with
+//	"*" or no result.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <future>
+#include <iosfwd>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chess_2.h"
+
+namespace pgn2pgc::Openings {
+    static constexpr char     kMagic[4]     = {'P', 'G', 'C', 'T'};
+    static constexpr uint32_t kVersion      = 1;
+    static constexpr size_t   kHeaderSize   = 20;
+    static constexpr unsigned kDefaultPlies = 30;
+    static constexpr size_t   kBatchMoves   = size_t(1) << 16; // records handed to the shards at a time
+
+    struct OpeningsError : std::runtime_error {
+        OpeningsError(std::string_view msg) : std::runtime_error(std::string(msg)) {}
+    };
+
+    enum class Result : uint8_t { white, draw, black, other };
+
+    // of a Result tag
+    Result ParseResult(std::string_view result);
+
+    struct Tally {
+        uint32_t white = 0;
+        uint32_t draws = 0;
+        uint32_t black = 0;
+        uint32_t other = 0;
+
+        uint64_t games() const { return uint64_t(white) + draws + black + other; }
+        void     add(Result result);
+
+        bool operator==(Tally const&) const = default;
+    };
+
+    struct MoveStats {
+        uint8_t ordinal = 0;
+        Tally   tally;
+    };
+
+    class TreeBuilder {
+      public:
+        // shards is rounded up to a power of 2, as many as there are hardware threads if 0
+        explicit TreeBuilder(unsigned plies = kDefaultPlies, size_t shards = 0);
+        ~TreeBuilder();
+
+        TreeBuilder(TreeBuilder const&)            = delete;
+        TreeBuilder& operator=(TreeBuilder const&) = delete;
+
+        // positions are the hashes of those of the game, from its start, one more than there are ordinals
+        void add(std::span<uint64_t const> positions, std::string_view ordinals, Result result);
+
+        // waits for the shards and writes the tree, throws OpeningsError
+        void write(std::filesystem::path const& name);
+        void write(std::ostream& os);
+
+        unsigned plies() const { return plies_; }
+        uint64_t games() const { return games_; }
+
+      private:
+        struct Record {
+            uint64_t position = 0;
+            uint8_t  ordinal  = 0;
+            Result   result   = Result::other;
+        };
+
+        // open addressing, at most half full; a slot is empty if it counts no game
+        class Table {
+          public:
+            void   add(Record const& record);
+            size_t size() const { return used_; }
+
+            // the moves in order of position, then ordinal; the table is left empty
+            std::vector<std::pair<uint64_t, MoveStats>> sorted();
+
+          private:
+            struct Slot {
+                uint64_t position = 0;
+                Tally    tally;
+                uint8_t  ordinal = 0;
+            };
+
+            void grow();
+
+            std::vector<Slot> slots_ = std::vector<Slot>(0x1000); // a power of 2
+            size_t            used_  = 0;
+        };
+
+        struct Shard {
+            Table               table;
+            std::vector<Record> batch;
+            std::future<void>   job; // adding the last batch to the table
+        };
+
+        void flushBatches();
+        void wait(); // for all of the shards
+
+        unsigned           plies_;
+        unsigned           shift_; // a hash's shard is its top bits
+        uint64_t           games_    = 0;
+        size_t             buffered_ = 0; // records in the batches
+        std::vector<Shard> shards_;
+    };
+
+    // the tree is read into memory, the moves of a position are found with a binary search
+    class OpeningTree {
+      public:
+        explicit OpeningTree(std::filesystem::path const& name); // throws OpeningsError
+
+        unsigned plies() const { return plies_; }
+        size_t   size() const { return positions_.size(); }
+
+        // in order of ordinal, none if the position is not in the tree
+        std::vector<MoveStats> moves(uint64_t hash) const;
+        std::vector<MoveStats> moves(Chess::Board const& board) const;
+
+      private:
+        struct Position {
+            uint64_t hash   = 0;
+            size_t   offset = 0; // in data_, of its moves
+        };
+
+        std::string           data_;
+        unsigned              plies_ = 0;
+        std::vector<Position> positions_;
+    };
+} // namespace pgn2pgc::Openings
@@ -0,0 +1,313 @@
+#include "pgcpositions.h"
+#include "pgcformat.h"
+#include "stpwatch.h"
+#include <algorithm>
+#include <bit>
+#include <fstream>
+#include <queue>
+#include <thread>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace pgn2pgc::Positions {
+    using Chess::Board;
+    using Chess::Occupant;
+    using Pgc::GetLE;
+    using Pgc::PutLE;
+
+    static_assert(sizeof(Entry) == kEntrySize); // a run is written as it is in memory
+
+    static constexpr size_t kBlockEntries = size_t(1) << 16; // read or written at a time
+
+    //-----------------------------------------------------------------------------
+    // pieces by colour and type, then square a1, b1, ... h8
+    struct ZobristKeys {
+        uint64_t pieces[12][Chess::gRanks * Chess::gFiles];
+        uint64_t blackToMove;
+        uint64_t castle[4]; // in the order of Board::Castlings
+        uint64_t enPassant[Chess::gFiles];
+    };
+
+    // splitmix64, the keys are part of the format
+    static constexpr ZobristKeys kKeys = [] {
+        ZobristKeys keys{};
+        uint64_t    state = 0x5047'4350'0000'0001;
+        auto const  next  = [&] {
+            uint64_t z = state += 0x9E37'79B9'7F4A'7C15;
+            z          = (z ^ (z >> 30)) * 0xBF58'476D'1CE4'E5B9;
+            z          = (z ^ (z >> 27)) * 0x94D0'49BB'1331'11EB;
+            return z ^ (z >> 31);
+        };
+        for (auto& piece : keys.pieces)
+            for (auto& square : piece)
+                square = next();
+        keys.blackToMove = next();
+        for (auto& right : keys.castle)
+            right = next();
+        for (auto& file : keys.enPassant)
+            file = next();
+        return keys;
+    }();
+
+    uint64_t Hash(Board const& board) {
+        using enum Occupant;
+        auto const is = [&](int rank, int file, Occupant piece) {
+            return board.squareAt({rank, file}).contents() == piece;
+        };
+
+        uint64_t hash = 0;
+        for (int rank = 0; rank < Chess::gRanks; ++rank)
+            for (int file = 0; file < Chess::gFiles; ++file)
+                if (auto const square = board.squareAt({rank, file}); !square.isEmpty()) {
+                    int const piece = (square.isBlack() ? 6 : 0) + std::to_underlying(square.type()) - 1;
+                    hash ^= kKeys.pieces[piece][rank * Chess::gFiles + file];
+                }
+
+        bool const black = board.toMove() == Board::ToMove::black;
+        if (black)
+            hash ^= kKeys.blackToMove;
+
+        // the rights Board keeps, as far as they can still be used
+        unsigned const castle = board.getCastle();
+        if (castle & Board::whiteKS && is(0, 4, whiteKing) && is(0, 7, whiteRook))
+            hash ^= kKeys.castle[0];
+        if (castle & Board::whiteQS && is(0, 4, whiteKing) && is(0, 0, whiteRook))
+            hash ^= kKeys.castle[1];
+        if (castle & Board::blackKS && is(7, 4, blackKing) && is(7, 7, blackRook))
+            hash ^= kKeys.castle[2];
+        if (castle & Board::blackQS && is(7, 4, blackKing) && is(7, 0, blackRook))
+            hash ^= kKeys.castle[3];
+
+        // Board has the file after every double step, a capture needs a pawn beside the one that moved
+        if (int const file = board.enPassant(); file >= 0) {
+            int const      rank = black ? 3 : 4;
+            Occupant const pawn = black ? blackPawn : whitePawn;
+            bool const     beside = (file > 0 && is(rank, file - 1, pawn)) ||
+                                (file < Chess::gFiles - 1 && is(rank, file + 1, pawn));
+            if (beside)
+                hash ^= kKeys.enPassant[file];
+        }
+        return hash;
+    }
+
+    //-----------------------------------------------------------------------------
+    static void WriteEntries(std::ostream& os, std::span<Entry const> entries) {
+        if constexpr (std::endian::native == std::endian::little)
+            os.write(reinterpret_cast<char const*>(entries.data()), entries.size_bytes());
+        else
+            for (auto [hash, game, ply] : entries) {
+                PutLE<uint64_t>(os, hash);
+                PutLE<uint32_t>(os, game);
+                PutLE<uint32_t>(os, ply);
+            }
+    }
+
+    // a sorted run, in memory or in a file read a block at a time
+    class RunReader {
+      public:
+        explicit RunReader(std::span<Entry const> run) : block_(run) {}
+        explicit RunReader(std::filesystem::path const& name) : file_(name, std::ios::binary) {
+            if (!file_)
+                throw PositionsError("Unable to open " + name.string());
+            refill();
+        }
+
+        bool         done() const { return next_ == block_.size(); }
+        Entry const& front() const { return block_[next_]; }
+
+        void pop() {
+            if (++next_ == block_.size() && file_.is_open())
+                refill();
+        }
+
+      private:
+        void refill() {
+            buffer_.resize(kBlockEntries);
+            file_.read(reinterpret_cast<char*>(buffer_.data()), buffer_.size() * sizeof(Entry));
+            buffer_.resize(file_.gcount() / sizeof(Entry));
+            block_ = buffer_;
+            next_  = 0;
+        }
+
+        std::ifstream          file_;
+        std::vector<Entry>     buffer_;
+        std::span<Entry const> block_;
+        size_t                 next_ = 0;
+    };
+
+    //-----------------------------------------------------------------------------
+    PositionWriter::PositionWriter(std::filesystem::path name, size_t runEntries)
+        : name_(std::move(name))
+        , runEntries_(std::max<size_t>(runEntries, 1))
+        , maxPending_(std::max(std::thread::hardware_concurrency(), 1u)) {}
+
+    PositionWriter::~PositionWriter() {
+        for (auto& run : pending_)
+            if (run.valid())
+                run.wait(); // an exception is finish's to report
+        std::error_code ec;
+        for (auto const& run : runs_)
+            std::filesystem::remove(run, ec);
+    }
+
+    void PositionWriter::add(uint32_t game, std::span<uint64_t const> hashes) {
+        for (uint32_t ply = 0; auto hash : hashes) {
+            run_.push_back({hash, game, ply++});
+            if (run_.size() == runEntries_)
+                flushRun();
+        }
+        entries_ += hashes.size();
+    }
+
+    void PositionWriter::flushRun() {
+        auto name = name_;
+        name += ".run" + std::to_string(runs_.size());
+        runs_.push_back(name);
+
+        if (pending_.size() == maxPending_)
+            waitOldest();
+        pending_.push_back(std::async(std::launch::async, [run = std::move(run_), name]() mutable {
+            TIMED(std::ranges::sort(run));
+            std::ofstream os(name, std::ios::trunc | std::ios::binary);
+            os.write(reinterpret_cast<char const*>(run.data()), run.size() * sizeof(Entry));
+            if (!os.flush())
+                throw PositionsError("Unable to write " + name.string());
+        }));
+        run_ = {};
+    }
+
+    void PositionWriter::waitOldest() {
+        auto run = std::move(pending_.front());
+        pending_.pop_front();
+        run.get();
+    }
+
+    void PositionWriter::finish() {
+        while (!pending_.empty())
+            waitOldest();
+
+        // what is left is sorted in as many parts as there are threads, and merged with the runs
+        size_t const parts = std::clamp<size_t>(run_.size() / kBlockEntries, 1, maxPending_);
+        std::vector<std::span<Entry>> chunks;
+        for (size_t i = 0; i < parts; ++i) {
+            size_t const begin = run_.size() * i / parts, end = run_.size() * (i + 1) / parts;
+            chunks.push_back(std::span(run_).subspan(begin, end - begin));
+        }
+        {
+            std::vector<std::jthread> pool;
+            for (size_t i = 1; i < parts; ++i)
+                pool.emplace_back([chunk = chunks[i]] { std::ranges::sort(chunk); });
+            TIMED(std::ranges::sort(chunks[0]));
+        }
+
+        std::vector<RunReader> readers;
+        readers.reserve(runs_.size() + parts); // a reader's block may point into its buffer
+        for (auto const& run : runs_)
+            readers.emplace_back(run);
+        for (auto chunk : chunks)
+            readers.emplace_back(chunk);
+
+        std::ofstream os(name_, std::ios::trunc | std::ios::binary);
+        os.write(kMagic, sizeof(kMagic));
+        PutLE<uint32_t>(os, kVersion);
+        PutLE<uint64_t>(os, entries_);
+
+        auto const later = [&](size_t a, size_t b) { return readers[b].front() < readers[a].front(); };
+        std::priority_queue<size_t, std::vector<size_t>, decltype(later)> next(later);
+        for (size_t i = 0; i < readers.size(); ++i)
+            if (!readers[i].done())
+                next.push(i);
+
+        std::vector<Entry> block;
+        block.reserve(kBlockEntries);
+        TIMER("merge the position runs").timed([&] {
+            while (!next.empty()) {
+                auto const i = next.top();
+                next.pop();
+                block.push_back(readers[i].front());
+                readers[i].pop();
+                if (!readers[i].done())
+                    next.push(i);
+                if (block.size() == kBlockEntries) {
+                    WriteEntries(os, block);
+                    block.clear();
+                }
+            }
+            WriteEntries(os, block);
+        });
+        if (!os.flush())
+            throw PositionsError("Unable to write position index " + name_.string());
+
+        readers.clear();
+        std::error_code ec;
+        for (auto const& run : runs_)
+            std::filesystem::remove(run, ec);
+        runs_.clear();
+        run_ = {};
+    }
+
+    //-----------------------------------------------------------------------------
+    PositionIndex::PositionIndex(std::filesystem::path const& name) {
+        int const fd = ::open(name.c_str(), O_RDONLY);
+        if (fd == -1)
+            throw PositionsError("Unable to open position index " + name.string());
+
+        struct stat st;
+        if (::fstat(fd, &st) == -1 || size_t(st.st_size) < kHeaderSize) {
+            ::close(fd);
+            throw PositionsError("Not a PGC position index");
+        }
+        length_ = st.st_size;
+        void* const mapping = ::mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+        ::close(fd); // the mapping keeps the file
+        if (mapping == MAP_FAILED)
+            throw PositionsError("Unable to map position index " + name.string());
+        data_ = static_cast<char const*>(mapping);
+
+        auto const fail = [&](std::string_view why) {
+            ::munmap(const_cast<char*>(data_), length_);
+            throw PositionsError(why);
+        };
+        if (!std::equal(kMagic, kMagic + sizeof(kMagic), data_))
+            fail("Not a PGC position index");
+        if (GetLE<uint32_t>(data_ + 4) != kVersion)
+            fail("Unsupported PGC position index version");
+        entries_ = GetLE<uint64_t>(data_ + 8);
+        if (entries_ > (length_ - kHeaderSize) / kEntrySize)
+            fail("Truncated PGC position index");
+        ::madvise(const_cast<char*>(data_), length_, MADV_RANDOM);
+    }
+
+    PositionIndex::~PositionIndex() { ::munmap(const_cast<char*>(data_), length_); }
+
+    Entry PositionIndex::entry(size_t i) const {
+        if (i >= entries_)
+            throw std::out_of_range("No position index entry " + std::to_string(i));
+        char const* const p = data_ + kHeaderSize + i * kEntrySize;
+        return {GetLE<uint64_t>(p), GetLE<uint32_t>(p + 8), GetLE<uint32_t>(p + 12)};
+    }
+
+    std::vector<Hit> PositionIndex::find(uint64_t hash) const {
+        auto const key = [&](size_t i) { return GetLE<uint64_t>(data_ + kHeaderSize + i * kEntrySize); };
+
+        size_t first = 0;
+        for (size_t count = entries_; count;) { // lower bound
+            size_t const half = count / 2;
+            if (key(first + half) < hash) {
+                first += half + 1;
+                count -= half + 1;
+            } else
+                count = half;
+        }
+
+        std::vector<Hit> hits;
+        for (size_t i = first; i < entries_ && key(i) == hash; ++i) {
+            auto const [_, game, ply] = entry(i);
+            hits.push_back({game, ply});
+        }
+        return hits;
+    }
+} // namespace pgn2pgc::Positions
@@ -0,0 +1,120 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////
+//	PgcPositions.h
+//
+//	Position index sidecar (.pgcp) for PGC databases: which games reach a
+//	position, and at which ply.
+//
+//	The converter has every position of a game in hand as it makes the
+//	moves, so it hashes the positions of the main line, the one before the
+//	first move included, and PositionWriter collects one entry per position.
+//	The entries are sorted by an external sort, so a database may have more
+//	of them than fit in memory: a run of kRunEntries is sorted and written
+//	to a temporary file next to the index while the conversion goes on, as
+//	many runs at the same time as there are hardware threads, and the runs
+//	are merged into the index at the end.  PositionIndex maps the index and
+//	finds a position with a binary search.
+//
+//	The hash is Zobrist's, with keys of their own, not Polyglot's.  Two
+//	positions are the same if the pieces, the side to move, the castling
+//	rights and the en passant file are.  A castling right counts only with
+//	the king and the rook on their squares, and the en passant file only
+//	with a pawn beside the one that moved, as the converter's Board keeps
+//	both a little longer than that.
+//
+//	Layout (all integers little endian):
+//	  "PGCP" u32 version u64 entries
+//	  entries * { u64 hash, u32 game, u32 ply }   (kEntrySize bytes each)
+//	sorted by hash, then game, then ply.  The game counts from 0 in PGC
+//	order, as in the .pgci, and the ply from 0 at the start of the game.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <future>
+#include <span>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "chess_2.h"
+
+namespace pgn2pgc::Positions {
+    static constexpr char     kMagic[4]   = {'P', 'G', 'C', 'P'};
+    static constexpr uint32_t kVersion    = 1;
+    static constexpr size_t   kHeaderSize = 16;
+    static constexpr size_t   kEntrySize  = 16;
+    static constexpr size_t   kRunEntries = size_t(1) << 22; // sorted in memory at a time, 64 MiB
+
+    struct PositionsError : std::runtime_error {
+        PositionsError(std::string_view msg) : std::runtime_error(std::string(msg)) {}
+    };
+
+    struct Entry {
+        uint64_t hash = 0;
+        uint32_t game = 0;
+        uint32_t ply  = 0;
+
+        constexpr auto operator<=>(Entry const&) const = default;
+    };
+
+    uint64_t Hash(Chess::Board const& board);
+
+    class PositionWriter {
+      public:
+        // the runs are written next to name, and removed by finish or the destructor
+        explicit PositionWriter(std::filesystem::path name, size_t runEntries = kRunEntries);
+        ~PositionWriter();
+
+        PositionWriter(PositionWriter const&)            = delete;
+        PositionWriter& operator=(PositionWriter const&) = delete;
+
+        // hashes are those of the positions of the game, one per ply
+        void add(uint32_t game, std::span<uint64_t const> hashes);
+
+        // merges the runs into the index, throws PositionsError
+        void finish();
+
+      private:
+        void flushRun();
+        void waitOldest(); // for the oldest run being sorted
+
+        std::filesystem::path              name_;
+        size_t                             runEntries_;
+        size_t                             maxPending_; // runs being sorted at the same time
+        uint64_t                           entries_ = 0;
+        std::vector<Entry>                 run_;
+        std::deque<std::future<void>>      pending_;
+        std::vector<std::filesystem::path> runs_; // written, or being written
+    };
+
+    struct Hit {
+        uint32_t game = 0;
+        uint32_t ply  = 0;
+    };
+
+    // the index is mapped, not read; a lookup is a binary search
+    class PositionIndex {
+      public:
+        explicit PositionIndex(std::filesystem::path const& name); // throws PositionsError
+        ~PositionIndex();
+
+        PositionIndex(PositionIndex const&)            = delete;
+        PositionIndex& operator=(PositionIndex const&) = delete;
+
+        size_t size() const { return entries_; }
+        Entry  entry(size_t i) const;
+
+        // in order of game, then ply
+        std::vector<Hit> find(uint64_t hash) const;
+        std::vector<Hit> find(Chess::Board const& board) const { return find(Hash(board)); }
+
+      private:
+        char const* data_    = nullptr; // the mapping, from the header on
+        size_t      length_  = 0;
+        size_t      entries_ = 0;
+    };
+} // namespace pgn2pgc::Positions
@@ -0,0 +1,180 @@
+#include "pgcreader.h"
+#include <optional>
+#include <utility>
+
+#include "pgccoder.h"
+#include "pgcindex.h"
+
+namespace pgn2pgc::Pgc {
+    using Chess::Board;
+    using Chess::OrderedMoveList;
+
+    static constexpr std::string_view kRosterNames[] = {
+        "Event", "Site", "Date", "Round", "White", "Black", "Result",
+    };
+    static_assert(std::size(kRosterNames) == Index::kNumKeyTags);
+
+    uint8_t GameDecoder::byte() {
+        if (p_ == end_)
+            throw FormatError("Truncated game record");
+        return static_cast<uint8_t>(*p_++);
+    }
+
+    uint8_t GameDecoder::peek() const {
+        if (p_ == end_)
+            throw FormatError("Truncated game record");
+        return static_cast<uint8_t>(*p_);
+    }
+
+    std::string_view GameDecoder::bytes(size_t n) {
+        if (n > size_t(end_ - p_))
+            throw FormatError("Truncated game record");
+        return {std::exchange(p_, p_ + n), n};
+    }
+
+    std::string_view GameDecoder::string() {
+        if (extensions_ & kExtStringTable)
+            return (*strings_)[GetVarint(p_, end_)];
+        return bytes(byte());
+    }
+
+    std::string_view GameDecoder::rosterValue(size_t i) {
+        if (extensions_ & kExtCompactTags) {
+            switch (i) {
+                case Index::date:
+                    if (GetCompactDate(p_, end_, compact_))
+                        return compact_;
+                    break;
+                case Index::round:
+                    if (GetCompactRound(p_, end_, compact_))
+                        return compact_;
+                    break;
+                case Index::result:
+                    if (GetCompactResult(p_, end_, compact_))
+                        return compact_;
+                    break;
+                default: break;
+            }
+        }
+        return string();
+    }
+
+    void GameDecoder::decode(char const*& p, char const* end, GameVisitor& visitor) {
+        p_          = p;
+        end_        = end;
+        visitor_    = &visitor;
+        extensions_ = 0;
+
+        switch (byte()) {
+            case kMarkerGameDataBegin: break;
+            case kMarkerGameDataBeginExt: extensions_ = byte(); break;
+            default: throw FormatError("Expected the beginning of a game");
+        }
+        if (extensions_ & ~kExtAll)
+            throw FormatError("Unknown PGC extension");
+        if ((extensions_ & kExtStringTable) && !strings_)
+            throw FormatError("Game needs a string table");
+
+        std::optional<MoveModel> model;
+        if (extensions_ & kExtCodedMoves)
+            model.emplace();
+        model_ = model ? &*model : nullptr;
+
+        Board game;
+        for (size_t i = 0; i < std::size(kRosterNames); ++i)
+            visitor.tag(kRosterNames[i], rosterValue(i));
+
+        while (peek() == kMarkerTagPair) {
+            ++p_;
+            std::string const name(string());
+            auto const        value = string();
+            if (name == "FEN")
+                game.processFEN(value);
+            visitor.tag(name, value);
+        }
+
+        previous_   = game;
+        variations_ = 0;
+        while (peek() != kMarkerGameDataEnd)
+            sequence(game);
+        ++p_;
+
+        model_ = nullptr;
+        p      = p_;
+    }
+
+    // one call of ProcessMoveSequence: a move sequence or a variation, and what ended it
+    void GameDecoder::sequence(Board& board, int depth) {
+        if (depth > kMaxVariationDepth)
+            throw FormatError("Variations nested too deep");
+        char const* const start = p_;
+
+        switch (peek()) {
+            case kMarkerShortMoveSequence:
+            case kMarkerLongMoveSequence: {
+                size_t const n =
+                    byte() == kMarkerShortMoveSequence ? byte() : GetLE<uint16_t>(bytes(2).data());
+
+                std::optional<RangeDecoder> rc;
+                if (model_) {
+                    auto const coded = bytes(GetVarint(p_, end_));
+                    rc.emplace(coded.data(), coded.data() + coded.size());
+                }
+
+                for (size_t i = 0; i < n; ++i) {
+                    OrderedMoveList legal   = board.genLegalMoveSet();
+                    unsigned const  ordinal = model_ ? model_->decode(*rc, board, legal) : byte();
+                    if (ordinal >= legal.bysan.size())
+                        throw FormatError("Move ordinal out of range");
+
+                    auto const& move = legal.bysan[ordinal];
+                    visitor_->move(board, move, ordinal);
+
+                    if (i == n - 1) {
+                        if (peek() == kMarkerRAVBegin) {
+                            ++p_;
+                            ++variations_;
+                            visitor_->ravBegin();
+                            Board temp = board;
+                            sequence(temp, depth + 1);
+                            board.processMove(move.move());
+                            return; // the variation took the place of what ended the sequence
+                        }
+                        previous_ = board;
+                    }
+                    board.processMove(move.move());
+                }
+                break;
+            }
+            case kMarkerRAVBegin:
+                ++p_;
+                ++variations_;
+                visitor_->ravBegin();
+                sequence(previous_, depth + 1);
+                return;
+            default: break;
+        }
+
+        switch (peek()) {
+            case kMarkerRAVEnd:
+                if (!variations_)
+                    throw FormatError("End of a variation that was not begun");
+                ++p_;
+                --variations_;
+                visitor_->ravEnd();
+                break;
+            case kMarkerSimpleNAG:
+                ++p_;
+                visitor_->nag(static_cast<int8_t>(byte()));
+                break;
+            case kMarkerEscape:
+                ++p_;
+                visitor_->escape(bytes(GetLE<uint16_t>(bytes(2).data())));
+                break;
+            default:
+                if (p_ == start && peek() != kMarkerGameDataEnd)
+                    throw FormatError("Unexpected marker in move text");
+                break;
+        }
+    }
+} // namespace pgn2pgc::Pgc
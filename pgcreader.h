@@ -0,0 +1,73 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////
+//	PgcReader.h
+//
+//	Decodes PGC game records, standard or extended, replaying the moves on a
+//	Board so that every ordinal can be turned back into a move.
+//
+//	The decoder mirrors ProcessMoveSequence in pgnpgc3.cpp: a variation that
+//	follows a move sequence starts from the position before its last move, a
+//	variation that follows anything else starts from the position before the
+//	last move of the previous sequence.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <string>
+#include <string_view>
+
+#include "chess_2.h"
+#include "pgcformat.h"
+
+namespace pgn2pgc::Pgc {
+    class MoveModel;
+
+    // receives the contents of a game record in PGC order
+    struct GameVisitor {
+        virtual ~GameVisitor() = default;
+
+        // roster tags come first, with their PGN names; the names of other tags are upper case
+        virtual void tag(std::string_view /*name*/, std::string_view /*value*/) {}
+        // board is the position before the move, ordinal the index of move in its legal move set
+        virtual void move(Chess::Board const& /*board*/, Chess::ChessMoveSAN const& /*move*/,
+                          unsigned /*ordinal*/) {}
+        virtual void nag(int /*value*/) {}
+        virtual void ravBegin() {}
+        virtual void ravEnd() {}
+        virtual void escape(std::string_view /*text*/) {}
+    };
+
+    class GameDecoder {
+      public:
+        // strings is required for games that use kExtStringTable
+        explicit GameDecoder(StringTable const* strings = nullptr) : strings_(strings) {}
+
+        // decodes the game record at p and leaves p just past it
+        // throws FormatError, also for the end of a variation that was not begun, and for variations nested
+        // deeper than kMaxVariationDepth
+        void decode(char const*& p, char const* end, GameVisitor& visitor);
+
+        // a variation is decoded by a recursive call; the converter, which recurses too, runs out of stack
+        // before it writes this deep
+        static constexpr int kMaxVariationDepth = 512;
+
+      private:
+        uint8_t          byte();
+        uint8_t          peek() const;
+        std::string_view bytes(size_t n);
+        std::string_view string();
+        std::string_view rosterValue(size_t i);
+
+        void sequence(Chess::Board& board, int depth = 0); // depth, the variations it is nested in
+
+        StringTable const* strings_;
+
+        // state of the game being decoded
+        Chess::Board previous_;       // as the converter's Variations::previous
+        int          variations_ = 0; // open
+        char const*  p_          = nullptr;
+        char const*  end_        = nullptr;
+        uint8_t      extensions_ = 0;
+        MoveModel*   model_      = nullptr;
+        GameVisitor* visitor_    = nullptr;
+        std::string  compact_; // decoded compact tag
+    };
+} // namespace pgn2pgc::Pgc
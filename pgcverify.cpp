@@ -0,0 +1,244 @@
+#include "pgcverify.h"
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstring>
+#include <fstream>
+#include <mutex>
+#include <span>
+#include <sstream>
+#include <thread>
+
+#include "pgcframes.h"
+#include "pgcreader.h"
+#include "stpwatch.h"
+
+namespace pgn2pgc::Verify {
+    using Chess::Board;
+    using Chess::ChessMoveSAN;
+    using Pgc::StringTable;
+
+    static constexpr size_t kBatchGames = 256; // of a plain .pgc, a frame container is checked by frame
+
+    std::vector<std::string_view> SourceMoves(std::string_view game) {
+        std::vector<std::string_view> moves;
+
+        auto const skipTo = [&](size_t& i, char c) { i = std::min(game.find(c, i), game.size()); };
+
+        for (size_t i = 0; i < game.size();) {
+            auto const c = static_cast<unsigned char>(game[i]);
+            switch (c) {
+                case '{':
+                    skipTo(i, '}');
+                    break;
+                case '[':
+                    skipTo(i, ']');
+                    break;
+                case ';':
+                case '%':
+                    skipTo(i, '\n');
+                    break;
+                default:
+                    if (isspace(c) || strchr("().!?", c)) {
+                        ++i;
+                        continue;
+                    }
+                    // a SAN move ends before a NAG or ')', anything else, e.g. "12." or "$1", after a '.'
+                    size_t const start = i;
+                    auto const   ends  = isalpha(c) ? " \t\r\n).!?" : " \t\r\n).";
+                    while (i < game.size() && !strchr(ends, game[i]))
+                        ++i;
+                    if (isalpha(c))
+                        moves.push_back(game.substr(start, i - start));
+                    continue;
+            }
+            ++i;
+        }
+        return moves;
+    }
+
+    // true if the decoded move is the move of the source SAN
+    static bool SameMove(Board const& board, std::string_view san, ChessMoveSAN const& move) {
+        auto const marked = san.find_first_of("+#"); // the check the decoded SAN has not
+        if (san.substr(0, marked) == move.SAN())
+            return true;
+
+        try {
+            Board position = board;
+            return position.resolveSAN(san, position.genLegalMoveSet().list) == move.move();
+        } catch (Chess::MoveError const&) {
+            return false;
+        }
+    }
+
+    // compares the moves of a record with those of its source, up to the first difference
+    struct MoveChecker : Pgc::GameVisitor {
+        std::span<std::string_view const> expected;
+        uint64_t                          ply = 0;
+        std::optional<Mismatch>           mismatch;
+
+        explicit MoveChecker(std::span<std::string_view const> moves) : expected(moves) {}
+
+        void move(Board const& board, ChessMoveSAN const& move, unsigned) override {
+            if (!mismatch && (ply == expected.size() || !SameMove(board, expected[ply], move))) {
+                mismatch.emplace();
+                mismatch->ply = ply;
+                mismatch->pgc = move.SAN();
+                if (ply < expected.size())
+                    mismatch->source = expected[ply];
+            }
+            ++ply;
+        }
+    };
+
+    // the records of a batch of games and their source
+    struct Batch {
+        uint64_t                 first = 0; // game
+        std::vector<std::string> records;
+    };
+
+    // checks the games of the batch in order, returns the first that differs
+    static std::optional<Mismatch> Check(Batch const& batch, std::istream& pgn,
+                                         std::vector<Source> const& games, Pgc::GameDecoder& decoder) {
+        if (batch.records.empty())
+            return {};
+
+        auto const& front = games[batch.first];
+        auto const& back  = games[batch.first + batch.records.size() - 1];
+        std::string text(back.pgnOffset + back.pgnLength - front.pgnOffset, '\0');
+        pgn.clear();
+        if (!pgn.seekg(front.pgnOffset) || !pgn.read(text.data(), text.size()))
+            throw std::runtime_error("Unable to read game " + std::to_string(batch.first) + " of the PGN");
+
+        for (size_t i = 0; i < batch.records.size(); ++i) {
+            auto const& source = games[batch.first + i];
+            auto const  moves  = SourceMoves(std::string_view(text).substr(source.pgnOffset - front.pgnOffset,
+                                                                          source.pgnLength));
+
+            MoveChecker checker(moves);
+            auto const& record = batch.records[i];
+            char const* p      = record.data();
+            try {
+                decoder.decode(p, record.data() + record.size(), checker);
+                if (p != record.data() + record.size())
+                    throw Pgc::FormatError("Game record too long");
+            } catch (Pgc::FormatError const& e) {
+                checker.mismatch.emplace();
+                checker.mismatch->ply   = checker.ply;
+                checker.mismatch->error = e.what();
+            }
+            if (!checker.mismatch && checker.ply < moves.size()) {
+                checker.mismatch.emplace();
+                checker.mismatch->ply    = checker.ply;
+                checker.mismatch->source = moves[checker.ply];
+            }
+
+            if (checker.mismatch) {
+                checker.mismatch->game      = batch.first + i;
+                checker.mismatch->pgnOffset = source.pgnOffset;
+                return checker.mismatch;
+            }
+        }
+        return {};
+    }
+
+    // the string table at the end of a stream, if there is one
+    static std::optional<StringTable> ReadStrings(std::istream& is) {
+        char magic[sizeof(StringTable::kMagic)];
+        is.clear();
+        if (!is.seekg(-std::streamoff(sizeof(magic)), std::ios::end) || !is.read(magic, sizeof(magic)) ||
+            !std::equal(magic, magic + sizeof(magic), StringTable::kMagic))
+            return {};
+        return StringTable::read(is);
+    }
+
+    std::optional<Mismatch> Verify(std::filesystem::path const& pgn, std::filesystem::path const& pgc,
+                                   std::vector<Source> const& games) {
+        std::ifstream is(pgc, std::ios::binary);
+        if (!is)
+            throw std::runtime_error("Unable to open " + pgc.string());
+        char magic[sizeof(Frames::kMagic)] = {};
+        is.read(magic, sizeof(magic)); // a plain .pgc without games can be shorter
+
+        // a batch is a frame of the container, or kBatchGames records of the plain file
+        std::optional<Frames::PgcFrames> frames;
+        std::optional<StringTable>       strings;
+        size_t                           batches;
+        if (std::equal(magic, magic + sizeof(magic), Frames::kMagic)) {
+            frames.emplace(is);
+            if (frames->games() != games.size())
+                throw std::runtime_error(pgc.string() + " has " + std::to_string(frames->games()) +
+                                         " games, not " + std::to_string(games.size()));
+            std::istringstream trailer(frames->readTrailer(is), std::ios::binary);
+            strings = ReadStrings(trailer);
+            batches = frames->frames();
+        } else {
+            strings = ReadStrings(is);
+            batches = (games.size() + kBatchGames - 1) / kBatchGames;
+        }
+
+        auto const batch = [&](std::istream& pgcStream, size_t n) {
+            Batch b;
+            if (frames) {
+                b.first   = frames->entry(n).firstGame;
+                b.records = frames->readFrame(pgcStream, n);
+                return b;
+            }
+
+            b.first            = n * kBatchGames;
+            auto const& front  = games[b.first];
+            auto const& back   = games[std::min(games.size(), b.first + kBatchGames) - 1];
+            std::string raw(back.pgcOffset + back.pgcLength - front.pgcOffset, '\0');
+            pgcStream.clear();
+            if (!pgcStream.seekg(front.pgcOffset) || !pgcStream.read(raw.data(), raw.size()))
+                throw std::runtime_error("Unable to read game " + std::to_string(b.first) + " of " +
+                                         pgc.string());
+            for (auto game = &front; game <= &back; ++game)
+                b.records.push_back(raw.substr(game->pgcOffset - front.pgcOffset, game->pgcLength));
+            return b;
+        };
+
+        std::atomic<size_t>     next{0};
+        std::atomic<uint64_t>   firstBad{UINT64_MAX}; // batches after it need not be checked
+        std::optional<Mismatch> result;
+        std::exception_ptr      failure;
+        std::mutex              lock;
+
+        auto const worker = [&] {
+            try {
+                std::ifstream    pgnStream(pgn, std::ios::binary), pgcStream(pgc, std::ios::binary);
+                Pgc::GameDecoder decoder(strings ? &*strings : nullptr);
+                if (!pgnStream || !pgcStream)
+                    throw std::runtime_error("Unable to open " + (pgnStream ? pgc : pgn).string());
+
+                for (size_t n; (n = next++) < batches;) {
+                    auto const b = TIMED(batch(pgcStream, n));
+                    if (b.first > firstBad)
+                        break; // batches are taken in order of their games
+                    if (auto mismatch = TIMED(Check(b, pgnStream, games, decoder))) {
+                        std::scoped_lock guard(lock);
+                        if (!result || mismatch->game < result->game) {
+                            result   = std::move(mismatch);
+                            firstBad = result->game;
+                        }
+                    }
+                }
+            } catch (...) {
+                std::scoped_lock guard(lock);
+                if (!failure)
+                    failure = std::current_exception();
+                next = batches; // stops the others
+            }
+        };
+
+        std::vector<std::jthread> pool;
+        for (unsigned t = 1; t < std::min<size_t>(std::thread::hardware_concurrency(), batches); ++t)
+            pool.emplace_back(worker);
+        worker();
+        pool.clear(); // joins
+
+        if (failure)
+            std::rethrow_exception(failure);
+        return result;
+    }
+} // namespace pgn2pgc::Verify
@@ -0,0 +1,57 @@
+#pragma once
+///////////////////////////////////////////////////////////////////////////////
+//	PgcVerify.h
+//
+//	Checks a converted database against its PGN source.
+//
+//	Every game record is decoded with GameDecoder, which replays the move
+//	ordinals on a Board, and its moves are compared with the SAN moves of
+//	the source game, main line and variations in the order of the movetext.
+//	The SAN of the decoded move is compared as text first; only if that
+//	differs, e.g. "exd5" against "ed5", is the source SAN resolved on the
+//	board.  So a move costs about a legal move generation, less than it
+//	cost to convert it, and the games are checked in batches on all
+//	hardware threads.
+//
+//	Like the converter's, the decoder's position for a variation that
+//	follows no move sequence outlives the game, and every batch starts
+//	without one.  A game whose movetext starts that way, e.g. "$1 (1. e4)",
+//	can be reported although it was converted as written.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <cstdint>
+#include <filesystem>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+namespace pgn2pgc::Verify {
+    // where a converted game came from, and where its record went
+    struct Source {
+        uint64_t pgnOffset = 0; // the '[' of the game in the PGN
+        uint32_t pgnLength = 0; // up to the end of its game termination marker
+        uint64_t pgcOffset = 0; // of the record in a plain .pgc, not used for a frame container
+        uint32_t pgcLength = 0;
+    };
+
+    struct Mismatch {
+        uint64_t    game      = 0; // counting from 0, in PGC order
+        uint64_t    pgnOffset = 0;
+        uint64_t    ply       = 0; // counting from 0, the moves of variations included
+        std::string source;        // the move of the PGN, empty if it has no more moves
+        std::string pgc;           // the move decoded, empty if the record has no more moves
+        std::string error;         // why the record could not be decoded, if it could not
+    };
+
+    // the SAN moves of a PGN game, tags, move numbers, NAGs, comments and
+    // escapes skipped, tokenized like ProcessMoveSequence does it
+    std::vector<std::string_view> SourceMoves(std::string_view game);
+
+    // games are the sources of the records of pgc in order; pgc is a plain
+    // .pgc or a frame container, with or without a string table
+    // returns the first game that differs from its source
+    // throws std::runtime_error if either file cannot be read
+    std::optional<Mismatch> Verify(std::filesystem::path const& pgn, std::filesystem::path const& pgc,
+                                   std::vector<Source> const& games);
+} // namespace pgn2pgc::Verify
@@ -0,0 +1,445 @@
+///////////////////////////////////////////////////////////////////////////////
+//	pgngen.cpp
+//
+//	Generates PGN corpora of random legal games for scale testing.
+//
+//	Usage: pgngen [--games=n] [--seed=n] [--plies=min-max] [--fen=%]
+//	              [--rav=%] [--rav-depth=n] [--nags=%] [--comments=%]
+//	              [--escapes=%] [--malformed=%] [--rav-extras] [--threads=n]
+//	              [output.pgn]
+//	       pgngen --help
+//
+//	Game n of seed s is the same whatever the other switches that do not
+//	shape games, e.g. --threads, and whatever the platform: the random
+//	numbers come from SplitMix64 seeded with s and n, not from <random>,
+//	whose distributions differ between standard libraries.
+//
+//	  --plies     length of the main line, less if the game ends (20-160)
+//	  --fen       percentage of games that start from a FEN position (5)
+//	  --rav       percentage of moves followed by a variation (3)
+//	  --rav-depth how deep variations nest (1)
+//	  --nags      percentage of moves followed by a NAG (3)
+//	  --comments  percentage of moves followed by a comment (3)
+//	  --escapes   percentage of moves followed by an escape line (0.5)
+//	  --malformed percentage of games with an illegal move, an unknown
+//	              token, an unmatched ')' or no game termination (0)
+//	  --rav-extras NAGs and escapes in variations too
+//
+//	The converter processes a variation up to its first NAG, escape or
+//	nested variation only, and reads the rest as the main line.  So by
+//	default variations do not nest and get comments only; --rav-extras and
+//	--rav-depth=2 make games that show it.
+//
+//	The moves come from Board::genLegalMoveSet, so the corpus exercises the
+//	same move generator that converts it.  Games are generated in batches
+//	on all hardware threads and written in order.  Keep games below the
+//	16 KiB the converter reads at a time: long main lines with many nested
+//	variations can exceed it.
+//
+///////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <array>
+#include <charconv>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <fstream>
+#include <future>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+
+#include "chess_2.h"
+#include "stpwatch.h"
+
+namespace fs = std::filesystem;
+
+namespace {
+    using namespace pgn2pgc;
+    using Chess::Board;
+    using Chess::GameStatus;
+
+    static constexpr size_t kBatch = 256; // games per task
+
+    // https://prng.di.unimi.it/splitmix64.c
+    class Random {
+      public:
+        explicit Random(uint64_t seed) : state_(seed) {}
+
+        uint64_t operator()() {
+            uint64_t z = (state_ += 0x9e3779b97f4a7c15);
+            z          = (z ^ (z >> 30)) * 0xbf58476d1ce4e5b9;
+            z          = (z ^ (z >> 27)) * 0x94d049bb133111eb;
+            return z ^ (z >> 31);
+        }
+
+        // in [0, n), n > 0
+        size_t below(size_t n) { return (*this)() % n; }
+        size_t between(size_t min, size_t max) { return min + below(max - min + 1); }
+        bool   percent(double p) { return (*this)() % 1'000'000 < p * 10'000; }
+
+      private:
+        uint64_t state_;
+    };
+
+    struct Options {
+        uint64_t games     = 1000;
+        uint64_t seed      = 1;
+        size_t   minPlies  = 20;
+        size_t   maxPlies  = 160;
+        double   fen       = 5;
+        double   rav       = 3;
+        unsigned ravDepth  = 1;
+        double   nags      = 3;
+        double   comments  = 3;
+        double   escapes   = 0.5;
+        double   malformed = 0;
+        bool     ravExtras = false;
+        unsigned threads   = std::max(std::thread::hardware_concurrency(), 1u);
+        fs::path output;
+
+        // returns false if the switch is not recognized or its value is not valid
+        bool parse(std::string_view arg) {
+            auto const number = [&](std::string_view name, auto& value) {
+                if (!arg.starts_with(name))
+                    return false;
+                auto const v         = arg.substr(name.size());
+                auto const [end, ec] = std::from_chars(v.data(), v.data() + v.size(), value);
+                return ec == std::errc{} && end == v.data() + v.size();
+            };
+            auto const percentage = [&](std::string_view name, double& value) {
+                return number(name, value) && value >= 0 && value <= 100;
+            };
+
+            if (arg == "--rav-extras")
+                return ravExtras = true;
+            if (arg.starts_with("--plies=")) {
+                auto const v    = arg.substr(std::size("--plies=") - 1);
+                auto const dash = v.find('-');
+                auto const a = v.substr(0, dash), b = dash == v.npos ? a : v.substr(dash + 1);
+                auto const [ea, eca] = std::from_chars(a.data(), a.data() + a.size(), minPlies);
+                auto const [eb, ecb] = std::from_chars(b.data(), b.data() + b.size(), maxPlies);
+                return eca == std::errc{} && ecb == std::errc{} && ea == a.data() + a.size() &&
+                    eb == b.data() + b.size() && minPlies <= maxPlies;
+            }
+            return number("--games=", games) || number("--seed=", seed) || number("--rav-depth=", ravDepth) ||
+                (number("--threads=", threads) && threads > 0) || percentage("--fen=", fen) ||
+                percentage("--rav=", rav) || percentage("--nags=", nags) ||
+                percentage("--comments=", comments) || percentage("--escapes=", escapes) ||
+                percentage("--malformed=", malformed);
+        }
+
+        static constexpr char const* kUsage =
+            "Usage: pgngen [--games=n] [--seed=n] [--plies=min-max] [--fen=%]\n"
+            "              [--rav=%] [--rav-depth=n] [--nags=%] [--comments=%]\n"
+            "              [--escapes=%] [--malformed=%] [--rav-extras] [--threads=n]\n"
+            "              [output.pgn]\n"
+            "       pgngen --help\n";
+
+        // --help, with the defaults
+        static constexpr char const* kSwitches =
+            "\n"
+            "  --games       games to write (1000)\n"
+            "  --seed        game n of seed s is always the same game (1)\n"
+            "  --plies       length of the main line, less if the game ends (20-160)\n"
+            "  --fen         percentage of games that start from a FEN position (5)\n"
+            "  --rav         percentage of moves followed by a variation (3)\n"
+            "  --rav-depth   how deep variations nest (1)\n"
+            "  --nags        percentage of moves followed by a NAG (3)\n"
+            "  --comments    percentage of moves followed by a comment (3)\n"
+            "  --escapes     percentage of moves followed by an escape line (0.5)\n"
+            "  --malformed   percentage of games with an illegal move, an unknown token,\n"
+            "                an unmatched ')' or no game termination (0)\n"
+            "  --rav-extras  NAGs and escapes in variations too\n"
+            "  --threads     threads generating games (all hardware threads)\n"
+            "\nWithout output.pgn the games go to standard output.\n";
+    };
+
+    // legal positions, with castling, en passant and promotions to come
+    static constexpr std::string_view kFenStarts[] = {
+        "r3k2r/p1ppqpb1/bn2pnp1/3PN3/1p2P3/2N2Q1p/PPPBBPPP/R3K2R w KQkq - 0 1",
+        "8/2p5/3p4/KP5r/1R3p1k/8/4P1P1/8 w - - 0 1",
+        "r3k2r/Pppp1ppp/1b3nbN/nP6/BBP1P3/q4N2/Pp1P2PP/R2Q1RK1 w kq - 0 1",
+        "rnbq1k1r/pp1Pbppp/2p5/8/2B5/8/PPP1NnPP/RNBQK2R w KQ - 1 8",
+        "r4rk1/1pp1qppp/p1np1n2/2b1p1B1/2B1P1b1/P1NP1N2/1PP1QPPP/R4RK1 w - - 0 10",
+        "rnbqkb1r/pp1p1ppp/4pn2/2pP4/2P5/8/PP2PPPP/RNBQKBNR w KQkq c6 0 4",
+        "8/8/4k3/8/2p5/8/1P2K3/8 w - - 0 1",
+        "4k3/1P6/8/8/8/8/6p1/4K3 b - - 0 1",
+    };
+
+    static constexpr std::string_view kWords[] = {
+        "a",      "strong",  "move",     "better", "was",    "the",   "only", "threat", "initiative", "pawn",
+        "centre", "weak",    "square",   "with",   "attack", "draws", "wins", "loses",  "time",       "king",
+        "safety", "endgame", "exchange", "bishop", "pair",   "open",  "file", "after",  "novelty",    "?",
+    };
+
+    template <typename... Parts> std::string Cat(Parts const&... parts) {
+        std::string s;
+        ((s += parts), ...);
+        return s;
+    }
+
+    // PGN text, wrapped before 80 columns
+    class Writer {
+      public:
+        explicit Writer(std::string& out) : out_(out) {}
+
+        void token(std::string_view t) {
+            if (column_ && column_ + 1 + t.size() >= 80)
+                newline();
+            else if (column_)
+                put(" ");
+            put(t);
+        }
+
+        // right after the previous token, e.g. a "!?" after its move
+        void suffix(std::string_view t) { put(t); }
+
+        // up to the end of the line, e.g. a ';' comment
+        void rest(std::string_view t) {
+            token(t);
+            newline();
+        }
+
+        // a line of its own, e.g. an escape
+        void line(std::string_view t) {
+            if (column_)
+                newline();
+            put(t);
+            newline();
+        }
+
+        void newline() {
+            out_ += '\n';
+            column_ = 0;
+        }
+
+      private:
+        void put(std::string_view t) {
+            out_ += t;
+            column_ += t.size();
+        }
+
+        std::string& out_;
+        size_t       column_ = 0;
+    };
+
+    class GameGenerator {
+      public:
+        GameGenerator(Options const& options, uint64_t number, std::string& out)
+            : o_(options)
+            , number_(number)
+            , random_(Random(options.seed ^ number * 0xd1342543de82ef95)())
+            , out_(out) {}
+
+        void generate() {
+            Board      board;
+            bool const fen      = random_.percent(o_.fen);
+            auto const fenStart = kFenStarts[random_.below(std::size(kFenStarts))];
+            if (fen)
+                board.processFEN(fenStart);
+
+            malformation_ = random_.percent(o_.malformed) ? Malformation(random_.between(1, 4)) : none;
+
+            // the result goes into the tags, so the movetext comes first
+            std::string moves;
+            Writer      text(moves);
+            text_ = &text;
+
+            auto const plies  = random_.between(o_.minPlies, o_.maxPlies);
+            flawAt_           = random_.below(plies);
+            auto const result = line(board, fen ? FullMove(fenStart) : 1, plies, 0);
+            if (malformation_ != noTermination)
+                text.token(result);
+            text.newline();
+
+            tags(fen ? fenStart : std::string_view{}, result);
+            out_ += '\n';
+            out_ += moves;
+        }
+
+      private:
+        static unsigned FullMove(std::string_view fen) {
+            unsigned   n     = 1;
+            auto const field = fen.substr(fen.rfind(' ') + 1);
+            std::from_chars(field.data(), field.data() + field.size(), n);
+            return n;
+        }
+
+        void tags(std::string_view fen, std::string_view result) {
+            Writer     w(out_);
+            auto const tag = [&](std::string_view name, std::string_view value) {
+                w.line(Cat("[", name, " \"", value, "\"]"));
+            };
+            auto const date = Cat(std::to_string(random_.between(1850, 2025)), ".",
+                                  std::to_string(random_.between(10, 12)), ".",
+                                  std::to_string(random_.between(10, 28)));
+            tag("Event", Cat("Synthetic ", std::to_string(random_.below(100))));
+            tag("Site", "pgngen");
+            tag("Date", date);
+            tag("Round", std::to_string(number_ % 13 + 1));
+            tag("White", Cat("Player ", std::to_string(random_.below(5000))));
+            tag("Black", Cat("Player ", std::to_string(random_.below(5000))));
+            tag("Result", result);
+            if (!fen.empty()) {
+                tag("SetUp", "1");
+                tag("FEN", fen);
+            }
+        }
+
+        enum Malformation { none, illegalMove, unknownToken, ravUnderflow, noTermination };
+
+        // after the move of the main line at flawAt_
+        void malform(bool white) {
+            switch (malformation_) {
+                case illegalMove: text_->token(white ? "a8" : "h1"); break; // a pawn move backwards
+                case unknownToken: text_->token("@@"); break;
+                case ravUnderflow: text_->token(")"); break;
+                default: break;
+            }
+        }
+
+        // plays up to plies random moves, with the extras after each; returns the result of the line
+        std::string line(Board board, unsigned moveNumber, size_t plies, unsigned depth) {
+            bool numbered  = false; // a black move needs "n..." unless it follows its white move
+            bool lastWhite = false;
+            for (size_t ply = 0; ply < plies; ++ply) {
+                auto const legal = board.genLegalMoveSet();
+                if (legal.bysan.empty()) // the side to move is the one that was mated
+                    return board.Status() != GameStatus::inCheckmate ? "1/2-1/2" : lastWhite ? "1-0" : "0-1";
+
+                auto const& move   = legal.bysan[random_.below(legal.bysan.size())];
+                bool const  white  = board.squareAt(move.move().from()).isWhite();
+                lastWhite          = white;
+                Board const before = board;
+                board.processMove(move.move());
+
+                std::string san = white ? std::to_string(moveNumber) + ". "
+                    : numbered          ? ""
+                                        : std::to_string(moveNumber) + "... ";
+                san += move.SAN();
+                switch (board.Status()) {
+                    case GameStatus::inCheck: san += '+'; break;
+                    case GameStatus::inCheckmate: san += '#'; break;
+                    default: break;
+                }
+                text_->token(san);
+                numbered = white;
+                extras(numbered, depth == 0 || o_.ravExtras);
+                if (depth == 0 && ply == flawAt_)
+                    malform(white);
+
+                if (depth < o_.ravDepth && random_.percent(o_.rav)) { // instead of the move
+                    text_->token("(");
+                    line(before, moveNumber, random_.between(1, 8), depth + 1);
+                    text_->token(")");
+                    numbered = false;
+                }
+
+                if (!white)
+                    ++moveNumber;
+            }
+            return random_.percent(25) ? "*" : std::array{"1-0", "0-1", "1/2-1/2"}[random_.below(3)];
+        }
+
+        void extras(bool& numbered, bool breaks) {
+            if (breaks && random_.percent(o_.nags)) {
+                static constexpr std::string_view kGlyphs[] = {"!", "?", "!!", "??", "!?", "?!"};
+                if (random_.percent(50))
+                    text_->suffix(kGlyphs[random_.below(std::size(kGlyphs))]); // "e4!?"
+                else
+                    text_->token(Cat("$", std::to_string(random_.between(0, 139))));
+            }
+            if (random_.percent(o_.comments)) {
+                std::string comment;
+                for (size_t i = random_.between(1, 12); i--;)
+                    comment += Cat(kWords[random_.below(std::size(kWords))], i ? " " : "");
+                if (random_.percent(20))
+                    text_->rest(Cat(";", comment));
+                else
+                    text_->token(Cat("{", comment, "}"));
+                numbered = false;
+            }
+            if (breaks && random_.percent(o_.escapes)) {
+                text_->line(Cat("%escape ", std::to_string(random_())));
+                numbered = false;
+            }
+        }
+
+        Options const& o_;
+        uint64_t       number_;
+        Random         random_;
+        std::string&   out_;
+        Writer*        text_         = nullptr; // the movetext being written
+        Malformation   malformation_ = none;
+        size_t         flawAt_       = 0; // ply of the main line
+    };
+
+    std::string Batch(Options const& options, uint64_t first, uint64_t games) {
+        std::string out;
+        for (uint64_t n = first; n < first + games; ++n) {
+            GameGenerator(options, n, out).generate();
+            out += '\n';
+        }
+        return out;
+    }
+} // namespace
+
+int main(int argc, char* argv[]) {
+    Options options;
+    for (int i = 1; i < argc; ++i) {
+        std::string_view const arg = argv[i];
+        if (arg == "--help") {
+            std::cout << Options::kUsage << Options::kSwitches;
+            return 0;
+        }
+        if (arg.starts_with("--") ? !options.parse(arg) : !options.output.empty()) {
+            std::cerr << Options::kUsage;
+            return 2;
+        }
+        if (!arg.starts_with("--"))
+            options.output = arg;
+    }
+
+    std::ofstream file;
+    if (!options.output.empty()) {
+        file.open(options.output, std::ios::binary | std::ios::trunc);
+        if (!file) {
+            std::cerr << "Unable to open " << options.output << " for output\n";
+            return 2;
+        }
+    }
+    std::ostream& os = options.output.empty() ? std::cout : file;
+    if (options.output.empty())
+        pgn2pgc::support::ReportTo(&std::cerr); // the timings of the move generator are no games
+
+    auto const started = std::chrono::steady_clock::now();
+    uint64_t   bytes   = 0;
+
+    std::deque<std::future<std::string>> pending; // in game order
+    auto const                           writeOldest = [&] {
+        auto const text = pending.front().get();
+        pending.pop_front();
+        os << text;
+        bytes += text.size();
+    };
+    for (uint64_t first = 0; first < options.games; first += kBatch) {
+        if (pending.size() == options.threads)
+            writeOldest();
+        pending.push_back(std::async(std::launch::async, Batch, std::cref(options), first,
+                                     std::min(kBatch, options.games - first)));
+    }
+    while (!pending.empty())
+        writeOldest();
+
+    if (!os.flush()) {
+        std::cerr << "Error writing the games\n";
+        return 2;
+    }
+
+    std::chrono::duration<double> const elapsed = std::chrono::steady_clock::now() - started;
+    std::cerr << options.games << " games, " << bytes / 1e6 << " MB in " << elapsed.count() << " s, "
+              << bytes / 1e6 / elapsed.count() << " MB/s\n";
+}
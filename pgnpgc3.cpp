@@ -2,33 +2,47 @@
 #include <bit>
 #include <cassert>
 #include <cctype>
+#include <charconv>
+#include <chrono>
 #include <climits>
 #include <cstring>
 #include <filesystem>
 #include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <memory_resource>
+#include <optional>
 #include <sstream>
 namespace fs = std::filesystem;
 
 // .pgn to .pgc
 #include "chess_2.h"
+#include "pgcbatch.h"
+#include "pgccoder.h"
+#include "pgcformat.h"
+#include "pgcframes.h"
+#include "pgcindex.h"
+#include "pgcopenings.h"
+#include "pgcpositions.h"
+#include "pgcverify.h"
 #include "stpwatch.h" // profiling
 
 // from https://stackoverflow.com/a/8197886/85371
 namespace {
-    using pgn2pgc::support::gTimers;
     using namespace pgn2pgc;
+    using namespace pgn2pgc::Pgc; // markers
     using Chess::Board;
     using Chess::MoveError;
     using Chess::OrderedMoveList;
 
     template <std::integral T> constexpr bool is_little_endian() {
+        using U = std::make_unsigned_t<T>; // T(1) << bit would promote, and miss the sign bit of a short
         for (unsigned bit = 0; bit != sizeof(T) * CHAR_BIT; ++bit) {
             unsigned char data[sizeof(T)] = {};
             // In little-endian, bit i of the raw bytes ...
             data[bit / CHAR_BIT] = 1 << (bit % CHAR_BIT);
             // ... Corresponds to bit i of the value.
-            if (std::bit_cast<T>(data) != T(1) << bit)
+            if (std::bit_cast<U>(data) != U(U(1) << bit))
                 return false;
         }
         return true;
@@ -41,27 +55,6 @@ namespace {
             c = {source[1], source[0]};
     }
 
-    //!!? Possible expansion (not covered in PGN standard document):
-    //  support for comments
-    //  special markers for supplementary tags, instead of kMarkerTagPair
-    // additional markers for strings that now only can have 255 length or only 2
-    // byte length to have choice (like short and long move sequence) change result
-    // tag to one byte // remove length info as well remove date length info (it's
-    // always the same) and change to byte sequence (e.g. int-2 year int-2 month
-    // int-1 day)
-
-    [[maybe_unused]] //
-    static int8_t const kMarkerBeginGameReduced  = 0x01;
-    static int8_t const kMarkerTagPair           = 0x02;
-    static int8_t const kMarkerShortMoveSequence = 0x03;
-    static int8_t const kMarkerLongMoveSequence  = 0x04;
-    static int8_t const kMarkerGameDataBegin     = 0x05;
-    static int8_t const kMarkerGameDataEnd       = 0x06;
-    static int8_t const kMarkerSimpleNAG         = 0x07;
-    static int8_t const kMarkerRAVBegin          = 0x08;
-    static int8_t const kMarkerRAVEnd            = 0x09;
-    static int8_t const kMarkerEscape            = 0x0a;
-
     void SkipWhite(char const*& c) {
         assert(c);
         while (isspace(*c) && *c != '\0')
@@ -127,7 +120,7 @@ namespace {
     }
 
     // returns the element, or -1 if it didn't find it
-    int FindElement(std::string const& target, OrderedMoveList& source) {
+    int FindElement(std::string_view target, OrderedMoveList& source) {
         for (unsigned i = 0; i < source.bysan.size(); ++i)
             if (source.bysan[i].SAN() == target)
                 return i;
@@ -152,15 +145,117 @@ namespace {
         unknown,
         whiteWin,
         blackWin,
-        draw
+        draw,
+        notDeferred // a variation needs the positions of the game, which a deferred conversion does not have
     }; //?!! Use later to determine if original STR Result is correct
 
-    E_gameTermination ProcessMoveSequence(Board& game, char const*& pgn, std::ostream& pgc) try {
-        static Board gPreviousGamePos; // used in case their is something other than a
-                                       // move sequence before a RAV
-        static int gRAVLevels;         // used to finish putting RAVEnd markers, and to detect
-                                       // RAV underflow
+    // the moves of a game converted without replaying them, for Batch::Replay to find their ordinals: the
+    // record has a placeholder for every ordinal
+    struct DeferredMoves {
+        Board                 start; // the position before the first move
+        std::string           san;   // of the moves, one after the other
+        std::vector<uint32_t> ends;  // of the SAN of every move in san
+        std::vector<uint32_t> at;    // of the placeholder of every move in the record
+
+        void add(std::string_view move, std::streamoff placeholder) {
+            san += move;
+            ends.push_back(static_cast<uint32_t>(san.size()));
+            at.push_back(static_cast<uint32_t>(placeholder));
+        }
+    };
+
+    // the openings of the games from the standard start, shared by the games that follow: a node is a move
+    // as written, from the position of its parent, with its ordinal and the position after it, so a game
+    // that begins like an earlier one writes those moves without generating, resolving or making them
+    // bounded: no node is added once it has capacity nodes, nor deeper than kMaxPly, nor for a SAN longer
+    // than 8 characters
+    class PrefixTrie {
+      public:
+        using Node = uint32_t;
+
+        static constexpr Node   kRoot     = 0;          // the standard start
+        static constexpr Node   kNone     = UINT32_MAX; // off the trie, for the rest of the game
+        static constexpr size_t kMaxPly   = 40;         // deeper, games seldom share their moves
+        static constexpr size_t kCapacity = 0x10000;    // nodes by default, 17 MB
+
+        explicit PrefixTrie(size_t capacity = kCapacity) : capacity_(std::max<size_t>(capacity, 1)) {
+            nodes_.push_back({});
+        }
+
+        // the child of parent for the move san, kNone if there is none
+        Node find(Node parent, std::string_view san) const {
+            if (parent == kNone || san.size() > sizeof(uint64_t))
+                return kNone;
+            auto const key = Key(san);
+            for (Node n = nodes_[parent].child; n != kNone; n = nodes_[n].sibling)
+                if (nodes_[n].san == key)
+                    return n;
+            return kNone;
+        }
+
+        // adds the child of parent for the move san, returns it, or kNone if the trie does not take it
+        Node add(Node parent, std::string_view san, uint8_t ordinal, Board const& after) {
+            if (parent == kNone || san.size() > sizeof(uint64_t) || nodes_.size() == capacity_ ||
+                nodes_[parent].ply == kMaxPly)
+                return kNone;
+            Node const n = static_cast<Node>(nodes_.size());
+            nodes_.push_back({Key(san), kNone, nodes_[parent].child, ordinal,
+                              static_cast<uint8_t>(nodes_[parent].ply + 1), after});
+            nodes_[parent].child = n;
+            return n;
+        }
+
+        uint8_t      ordinal(Node n) const { return nodes_[n].ordinal; }
+        Board const& position(Node n) const { return nodes_[n].after; }
+        size_t       size() const { return nodes_.size(); }
+
+      private:
+        static uint64_t Key(std::string_view san) {
+            uint64_t key = 0;
+            memcpy(&key, san.data(), san.size());
+            return key;
+        }
+
+        struct Entry {
+            uint64_t san     = 0;     // the move as written, padded with '\0'
+            Node     child   = kNone; // the last one added
+            Node     sibling = kNone;
+            uint8_t  ordinal = 0;
+            uint8_t  ply     = 0;
+            Board    after;
+        };
 
+        size_t             capacity_;
+        std::vector<Entry> nodes_;
+    };
+
+    // what is kept of the main line of a game as its moves are made
+    struct MainLine {
+        PrefixTrie*            trie      = nullptr;
+        PrefixTrie::Node       node      = PrefixTrie::kNone; // of the position of the game in trie
+        std::vector<uint64_t>* positions = nullptr;           // the hashes of the positions, one per ply
+        std::string*           ordinals  = nullptr;           // of the moves, one byte each
+    };
+
+    // what the move sequences of a game share, so that a game leaves nothing behind for the next one
+    struct Variations {
+        Board previous;   // before the last move of the last sequence, for a variation that follows no moves
+        int   levels = 0; // open, closed at the end of the game; below 0 after an unmatched ')'
+    };
+
+    // the legal moves of a position come from a buffer on the stack, the arena of the game if they outgrow it
+    static constexpr size_t kPositionScratch = 0x4000;
+
+    // with a model, the ordinals are range coded (kExtCodedMoves)
+    // what lasts no longer than the game is allocated from arena
+    // with deferred, the moves are not replayed, but written as placeholders and added to deferred; game is
+    // not changed, and a variation throws notDeferred
+    // with line, game is that of the main line: the moves the trie has are taken from it, those it has not
+    // are added, and the positions after the moves are hashed
+    E_gameTermination ProcessMoveSequence(Board& game, Variations& variations, char const*& pgn,
+                                          std::ostream& pgc, MoveModel* model,
+                                          std::pmr::memory_resource* arena, DeferredMoves* deferred,
+                                          MainLine* line) try {
         enum E_reasonToEndSequence { RAVBegin, RAVEnd, NAG, escape, other } reasonToBreak = other;
         E_gameTermination gameResult                                                      = none;
 
@@ -168,7 +263,7 @@ namespace {
         std::string escapeToken;
 
         auto const moves = [&] {
-            std::vector<std::string> moves;
+            std::pmr::vector<std::string> moves(arena);
             std::string              token;
             for (bool processMoveSequence = true; processMoveSequence; token.clear()) // move sequence
             {
@@ -258,18 +353,23 @@ namespace {
                 } else if (token[0] == '{') // multi-line comment
                 {
                     // .pgc doesn't allow for comments yet..
-                    SkipTo(pgn, "}");
+                    if (auto const close = token.find('}'); close != std::string::npos)
+                        pgn -= token.size() - close - 1; // the token has all of it, e.g. {Novelty}
+                    else
+                        SkipTo(pgn, "}");
                 } else if (token[0] == ';') // single-line comment
                 {
                     SkipTo(pgn, "\n");
                 } else if (token[0] == '(') // RAV
                 {
-                    ++gRAVLevels;
+                    if (deferred)
+                        throw notDeferred; // before it counts as a level
+                    ++variations.levels;
                     reasonToBreak       = RAVBegin;
                     processMoveSequence = false;
                 } else if (token[0] == ')') // RAV
                 {
-                    --gRAVLevels;
+                    --variations.levels;
                     reasonToBreak       = RAVEnd;
                     processMoveSequence = false;
                 } else if (token[0] == '$') // NAG
@@ -314,40 +414,87 @@ namespace {
                 pgc << kMarkerLongMoveSequence << moveSize[0] << moveSize[1];
             }
 
+            RangeEncoder rc;
+            // after the ordinal of the last move is written, before the move is made
+            auto const endSequence = [&] {
+                if (model) {
+                    auto const coded = rc.finish();
+                    PutVarint(pgc, coded.size());
+                    pgc << coded;
+                }
+
+                if (reasonToBreak == RAVBegin) {
+                    pgc << kMarkerRAVBegin;
+                    Board temp = game;
+                    gameResult =
+                        ProcessMoveSequence(temp, variations, pgn, pgc, model, arena, deferred, nullptr);
+                } else {
+                    // their can't be two RAV's at the same level for the same
+                    // move, instead use 1. (1. (1.)) 1... not 1. (1.)(1.) 1...
+                    // (pgn formal syntax)
+                    variations.previous = game;
+                }
+            };
+
+            // after a move of the main line is made
+            auto const mainLineMove = [&](int ordinal) {
+                if (line->positions)
+                    line->positions->push_back(Positions::Hash(game));
+                if (line->ordinals)
+                    line->ordinals->push_back(static_cast<char>(ordinal));
+            };
+
             for (size_t i = 0; auto& mv : moves) {
-                OrderedMoveList legal = game.genLegalMoveSet();
+                bool const last = ++i == moves.size();
+                if (deferred) { // there is no variation to begin
+                    deferred->add(mv, pgc.tellp());
+                    pgc << int8_t{0};
+                    continue;
+                }
+
+                auto const known = line && line->trie ? line->trie->find(line->node, mv) : PrefixTrie::kNone;
+                if (known != PrefixTrie::kNone) {
+                    pgc << (int8_t)line->trie->ordinal(known);
+                    if (last)
+                        endSequence();
+                    game       = line->trie->position(known);
+                    line->node = known;
+                    mainLineMove(line->trie->ordinal(known));
+                    continue;
+                }
+
+                std::array<std::byte, kPositionScratch> scratch;
+                std::pmr::monotonic_buffer_resource     position(scratch.data(), scratch.size(), arena);
+                OrderedMoveList                         legal = game.genLegalMoveSet(&position);
 
-                auto [cm, san] = gTimers["resolveSAN & toSAN"].timed([&] {
+                auto [cm, san] = TIMER("resolveSAN & toSAN").timed([&] {
                     auto cm = game.resolveSAN(mv, legal.list);
                     return std::tuple(cm, game.toSAN(cm, legal.list));
                 });
 
-                assert(FindElement(san, legal) != -1);
+                int const ordinal = FindElement(san, legal);
+                assert(ordinal != -1);
 
-                pgc << (int8_t)FindElement(san, legal);
+                if (model)
+                    model->encode(rc, game, legal, ordinal);
+                else
+                    pgc << (int8_t)ordinal;
 
-                if (i == (moves.size() - 1)) {
-                    if (reasonToBreak == RAVBegin) {
-                        pgc << kMarkerRAVBegin;
-                        Board temp = game;
-                        gameResult = ProcessMoveSequence(temp, pgn, pgc);
-                    } else {
-                        // their can't be two RAV's at the same level for the same
-                        // move, instead use 1. (1. (1.)) 1... not 1. (1.)(1.) 1...
-                        // (pgn formal syntax)
-                        gPreviousGamePos = game;
-                    }
-                }
+                if (last)
+                    endSequence();
 
-                TIMED(game.processMove(cm));
-
-                ++i;
+                TIMED(game.processMove(cm, &position));
+                if (line && line->trie)
+                    line->node = line->trie->add(line->node, mv, static_cast<uint8_t>(ordinal), game);
+                if (line)
+                    mainLineMove(ordinal);
             }
 
         } else if (reasonToBreak == RAVBegin) // e.g. in case their is a NAG in before the RAVBegin
         {
             pgc << kMarkerRAVBegin;
-            gameResult = ProcessMoveSequence(gPreviousGamePos, pgn, pgc);
+            gameResult = ProcessMoveSequence(variations.previous, variations, pgn, pgc, model, arena,
+                                             deferred, nullptr);
         }
 
         switch (reasonToBreak) {
@@ -366,14 +513,12 @@ namespace {
             default: break;
         }
 
-        if (gRAVLevels < 0)
+        if (variations.levels < 0)
             throw RAVUnderflow;
 
-        if (gameResult != none && gRAVLevels)
-            while (gRAVLevels) {
+        if (gameResult != none)
+            for (; variations.levels; --variations.levels)
                 pgc << kMarkerRAVEnd;
-                --gRAVLevels;
-            }
 
         return gameResult;
     } catch (MoveError const& me) {
@@ -384,12 +529,240 @@ namespace {
         return e;
     }
 
+    // the seven tag roster in output order, with the value used when a tag is missing
+    struct RosterTag {
+        char const*      name;
+        std::string_view missing;
+    };
+    constexpr RosterTag kSevenTagRoster[] = {
+        {"EVENT", "?"}, {"SITE", "?"},  {"DATE", "????.??.??"}, {"ROUND", "?"},
+        {"WHITE", "?"}, {"BLACK", "?"}, {"RESULT", "*"},
+    };
+    static_assert(std::size(kSevenTagRoster) == Index::kNumKeyTags);
+
+    // returns the first tag with that name, or -1 if it didn't find it
+    int FindTag(std::vector<PGNTag> const& tags, std::string_view name) {
+        for (unsigned i = 0; i < tags.size(); ++i)
+            if (tags[i].name == name)
+                return i;
+
+        return -1;
+    }
+
+    // the seven tag roster values as they are written to the .pgc
+    Index::KeyTagViews RosterValues(std::vector<PGNTag> const& tags) {
+        Index::KeyTagViews values;
+        for (size_t i = 0; auto& [name, missing] : kSevenTagRoster) {
+            int const j = FindTag(tags, name);
+            values[i++] = j == -1 ? missing : tags[j].value;
+        }
+        return values;
+    }
+
+    // the opt-in extensions used for the games being written, none is the standard PGC format
+    struct PgcEncoding {
+        StringTable* strings     = nullptr; // tag names and values become ids into the string table
+        bool         compactTags = false;   // binary Date, Round and Result
+        bool         codedMoves  = false;   // range coded move ordinals
+
+        uint8_t extensions() const {
+            return (strings ? kExtStringTable : 0) | (compactTags ? kExtCompactTags : 0) |
+                (codedMoves ? kExtCodedMoves : 0);
+        }
+
+        void putBeginGame(std::ostream& pgc) const {
+            if (auto ext = extensions())
+                pgc << kMarkerGameDataBeginExt << (int8_t)ext;
+            else
+                pgc << kMarkerGameDataBegin;
+        }
+
+        // a tag name or value
+        void putString(std::ostream& pgc, std::string_view s) const {
+            if (strings) {
+                PutVarint(pgc, strings->id(s));
+            } else {
+                assert(s.length() <= UCHAR_MAX); //??! Need to deal with this
+                pgc << (int8_t)s.length() << s;
+            }
+        }
+
+        // a value of the seven tag roster
+        void putRosterValue(std::ostream& pgc, Index::KeyTag tag, std::string_view value) const {
+            if (compactTags) {
+                switch (tag) {
+                    case Index::date:
+                        if (PutCompactDate(pgc, value))
+                            return;
+                        break;
+                    case Index::round:
+                        if (PutCompactRound(pgc, value))
+                            return;
+                        break;
+                    case Index::result:
+                        if (PutCompactResult(pgc, value))
+                            return;
+                        break;
+                    default: break;
+                }
+            }
+            putString(pgc, value);
+        }
+    };
+
+    // the begin marker and the tags of a game, the seven tag roster first
+    void PutGameTags(std::ostream& pgc, std::vector<PGNTag> const& tags, PgcEncoding const& encoding) {
+        encoding.putBeginGame(pgc);
+        std::array<int, std::size(kSevenTagRoster)> rosterTag;
+        for (size_t i = 0; auto& [name, missing] : kSevenTagRoster) {
+            int const j = rosterTag[i] = FindTag(tags, name);
+            encoding.putRosterValue(pgc, Index::KeyTag(i++),
+                                    j != -1 ? std::string_view(tags[j].value) : missing);
+        }
+        // any remaining tags
+        //??! Case information is lost when parsing tags
+        for (int i = 0; i < int(tags.size()); ++i) {
+            if (std::ranges::find(rosterTag, i) != rosterTag.end())
+                continue;
+
+            pgc << kMarkerTagPair;
+            encoding.putString(pgc, tags[i].name);
+            encoding.putString(pgc, tags[i].value);
+        }
+    }
+
+    // one CSV (RFC 4180) row per game for the tags-only scan and the slow game log
+    void WriteCsvRow(std::ostream& csv, uint64_t offset, uint32_t length, Index::KeyTagViews const& roster) {
+        csv << offset << ',' << length;
+        for (auto value : roster) {
+            csv << ',';
+            if (value.find_first_of(",\"\r\n") == std::string_view::npos) {
+                csv << value;
+            } else {
+                csv << '"';
+                for (char c : value)
+                    (c == '"' ? csv << "\"\"" : csv << c);
+                csv << '"';
+            }
+        }
+        csv << '\n';
+    }
+
+    // conversion time per game, and a log of the games that took too long
+    struct GameTimes {
+        support::LatencyHistogram histogram; // nanoseconds
+        std::ostream*             slowLog = nullptr;
+        std::chrono::nanoseconds  slow    = std::chrono::milliseconds(100);
+
+        void add(std::chrono::nanoseconds time, uint64_t offset, uint32_t length,
+                 std::vector<PGNTag> const& tags) {
+            histogram.record(time.count());
+            if (slowLog && time >= slow) {
+                *slowLog << std::chrono::duration<double, std::milli>(time).count() << ',';
+                WriteCsvRow(*slowLog, offset, length, RosterValues(tags));
+            }
+        }
+    };
+
+    // the games that are the same game again: the ordinals of their main lines are the same from the same
+    // start position, and with tags, so is their seven tag roster
+    // a game is known by a 128 bit digest of that key, in an open addressing table of the games written
+    class Duplicates {
+      public:
+        bool     drop  = true;  // else they are only reported
+        bool     tags  = false; // the seven tag roster is part of the key
+        uint64_t found = 0;
+
+        // the game that this one is a copy of, or nothing if there is none, and it is kept as game
+        std::optional<uint32_t> find(uint32_t game, std::string_view ordinals,
+                                     std::vector<PGNTag> const& gameTags) {
+            key_.clear();
+            if (tags)
+                for (auto value : RosterValues(gameTags))
+                    (key_ += value) += '\0';
+            if (int const fen = FindTag(gameTags, "FEN"); fen != -1)
+                key_ += gameTags[fen].value;
+            (key_ += '\0') += ordinals; // last, ordinals can be 0
+
+            auto const [lo, hi] = Digest(key_);
+            for (size_t i = lo & (slots_.size() - 1);; i = (i + 1) & (slots_.size() - 1)) {
+                auto& slot = slots_[i];
+                if (slot.lo == lo && slot.hi == hi) {
+                    ++found;
+                    return slot.game;
+                }
+                if (!slot.lo && !slot.hi) {
+                    slot = {lo, hi, game};
+                    if (++used_ * 2 > slots_.size())
+                        grow();
+                    return {};
+                }
+            }
+        }
+
+      private:
+        struct Slot {
+            uint64_t lo = 0, hi = 0; // of the digest, both 0 if the slot is empty
+            uint32_t game = 0;
+        };
+
+        // two 64 bit hashes of the 8 byte words of key, each word mixed in with the finalizer of MurmurHash3
+        static std::pair<uint64_t, uint64_t> Digest(std::string_view key) {
+            auto const mix = [](uint64_t h) {
+                h = (h ^ (h >> 33)) * 0xFF51'AFD7'ED55'8CCD;
+                h = (h ^ (h >> 33)) * 0xC4CE'B9FE'1A85'EC53;
+                return h ^ (h >> 33);
+            };
+            uint64_t lo = mix(key.size()), hi = mix(~key.size());
+            for (size_t i = 0; i < key.size(); i += sizeof(uint64_t)) {
+                uint64_t word = 0;
+                memcpy(&word, key.data() + i, std::min(sizeof(word), key.size() - i));
+                lo = mix(lo ^ word);
+                hi = mix(hi + word * 0x9E37'79B9'7F4A'7C15);
+            }
+            return {lo, hi | (lo ? 0 : 1)}; // never empty
+        }
+
+        void grow() {
+            std::vector<Slot> old(slots_.size() * 2);
+            old.swap(slots_);
+            for (auto const& slot : old)
+                if (slot.lo || slot.hi) {
+                    size_t i = slot.lo & (slots_.size() - 1);
+                    while (slots_[i].lo || slots_[i].hi)
+                        i = (i + 1) & (slots_.size() - 1);
+                    slots_[i] = slot;
+                }
+        }
+
+        std::vector<Slot> slots_ = std::vector<Slot>(0x1000); // a power of 2, at most half full
+        size_t            used_  = 0;
+        std::string       key_;
+    };
+
+    // the output of PgnToPgc for a game, in the arena of the game
+    using GameRecord =
+        std::basic_ostringstream<char, std::char_traits<char>, std::pmr::polymorphic_allocator<char>>;
+
     // convert game from .pgn format to .pgc format
     // returns true if game is valid and succeeded, false otherwise
     // sets endOfGame to the place in pgn where the game stopped being processed
-    E_gameTermination PgnToPgc(char const* pgn, char const*& endOfGame, std::ostream& pgc) {
+    // the parsed tags are left in tags
+    // the transient state of the conversion is allocated from arena
+    // with deferred, the moves are left in it for Batch::Replay and their ordinals are placeholders; a game
+    // with a variation returns notDeferred, its record incomplete
+    // with the trie of line, a game from the standard start takes the moves of its main line it shares with
+    // earlier games from the trie, and adds those of its opening it does not
+    // with line, the positions and the ordinals of the main line are left in it, those it asks for
+    E_gameTermination PgnToPgc(char const* pgn, char const*& endOfGame, std::ostream& pgc,
+                               std::vector<PGNTag>& tags, PgcEncoding const& encoding,
+                               std::pmr::memory_resource* arena = std::pmr::get_default_resource(),
+                               DeferredMoves* deferred = nullptr, MainLine* line = nullptr) {
         assert(pgn);
-        std::vector<PGNTag> tags;
+        assert(!deferred || !encoding.codedMoves); // the model needs the positions
+        assert(!line || !deferred);                // the moves are not made
+        assert(!line || !line->trie || !encoding.codedMoves); // the model needs the legal moves
+        tags.clear();
         endOfGame = pgn;
         pgn       = ParsePGNTags(pgn, tags);
 
@@ -400,52 +773,32 @@ namespace {
             return parsingError;
         }
 
-        pgc << kMarkerGameDataBegin;
-        // output the tags in the right order
-        char const* sevenTagRoster[] = {
-            "EVENT", "SITE", "DATE", "ROUND", "WHITE", "BLACK", "RESULT",
-        };
-        for (int i = 0; i < int(sizeof(sevenTagRoster) / sizeof(sevenTagRoster[0])); ++i) {
-            bool foundTag = false;
-            for (int j = 0; j < int(tags.size()); ++j) {
-                if (tags[j].name == sevenTagRoster[i]) {
-                    assert(tags[j].value.length() <= UCHAR_MAX); //??! Need to deal with this
-                    pgc << (int8_t)tags[j].value.length() << tags[j].value;
-                    tags.erase(tags.begin() + j);
-                    foundTag = true;
-                    break;
-                }
-            }
-            if (!foundTag) {
-                switch (i) {
-                    case 0:
-                    case 1:
-                    case 3:
-                    case 4:
-                    case 5: pgc << (int8_t)1 << '?'; break;
-                    case 2: pgc << (int8_t)10 << "????.??.??"; break;
-                    case 6: pgc << (int8_t)1 << '*'; break;
-                    default: assert(0); // not Reached
-                }
-            }
-        }
-        // any remaining tags
-        //??! Case information is lost when parsing tags
-        for (int i = 0; i < int(tags.size()); ++i) {
-            assert(tags[i].name.length() < UCHAR_MAX); //??! Need to deal with this
-            pgc << kMarkerTagPair << (int8_t)tags[i].name.length() << tags[i].name
-                << (int8_t)tags[i].value.length() << tags[i].value;
-
-            if (tags[i].name == "FEN") // process FEN
-                game.processFEN(tags[i].value.c_str());
-        }
+        PutGameTags(pgc, tags, encoding);
+        for (auto const& tag : tags)
+            if (tag.name == "FEN") // process FEN
+                game.processFEN(tag.value.c_str());
 
         E_gameTermination processGame = none;
         // Board          previousBoard = game;     // used for RAV
 
+        std::optional<MoveModel> model; // every game starts with a fresh model
+        if (encoding.codedMoves)
+            model.emplace();
+        if (deferred)
+            *deferred = {game, {}, {}, {}};
+        if (line) {
+            line->node = line->trie && FindTag(tags, "FEN") == -1 ? PrefixTrie::kRoot : PrefixTrie::kNone;
+            if (line->positions)
+                line->positions->assign(1, Positions::Hash(game));
+            if (line->ordinals)
+                line->ordinals->clear();
+        }
+
+        Variations variations{game};
         while (processGame == none && *pgn != '\0') // whole game
         {
-            processGame = ProcessMoveSequence(game, pgn, pgc);
+            processGame = ProcessMoveSequence(game, variations, pgn, pgc, model ? &*model : nullptr, arena,
+                                              deferred, line);
         }
         pgc << kMarkerGameDataEnd;
 
@@ -453,15 +806,171 @@ namespace {
         return processGame;
     }
 
+    // what PgnToPgcDataBase does besides converting the games to pgc; a sink that is not given is not
+    // written, and if batched none of positions, duplicates and openings may be given
+    struct DataBaseOptions {
+        Index::IndexWriter*          index   = nullptr; // every game written is recorded in it
+        Frames::FrameWriter*         frames  = nullptr; // gets the games instead of pgc
+        GameTimes*                   times   = nullptr; // every game converted or rejected is timed
+        std::vector<Verify::Source>* sources = nullptr; // where every game written came from
+
+        // the moves of kReplayGames games at a time are replayed by Batch::Replay, and the games are not
+        // timed; the encoding must not code the moves
+        bool batched = false;
+
+        // the openings of the games are kept in a PrefixTrie of as many nodes; the encoding must not code the
+        // moves
+        size_t prefixNodes = 0;
+
+        Positions::PositionWriter* positions  = nullptr; // gets the positions of the main line of a game
+        Duplicates*                duplicates = nullptr; // reports a game that is one, drops it if so
+        Openings::TreeBuilder*     openings   = nullptr; // gets the first moves of a game, with its Result
+    };
+
     // returns the number of games processed successfully
-    int PgnToPgcDataBase(std::istream& pgn, std::ostream& pgc) {
+    // if the encoding uses a string table, it is written after the last game
+    int PgnToPgcDataBase(std::istream& pgn, std::ostream& pgc, PgcEncoding const& encoding = {},
+                         DataBaseOptions const& options = {}) {
+        assert(!options.batched || (!options.positions && !options.duplicates && !options.openings));
         size_t constexpr kLargestGame = 0x4000; // too large will impede performance due to memmove
+        size_t constexpr kReplayGames = 0x1000; // held back for a Batch::Replay
         thread_local std::array<char, kLargestGame + 1> gameStorage;
 
+        // the transient state of a game, released after it
+        size_t constexpr kGameArena = 0x10000; // more comes from the heap
+        thread_local std::array<std::byte, kGameArena> arenaStorage;
+        std::pmr::monotonic_buffer_resource            arena(arenaStorage.data(), arenaStorage.size());
+
         char* const gameBuffer        = gameStorage.data();
         char*       gameBufferCurrent = gameBuffer;
 
-        unsigned gamesProcessed = 0;
+        unsigned            gamesProcessed = 0;
+        uint64_t            pgcOffset      = 0; // bytes written to pgc so far
+        uint64_t            pgnOffset      = 0; // source offset of gameBuffer[0]
+        std::vector<PGNTag> tags;
+
+        std::optional<PrefixTrie> prefixes;
+        if (options.prefixNodes)
+            prefixes.emplace(options.prefixNodes);
+        std::vector<uint64_t> hashes;   // of the positions of the game
+        std::string           ordinals; // of the moves of its main line
+
+        MainLine line{prefixes ? &*prefixes : nullptr, PrefixTrie::kNone,
+                      options.positions || options.openings ? &hashes : nullptr,
+                      options.duplicates || options.openings ? &ordinals : nullptr};
+        bool const keepLine = line.trie || line.positions || line.ordinals;
+
+        // with a string table, a game is converted with ids of its own, and gets those of the table when it
+        // is written, so that a game that is rejected or dropped adds no strings to it
+        StringTable gameStrings;
+        PgcEncoding gameEncoding = encoding;
+        if (encoding.strings)
+            gameEncoding.strings = &gameStrings;
+        auto const convert = [&](char const* game, char const*& end, std::ostream& record,
+                                 std::vector<PGNTag>& gameTags, auto... args) {
+            gameStrings.clear();
+            return PgnToPgc(game, end, record, gameTags, gameEncoding, args...);
+        };
+
+        // says why a game is not written, false if it is
+        auto const rejected = [](E_gameTermination result) {
+            switch (result) {
+                case illegalMove: std::cout << "\n Illegal move."; return true;
+                case RAVUnderflow: std::cout << "\n RAV underflow."; return true;
+                case parsingError: // return gamesProcessed; //??! Needs fixing .eof()
+                    std::cout << "\n Parsing error (may be end-of-file).";
+                    return true;
+                default: return false;
+            }
+        };
+
+        auto const write = [&](std::string_view record, std::vector<PGNTag> const& gameTags, uint64_t offset,
+                               uint32_t length) {
+            std::string withIds;
+            if (encoding.strings) { // the tags are put again, the game's own ids are those of a fresh table
+                std::ostringstream os(std::ios::binary);
+                gameStrings.clear();
+                PutGameTags(os, gameTags, gameEncoding);
+                auto const moves = record.substr(os.view().size());
+                os.str({});
+                PutGameTags(os, gameTags, encoding);
+                os << moves;
+                withIds = std::move(os).str();
+                record  = withIds;
+            }
+            if (options.frames)
+                options.frames->add(record);
+            else
+                pgc << record;
+            if (options.index)
+                options.index->add(pgcOffset, record.size(), RosterValues(gameTags));
+            if (options.sources)
+                options.sources->push_back({offset, length, pgcOffset, static_cast<uint32_t>(record.size())});
+            if (options.positions)
+                options.positions->add(gamesProcessed, hashes);
+            if (options.openings) {
+                int const  result = FindTag(gameTags, "RESULT");
+                auto const value  = result != -1 ? std::string_view(gameTags[result].value) : "*";
+                options.openings->add(hashes, ordinals, Openings::ParseResult(value));
+            }
+            pgcOffset += record.size();
+            ++gamesProcessed;
+        };
+
+        // batched: the games converted but for the ordinals of their moves, in order
+        struct PendingGame {
+            std::string                  record;
+            std::optional<DeferredMoves> moves; // none if the game was converted as ever
+            std::vector<PGNTag>          tags;
+            std::string                  source; // to convert the game as ever if Replay cannot
+            uint64_t                     offset = 0;
+            uint32_t                     length = 0;
+        };
+        std::vector<PendingGame> pending;
+
+        // fills in the ordinals of the pending games and writes them
+        auto const replay = [&] {
+            size_t plies = 0;
+            for (auto const& game : pending)
+                plies += game.moves ? game.moves->ends.size() : 0;
+
+            std::vector<std::string_view> moves; // the spans of the games point into them
+            std::vector<uint8_t>          ordinals(plies);
+            std::vector<Batch::Game>      games;
+            moves.reserve(plies);
+            for (auto const& game : pending) {
+                if (!game.moves)
+                    continue;
+                size_t const first = moves.size();
+                for (uint32_t begin = 0; auto end : game.moves->ends) {
+                    moves.push_back(std::string_view(game.moves->san).substr(begin, end - begin));
+                    begin = end;
+                }
+                games.push_back({game.moves->start, std::span(moves).subspan(first),
+                                 std::span(ordinals).subspan(first, moves.size() - first)});
+            }
+            TIMED(Batch::Replay(games));
+
+            for (auto replayed = games.begin(); auto& game : pending) {
+                if (game.moves) {
+                    if (replayed->replayed) {
+                        for (size_t i = 0; i < game.moves->at.size(); ++i)
+                            game.record[game.moves->at[i]] = static_cast<char>(replayed->ordinals[i]);
+                    } else { // an illegal move, or a position Replay does not take
+                        std::ostringstream again(std::ios::binary);
+                        char const*        end = nullptr;
+                        if (rejected(convert(game.source.c_str(), end, again, game.tags))) {
+                            ++replayed;
+                            continue;
+                        }
+                        game.record = std::move(again).str();
+                    }
+                    ++replayed;
+                }
+                write(game.record, game.tags, game.offset, game.length);
+            }
+            pending.clear();
+        };
 
         std::cout << "\n"; // USER UPDATE
 
@@ -470,7 +979,8 @@ namespace {
         while (!pgn.bad() && pgc.good()) {
             std::cout << '.' << std::flush; // USER UPDATE
 
-            std::ostringstream pgcGame(std::ios::binary);
+            arena.release(); // all of the previous game
+            GameRecord pgcGame(std::ios::binary, &arena);
 
             if (!pgn.eof()) // Clearing eofbit and then reading from file will set
                             // badbit (illegal operation), but need to clear
@@ -483,35 +993,180 @@ namespace {
             gameBufferCurrent[received] = '\0';
 
             char const*       endOfGame = 0;
-            E_gameTermination result    = PgnToPgc(gameBuffer, endOfGame, pgcGame);
-
-            switch (result) {
-                case illegalMove: std::cout << "\n Illegal move."; break;
-                case RAVUnderflow: std::cout << "\n RAV underflow."; break;
-                case parsingError:
-                    std::cout << "\n Parsing error (may be end-of-file).";
-                    break;
-                    // return gamesProcessed; //??! Needs fixing .eof()
-                default:
-                    pgc << pgcGame.str();
-                    ++gamesProcessed;
-                    break;
+            auto const        started   = std::chrono::steady_clock::now();
+            std::optional<DeferredMoves> deferred;
+            if (options.batched)
+                deferred.emplace();
+            E_gameTermination result = convert(gameBuffer, endOfGame, pgcGame, tags, &arena,
+                                               deferred ? &*deferred : nullptr, keepLine ? &line : nullptr);
+            if (result == notDeferred) { // converted as ever
+                deferred.reset();
+                pgcGame = GameRecord(std::ios::binary, &arena);
+                result  = convert(gameBuffer, endOfGame, pgcGame, tags, &arena);
+            }
+            char const* const gameBegin = gameBuffer + strcspn(gameBuffer, "[");
+
+            if (options.times && !tags.empty() && !options.batched)
+                options.times->add(std::chrono::steady_clock::now() - started,
+                                   pgnOffset + (gameBegin - gameBuffer),
+                                   static_cast<uint32_t>(endOfGame - gameBegin), tags);
+
+            uint64_t const offset = pgnOffset + (gameBegin - gameBuffer);
+            uint32_t const length = static_cast<uint32_t>(endOfGame - gameBegin);
+            bool written = !rejected(result);
+            if (written && options.duplicates)
+                if (auto const original = options.duplicates->find(gamesProcessed, ordinals, tags)) {
+                    std::cout << "\n Duplicate of game " << *original + 1 << ".";
+                    written = !options.duplicates->drop;
+                }
+            if (written && options.batched) {
+                pending.push_back(
+                    {std::string(pgcGame.view()), std::move(deferred), tags, {}, offset, length});
+                if (pending.back().moves)
+                    pending.back().source.assign(gameBuffer, endOfGame - gameBuffer);
+                if (pending.size() == kReplayGames)
+                    replay();
+            } else if (written) {
+                write(pgcGame.view(), tags, offset, length);
             }
             assert(endOfGame && endOfGame >= gameBuffer);
             memmove(gameBuffer, endOfGame, kLargestGame - (endOfGame - gameBuffer));
+            pgnOffset += endOfGame - gameBuffer;
             gameBufferCurrent = gameBuffer + kLargestGame - (endOfGame - gameBuffer);
 
             if (!pgcGame || (!pgn.good() && gameBuffer[0] == '\0')) {
                 break;
             }
         }
+        if (options.batched)
+            replay();
         assert(!pgn.bad());
         assert(pgc.good());
 
+        if (options.frames) {
+            std::ostringstream trailer(std::ios::binary);
+            if (encoding.strings)
+                encoding.strings->write(trailer, 0); // the trailer frame is a stream of its own
+            options.frames->finish(trailer.view());
+        } else if (encoding.strings)
+            encoding.strings->write(pgc, pgcOffset);
+
         pgn.flags(oldPGNFlags);
         return gamesProcessed;
     }
 
+    // skips over the movetext of a game without looking at the moves, only
+    // comments, RAV nesting and the game termination marker are tracked
+    // returns just past the termination marker, at the '[' of the next game if
+    // the termination marker is missing, or at the terminating '\0', also when
+    // the text ends inside a termination marker, "1/2-1" of "1/2-1/2"
+    char const* SkipMoveText(char const* pgn) {
+        assert(pgn);
+        char const* const start = pgn;
+
+        auto atTokenStart = [&] {
+            return pgn == start || isspace(pgn[-1]) || pgn[-1] == ')' || pgn[-1] == '}';
+        };
+
+        for (int RAVLevels = 0;; ++pgn) {
+            pgn += strcspn(pgn, "{;%()[*01");
+
+            switch (*pgn) {
+                case '\0': return pgn;
+                case '{': pgn += strcspn(pgn, "}"); break;
+                case ';': pgn += strcspn(pgn, "\n"); break;
+                case '%':
+                    if (atTokenStart())
+                        pgn += strcspn(pgn, "\n");
+                    break;
+                case '(': ++RAVLevels; break;
+                case ')':
+                    if (RAVLevels)
+                        --RAVLevels;
+                    break;
+                case '[':
+                    if (!RAVLevels && atTokenStart())
+                        return pgn; // next game, without end-of-game marker
+                    break;
+                case '*':
+                    if (!RAVLevels)
+                        return pgn + 1;
+                    break;
+                default: // '0' or '1'
+                    if (!RAVLevels && atTokenStart())
+                        for (std::string_view marker : {"1-0", "0-1", "1/2-1/2", "1/2"}) {
+                            size_t n = 0;
+                            while (n < marker.length() && pgn[n] == marker[n])
+                                ++n;
+                            if (n == marker.length() || !pgn[n])
+                                return pgn + n;
+                        }
+                    break;
+            }
+            if (*pgn == '\0') // unterminated comment or escape
+                return pgn;
+        }
+    }
+
+    // extracts the tags of every game without replaying any moves
+    // calls sink(offset, length, roster) per game, offset and length locate
+    // the game in the PGN source
+    // returns the number of games found
+    template <typename Sink>
+        requires std::invocable<Sink, uint64_t, uint32_t, Index::KeyTagViews const&>
+    int ScanPgnTags(std::istream& pgn, Sink sink) {
+        std::vector<char> buffer(0x100000); // grows to fit the largest game
+        size_t            filled     = 0;   // valid chars in buffer
+        uint64_t          bufferBase = 0;   // source offset of buffer[0]
+
+        unsigned            gamesFound = 0;
+        std::vector<PGNTag> tags;
+
+        auto oldPGNFlags = pgn.flags();
+        pgn >> std::noskipws;
+
+        auto refill = [&](size_t keep) {
+            std::memmove(buffer.data(), buffer.data() + filled - keep, keep);
+            bufferBase += filled - keep;
+            filled = keep;
+            if (filled + 1 >= buffer.size())
+                buffer.resize(buffer.size() * 2);
+
+            pgn.read(buffer.data() + filled, buffer.size() - filled - 1);
+            filled += pgn.gcount();
+            buffer[filled] = '\0';
+        };
+
+        for (refill(0); filled;) {
+            char const* const data   = buffer.data();
+            char const*       cursor = data;
+
+            while (true) {
+                char const* const gameBegin = cursor + strcspn(cursor, "[");
+
+                tags.clear();
+                char const* const movetext = ParsePGNTags(gameBegin, tags);
+                char const* const gameEnd  = SkipMoveText(movetext);
+
+                if (*gameEnd == '\0' && pgn.good()) { // incomplete game, read some more
+                    refill(data + filled - gameBegin);
+                    break;
+                }
+                if (tags.empty()) { // nothing but white space left
+                    filled = 0;
+                    break;
+                }
+
+                sink(bufferBase + (gameBegin - data), gameEnd - gameBegin, RosterValues(tags));
+                ++gamesFound;
+                cursor = gameEnd;
+            }
+        }
+
+        pgn.flags(oldPGNFlags);
+        return gamesFound;
+    }
+
     // non-standard (may not be portable to some operating systems)
 
     // the different kinds of file operations that can cause an error
@@ -559,8 +1214,123 @@ namespace {
 
         return false;
     }
+
+    // command line switches, they can appear anywhere on the command line
+    struct Options {
+        enum class TagTable { none, csv, pgci };
+        enum class Dedupe { off, drop, report };
+
+        bool     writeIndex   = false;          // --index: write a .pgci random access index too
+        TagTable tagsOnly     = TagTable::none; // --tags-only[=csv|pgci]: only the tags, no conversion
+        bool     stringTable  = false;          // --string-table: extended PGC, tags refer to a string table
+        bool     compactTags  = false;          // --compact-tags: extended PGC, binary Date, Round and Result
+        bool     codedMoves   = false;          // --coded-moves: extended PGC, range coded move ordinals
+        size_t   frameGames   = 0;              // --frames[=games]: seekable container of compressed frames
+        fs::path traceFile;                     // --trace=file: Chrome trace of the TIMED calls
+        bool     perfCounters = false;          // --perf-counters: hardware counters of the TIMED calls
+        fs::path slowGames;                     // --slow-games=file: CSV of the games slower than slowMs
+        double   slowMs       = 100;            // --slow-ms=ms
+        bool     verify       = false;          // --verify: replay the output against the source
+        bool     batched      = false;          // --batched: replay many games at once, experimental
+        size_t   prefixNodes  = 0;              // --prefix-trie[=nodes]: take shared openings from a trie
+        bool     positions    = false;          // --positions: write a .pgcp position index too
+        Dedupe   dedupe       = Dedupe::off;    // --dedupe[=drop|report]: games that are in the source again
+        bool     dedupeTags   = false;          // --dedupe-tags: the same game has the same seven tag roster
+        unsigned openingPlies = 0;              // --opening-tree[=plies]: write a .pgct opening tree too
+
+        // returns false if the switch is not recognized
+        bool parse(std::string_view arg) {
+            if (arg == "--index")
+                writeIndex = true;
+            else if (arg == "--string-table")
+                stringTable = true;
+            else if (arg == "--compact-tags")
+                compactTags = true;
+            else if (arg == "--coded-moves")
+                codedMoves = true;
+            else if (arg == "--frames")
+                frameGames = Frames::kDefaultGames;
+            else if (arg.starts_with("--frames=")) {
+                auto const games     = arg.substr(std::size("--frames=") - 1);
+                auto const [end, ec] = std::from_chars(games.data(), games.data() + games.size(), frameGames);
+                return ec == std::errc{} && end == games.data() + games.size() && frameGames > 0;
+            } else if (arg.starts_with("--trace=") && arg.size() > std::size("--trace=") - 1)
+                traceFile = arg.substr(std::size("--trace=") - 1);
+            else if (arg == "--perf-counters")
+                perfCounters = true;
+            else if (arg == "--verify")
+                verify = true;
+            else if (arg == "--batched")
+                batched = true;
+            else if (arg == "--positions")
+                positions = true;
+            else if (arg == "--dedupe" || arg == "--dedupe=drop")
+                dedupe = Dedupe::drop;
+            else if (arg == "--dedupe=report")
+                dedupe = Dedupe::report;
+            else if (arg == "--dedupe-tags")
+                dedupeTags = true;
+            else if (arg == "--opening-tree")
+                openingPlies = Openings::kDefaultPlies;
+            else if (arg.starts_with("--opening-tree=")) {
+                auto const plies     = arg.substr(std::size("--opening-tree=") - 1);
+                auto const [end, ec] =
+                    std::from_chars(plies.data(), plies.data() + plies.size(), openingPlies);
+                return ec == std::errc{} && end == plies.data() + plies.size() && openingPlies > 0;
+            } else if (arg == "--prefix-trie")
+                prefixNodes = PrefixTrie::kCapacity;
+            else if (arg.starts_with("--prefix-trie=")) {
+                auto const nodes     = arg.substr(std::size("--prefix-trie=") - 1);
+                auto const [end, ec] =
+                    std::from_chars(nodes.data(), nodes.data() + nodes.size(), prefixNodes);
+                return ec == std::errc{} && end == nodes.data() + nodes.size() && prefixNodes > 0 &&
+                    prefixNodes <= PrefixTrie::kNone;
+            } else if (arg.starts_with("--slow-games=") && arg.size() > std::size("--slow-games=") - 1)
+                slowGames = arg.substr(std::size("--slow-games=") - 1);
+            else if (arg.starts_with("--slow-ms=")) {
+                auto const ms        = arg.substr(std::size("--slow-ms=") - 1);
+                auto const [end, ec] = std::from_chars(ms.data(), ms.data() + ms.size(), slowMs);
+                return ec == std::errc{} && end == ms.data() + ms.size() && slowMs >= 0;
+            } else if (arg == "--tags-only" || arg == "--tags-only=csv")
+                tagsOnly = TagTable::csv;
+            else if (arg == "--tags-only=pgci")
+                tagsOnly = TagTable::pgci;
+            else
+                return false;
+            return true;
+        }
+
+        // returns false if the switches contradict each other
+        bool valid() const {
+            if (frameGames && writeIndex) // the container has its own random access
+                return false;
+            // the model needs the positions, the games are not timed
+            if (batched && (codedMoves || !slowGames.empty()))
+                return false;
+            // the model needs the legal moves, Replay makes no move
+            if ((prefixNodes && (codedMoves || batched)) ||
+                ((positions || dedupe != Dedupe::off || openingPlies) && batched))
+                return false;
+            if (dedupeTags && dedupe == Dedupe::off)
+                return false;
+            return tagsOnly == TagTable::none || !(writeIndex || stringTable || compactTags || codedMoves ||
+                                                   frameGames || !slowGames.empty() || verify || batched ||
+                                                   prefixNodes || positions || dedupe != Dedupe::off ||
+                                                   openingPlies);
+        }
+
+        static constexpr char const* kUsage =
+            "\nUsage: pgn2pgc [--index] [--positions] [--string-table] [--compact-tags]\n"
+            "               [--coded-moves] [--frames[=games]] [--slow-games=file [--slow-ms=ms]]\n"
+            "               [--verify] [--batched] [--prefix-trie[=nodes]]\n"
+            "               [--dedupe[=drop|report] [--dedupe-tags]] [--opening-tree[=plies]]\n"
+            "               [--trace=file] [--perf-counters] [source_file [report_file]]\n"
+            "       pgn2pgc --tags-only[=csv|pgci] [--trace=file] [--perf-counters]"
+            " [source_file [report_file]]\n";
+    };
 } // namespace
 
+#ifndef BENCH // bench_pgn2pgc.cpp has its own
 int main(int argc, char* argv[]) {
     // INITIALIZE
     fs::path inputFileName, outputFileName;
@@ -575,11 +1345,31 @@ int main(int argc, char* argv[]) {
     // argv[2], ouput filename (optional)
     assert(argc);
 
-    if (argc > 3) {
-        std::cout << "\nUsage: pgn2pgc [source_file [report_file]]\n";
+    // take the switches out, leaving only the file names in argv[]
+    Options options;
+    {
+        int positional = 1;
+        for (int i = 1; i < argc; ++i) {
+            if (!std::string_view(argv[i]).starts_with("--"))
+                argv[positional++] = argv[i];
+            else if (!options.parse(argv[i])) {
+                std::cout << Options::kUsage;
+                return 2;
+            }
+        }
+        argc = positional;
+    }
+
+    if (argc > 3 || !options.valid()) {
+        std::cout << Options::kUsage;
         return 2;
     }
 
+    if (!options.traceFile.empty())
+        support::StartTracing(options.traceFile); // written at exit, with the timings
+    if (options.perfCounters)
+        support::StartPerfCounters(); // says so if there are none, the timings are reported anyway
+
     // get the name of the input file
     if (argc >= 2) {
         inputFileName = argv[1];
@@ -650,6 +1440,11 @@ int main(int argc, char* argv[]) {
         return 2;
     }
 
+    // the indexes are named after the final output file, not the temporary file
+    fs::path indexFileName     = fs::path(outputFileName).replace_extension(".pgci");
+    fs::path positionsFileName = fs::path(outputFileName).replace_extension(".pgcp");
+    fs::path openingsFileName  = fs::path(outputFileName).replace_extension(".pgct");
+
     // if the input file is the same as the output file, use a temporary file
     // and then delete the old file and rename the temporary file.
     bool inputOutputSameFile = inputFileName.lexically_normal() == outputFileName.lexically_normal();
@@ -665,20 +1460,162 @@ int main(int argc, char* argv[]) {
         return 2;
     }
 
-    // Let user know that what we are about to do
-    std::cout << "\nConverting the PGN file " << inputFileName
-              << "\n to PGC format and sending the output to file " << outputFileName << "";
+    Index::IndexWriter          index;
+    std::optional<Duplicates>   duplicates;
+    StringTable                 strings;
+    unsigned                    gameProcessed = 0;
+    GameTimes                   times;
+    std::vector<Verify::Source> sources;
+
+    if (options.tagsOnly == Options::TagTable::none) {
+        // Let user know that what we are about to do
+        std::cout << "\nConverting the PGN file " << inputFileName
+                  << "\n to PGC format and sending the output to file " << outputFileName << "";
+
+        PgcEncoding encoding;
+        if (options.stringTable)
+            encoding.strings = &strings;
+        encoding.compactTags = options.compactTags;
+        encoding.codedMoves  = options.codedMoves;
+
+        std::optional<Frames::FrameWriter> frames;
+        if (options.frameGames)
+            frames.emplace(outputStream, options.frameGames);
+
+        std::optional<Positions::PositionWriter> positions;
+        if (options.positions)
+            positions.emplace(positionsFileName);
+
+        std::optional<Openings::TreeBuilder> openings;
+        if (options.openingPlies)
+            openings.emplace(options.openingPlies);
+
+        if (options.dedupe != Options::Dedupe::off) {
+            duplicates.emplace();
+            duplicates->drop = options.dedupe == Options::Dedupe::drop;
+            duplicates->tags = options.dedupeTags;
+        }
 
-    unsigned gameProcessed = TIMED(PgnToPgcDataBase(inputStream, outputStream));
+        std::ofstream slowLog;
+        if (!options.slowGames.empty()) {
+            slowLog.open(options.slowGames, std::ios::trunc);
+            if (!slowLog) {
+                ReportFileError(E_openForOutput, options.slowGames);
+                return 2;
+            }
+            slowLog << "Milliseconds,Offset,Length,Event,Site,Date,Round,White,Black,Result\n";
+            times.slowLog = &slowLog;
+            times.slow    = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                std::chrono::duration<double, std::milli>(options.slowMs));
+        }
+
+        try {
+            DataBaseOptions conversion;
+            if (options.writeIndex)
+                conversion.index = &index;
+            if (frames)
+                conversion.frames = &*frames;
+            conversion.times = &times;
+            if (options.verify)
+                conversion.sources = &sources;
+            conversion.batched     = options.batched;
+            conversion.prefixNodes = options.prefixNodes;
+            if (positions)
+                conversion.positions = &*positions;
+            if (duplicates)
+                conversion.duplicates = &*duplicates;
+            if (openings)
+                conversion.openings = &*openings;
+
+            gameProcessed = TIMED(PgnToPgcDataBase(inputStream, outputStream, encoding, conversion));
+            if (positions)
+                TIMED(positions->finish());
+            if (openings)
+                TIMED(openings->write(openingsFileName));
+        } catch (Frames::FramesError const&) {
+            ReportFileError(E_output, outputFileName);
+            return 2;
+        } catch (Positions::PositionsError const&) {
+            ReportFileError(E_output, positionsFileName);
+            return 2;
+        } catch (Openings::OpeningsError const&) {
+            ReportFileError(E_output, openingsFileName);
+            return 2;
+        }
+
+        if (slowLog.is_open() && !slowLog.flush()) {
+            ReportFileError(E_output, options.slowGames);
+            return 2;
+        }
+    } else {
+        std::cout << "\nScanning the tags of the PGN file " << inputFileName
+                  << "\n and sending the table to file " << outputFileName << "";
+
+        if (options.tagsOnly == Options::TagTable::csv) {
+            auto csvRow = [&](uint64_t offset, uint32_t length, Index::KeyTagViews const& roster) {
+                WriteCsvRow(outputStream, offset, length, roster);
+            };
+            outputStream << "Offset,Length,Event,Site,Date,Round,White,Black,Result\n";
+            gameProcessed = TIMED(ScanPgnTags(inputStream, csvRow));
+        } else {
+            auto indexEntry = [&](uint64_t offset, uint32_t length, Index::KeyTagViews const& roster) {
+                index.add(offset, length, roster);
+            };
+            gameProcessed = TIMED(ScanPgnTags(inputStream, indexEntry));
+            index.write(outputStream);
+        }
+    }
 
     std::cout << "\n\nThere " << (gameProcessed == 1 ? "was" : "were") << " " << gameProcessed << " game"
               << (gameProcessed == 1 ? "" : "s") << " processed.";
+    if (duplicates)
+        std::cout << "\n" << duplicates->found << " duplicate game" << (duplicates->found == 1 ? "" : "s")
+                  << (duplicates->drop ? " dropped." : " found.");
+
+    if (auto const& h = times.histogram; h.count()) {
+        auto const ms = [](uint64_t ns) { return ns / 1e6; };
+        std::cout << std::fixed << std::setprecision(3) << "\nConversion time per game: p50 "
+                  << ms(h.percentile(.5)) << " ms, p90 " << ms(h.percentile(.9)) << " ms, p99 "
+                  << ms(h.percentile(.99)) << " ms, max " << ms(h.max()) << " ms" << std::defaultfloat;
+    }
 
     if (!outputStream.good()) {
         ReportFileError(E_output, outputFileName);
         return 2;
     }
 
+    if (options.writeIndex) {
+        try {
+            index.write(indexFileName);
+        } catch (Index::IndexError const&) {
+            ReportFileError(E_output, indexFileName);
+            return 2;
+        }
+    }
+
+    // before the source can be replaced by the output
+    if (options.verify) {
+        std::cout << "\n\nVerifying the output against the source";
+        try {
+            outputStream.flush();
+            if (auto const m = TIMED(Verify::Verify(inputFileName, outputFileName, sources))) {
+                std::cout << "\n\nGame " << m->game + 1 << " (offset " << m->pgnOffset
+                          << " of the source), move " << m->ply + 1 << ": ";
+                if (!m->error.empty())
+                    std::cout << m->error;
+                else
+                    std::cout << "the source has " << (m->source.empty() ? "no more moves" : m->source)
+                              << ", the output " << (m->pgc.empty() ? "no more moves" : m->pgc);
+                std::cout << "\n\nVerification failed." << std::endl;
+                return 1;
+            }
+        } catch (std::runtime_error const& e) {
+            std::cerr << "\nError: " << e.what() << std::endl;
+            return 2;
+        }
+        std::cout << "\nAll " << sources.size() << " games match.";
+    }
+
     if (inputOutputSameFile) {
         inputStream.close();
         outputStream.close();
@@ -706,3 +1643,4 @@ int main(int argc, char* argv[]) {
     // If we get to here than their were no file errors
     std::cout << "\n\nOperation was successful." << std::endl;
 }
+#endif
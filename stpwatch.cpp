@@ -1,17 +1,437 @@
 #include "stpwatch.h"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <iomanip>
 #include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <vector>
+
+#ifdef __linux__
+    #include <linux/perf_event.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+#endif
+#if __has_include(<sys/resource.h>)
+    #include <sys/resource.h>
+#endif
 
 namespace pgn2pgc::support {
-    std::map<std::string_view, StopWatch> gTimers;
+    std::atomic<bool> gTracing{false};
+    std::atomic<bool> gPerfCounting{false};
 
     namespace {
+        struct TraceEvent {
+            uint64_t begin, end; // ticks
+            size_t   slot;
+        };
+
+        // written by its thread only, read at exit
+        struct ThreadTrace {
+            std::unique_ptr<TraceEvent[]> ring;
+            size_t                        size = 0;
+            unsigned                      tid  = 0;
+            std::atomic<uint64_t>         written{0};
+        };
+
+        struct Registry {
+            std::mutex                   mutex;
+            std::deque<std::string_view> names;       // by slot id
+            std::deque<ThreadTimers>     threads;     // stable addresses, of running threads or spare
+            std::vector<ThreadTimers*>   spareTimers; // cleared
+            ThreadTimers                 exited{};    // the counters of the threads that exited, added up
+            std::deque<ThreadTrace>      traces;      // stable addresses, of running threads or spare
+            std::vector<ThreadTrace*>    spareTraces; // written, and empty
+            std::filesystem::path        traceFile;
+            std::ofstream                trace; // from the first events written until the exit report
+            char const*                  traceSeparator = "\n";
+            unsigned                     traceThreads   = 0;     // tids given out
+            bool                         traceDone      = false; // the file is complete
+            size_t                       traceEvents    = kTraceEvents;
+            unsigned                     perfEvents     = 0; // bit per PerfEvent, the ones all threads have
+            std::ostream*                report         = &std::cout;
+        };
+
+        Registry& TheRegistry() {
+            static Registry registry;
+            return registry;
+        }
+
+        void WriteJsonString(std::ostream& os, std::string_view s) {
+            os << '"';
+            for (char c : s) {
+                if (c == '"' || c == '\\')
+                    os << '\\' << c;
+                else if (static_cast<unsigned char>(c) < 0x20)
+                    os << ' ';
+                else
+                    os << c;
+            }
+            os << '"';
+        }
+
+        // Chrome trace event format, complete ("X") events in microseconds; the file is begun by the first
+        // events written, and finished by the exit report
+        void WriteTraceEvents(Registry& registry, ThreadTrace const& trace, uint64_t origin,
+                              double nsPerTick) {
+            auto& os = registry.trace;
+            if (!os.is_open()) {
+                os.open(registry.traceFile, std::ios::trunc);
+                os << std::fixed << std::setprecision(3) << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[";
+            }
+
+            uint64_t const written = trace.written.load(std::memory_order_acquire);
+            uint64_t const first   = written > trace.size ? written - trace.size : 0;
+            for (uint64_t i = first; i < written; ++i) {
+                auto const& e = trace.ring[i % trace.size];
+                os << registry.traceSeparator << "{\"name\":";
+                WriteJsonString(os, registry.names[e.slot]);
+                os << ",\"ph\":\"X\",\"pid\":1,\"tid\":" << trace.tid
+                   << ",\"ts\":" << (e.begin - origin) * nsPerTick / 1e3
+                   << ",\"dur\":" << (e.end - e.begin) * nsPerTick / 1e3 << "}";
+                registry.traceSeparator = ",\n";
+            }
+        }
+
+        void FinishTrace(Registry& registry) {
+            auto& os = registry.trace;
+            os << "\n]}\n";
+            if (!os.flush())
+                std::cerr << "Unable to write trace " << registry.traceFile << "\n";
+            os.close();
+            registry.traceDone = true;
+        }
+
+        void Add(TimerCounters& sum, TimerCounters const& c) {
+            sum.ticks += c.ticks;
+            sum.calls += c.calls;
+            sum.samples += c.samples;
+            for (size_t i = 0; i < kPerfEvents; ++i)
+                sum.perf[i] += c.perf[i];
+            sum.allocs.allocs += c.allocs.allocs;
+            sum.allocs.bytes += c.allocs.bytes;
+            sum.rssRise = std::max(sum.rssRise, c.rssRise);
+        }
+
+#ifdef __linux__
+        // the hardware counters of one thread, read together
+        class PerfGroup {
+          public:
+            PerfGroup() {
+                static constexpr auto cache = [](uint64_t cache) {
+                    return cache | PERF_COUNT_HW_CACHE_OP_READ << 8 | PERF_COUNT_HW_CACHE_RESULT_MISS << 16;
+                };
+                static constexpr std::pair<uint32_t, uint64_t> kEvents[kPerfEvents] = {
+                    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES},
+                    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS},
+                    {PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES},
+                    {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_L1D)},
+                    {PERF_TYPE_HW_CACHE, cache(PERF_COUNT_HW_CACHE_LL)},
+                };
+
+                for (size_t i = 0; i < kPerfEvents; ++i) {
+                    perf_event_attr attr{};
+                    attr.size           = sizeof(attr);
+                    attr.type           = kEvents[i].first;
+                    attr.config         = kEvents[i].second;
+                    attr.read_format    = PERF_FORMAT_GROUP | PERF_FORMAT_TOTAL_TIME_ENABLED |
+                        PERF_FORMAT_TOTAL_TIME_RUNNING;
+                    attr.exclude_kernel = 1; // allowed with perf_event_paranoid 2
+                    attr.exclude_hv     = 1;
+
+                    // this thread on any CPU; members missing on this CPU are left out
+                    int const fd = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, leader_, 0));
+                    if (fd < 0) {
+                        if (leader_ < 0)
+                            error_ = errno;
+                        continue;
+                    }
+                    if (leader_ < 0)
+                        leader_ = fd;
+                    fds_[i]      = fd;
+                    position_[i] = members_++;
+                    events_ |= 1u << i;
+                }
+
+                auto&           registry = TheRegistry(); // the report has the events all threads have
+                std::lock_guard lock(registry.mutex);
+                registry.perfEvents &= events_;
+            }
+
+            PerfGroup(PerfGroup const&) = delete;
+
+            ~PerfGroup() {
+                for (int fd : fds_)
+                    if (fd >= 0)
+                        close(fd);
+            }
+
+            unsigned events() const { return events_; }
+            int      error() const { return error_; }
+
+            bool read(PerfCounts& counts) const {
+                struct {
+                    uint64_t members, enabled, running;
+                    uint64_t values[kPerfEvents];
+                } group;
+                if (!events_ || ::read(leader_, &group, sizeof(group)) < 0 || group.members != members_)
+                    return false;
+
+                // the group shared the counters with other groups; scale up to all of the time
+                double const scale = group.running ? double(group.enabled) / group.running : 0;
+                for (size_t i = 0; i < kPerfEvents; ++i)
+                    counts[i] = events_ >> i & 1 ? uint64_t(group.values[position_[i]] * scale) : 0;
+                return true;
+            }
+
+          private:
+            int      fds_[kPerfEvents]      = {-1, -1, -1, -1, -1};
+            unsigned position_[kPerfEvents] = {};
+            int      leader_                = -1;
+            unsigned members_               = 0;
+            unsigned events_                = 0;
+            int      error_                 = 0;
+        };
+
+        PerfGroup& LocalPerfGroup() {
+            thread_local PerfGroup group;
+            return group;
+        }
+#endif
+
+        // IPC and misses per call, in columns; "-" for the events some thread did not have
+        void WritePerfCounters(std::ostream& os, TimerCounters const& c, unsigned events) {
+            static constexpr std::pair<PerfEvent, char const*> kMisses[] = {
+                {perfBranchMisses, " br-miss "},
+                {perfL1dMisses, " L1d-miss "},
+                {perfLlcMisses, " LLC-miss "},
+            };
+
+            auto const has = [&](PerfEvent e) { return c.samples && events >> e & 1; };
+            os << std::setw(5);
+            if (has(perfCycles) && has(perfInstructions) && c.perf[perfCycles])
+                os << double(c.perf[perfInstructions]) / c.perf[perfCycles];
+            else
+                os << "-";
+            os << " IPC";
+            for (auto [e, label] : kMisses) {
+                os << std::setw(10);
+                if (has(e))
+                    os << double(c.perf[e]) / c.samples;
+                else
+                    os << "-";
+                os << label;
+            }
+            os << " ";
+        }
+
         static struct AtProgramExit {
-            ~AtProgramExit() {
+            uint64_t                              ticks = Ticks(); // to calibrate the time stamp counter
+            std::chrono::steady_clock::time_point time  = std::chrono::steady_clock::now();
+
+            AtProgramExit() { TheRegistry(); } // constructed first, so destroyed after the report
+
+            // calibrated against steady_clock since the start if it is the time stamp counter
+            double nsPerTick() const {
                 using namespace std::chrono_literals;
-                std::cout << std::fixed << std::setprecision(2);
-                for (auto& [name, timer] : gTimers)
-                    std::cout << std::setw(8) << timer.time() / 1.ms << " ms " << name << "\n";
+                if constexpr (PGN2PGC_TIMER_CLOCK == 2) {
+                    auto const elapsed = std::chrono::steady_clock::now() - time;
+                    if (auto const ticksElapsed = Ticks() - ticks)
+                        return elapsed / 1ns / double(ticksElapsed);
+                }
+                return 1;
+            }
+
+            ~AtProgramExit() {
+                double const nsPerTick = this->nsPerTick();
+
+                gTracing = false;
+                auto& registry = TheRegistry();
+                std::lock_guard lock(registry.mutex);
+
+                std::map<std::string_view, TimerCounters> total; // sorted by name
+                for (size_t id = 0; id < registry.names.size(); ++id) {
+                    auto& sum = total[registry.names[id]];
+                    Add(sum, registry.exited[id]);
+                    for (auto& thread : registry.threads) // the spare ones are cleared
+                        Add(sum, thread[id]);
+                }
+
+                bool const perf = gPerfCounting.exchange(false);
+                if (auto* const os = registry.report) {
+                    *os << std::fixed << std::setprecision(2);
+                    for (auto& [name, counters] : total) {
+                        *os << std::setw(8) << counters.ticks * nsPerTick / 1e6 << " ms " << std::setw(9)
+                            << counters.calls << "x ";
+                        if (perf)
+                            WritePerfCounters(*os, counters, registry.perfEvents);
+                        if (PGN2PGC_COUNT_ALLOCS && counters.calls)
+                            *os << std::setw(10) << double(counters.allocs.allocs) / counters.calls
+                                << " allocs " << std::setw(11)
+                                << double(counters.allocs.bytes) / counters.calls << " B +" << std::setw(7)
+                                << counters.rssRise / 1024.0 << " MiB peak ";
+                        *os << name << "\n";
+                    }
+                }
+
+                if (!registry.traceFile.empty()) {
+                    for (auto const& trace : registry.traces) // the spare ones are empty
+                        WriteTraceEvents(registry, trace, ticks, nsPerTick);
+                    FinishTrace(registry);
+                }
             }
         } gAtProgramExit{};
+
+        // the ring of the calling thread, a spare one if there is one
+        struct LocalTrace {
+            LocalTrace() : trace(Lease()) {}
+
+            ~LocalTrace() {
+                auto&           registry = TheRegistry();
+                std::lock_guard lock(registry.mutex);
+                if (!registry.traceDone)
+                    WriteTraceEvents(registry, trace, gAtProgramExit.ticks, gAtProgramExit.nsPerTick());
+                trace.written.store(0, std::memory_order_relaxed);
+                registry.spareTraces.push_back(&trace);
+            }
+
+            LocalTrace(LocalTrace const&) = delete;
+
+            static ThreadTrace& Lease() {
+                auto&           registry = TheRegistry();
+                std::lock_guard lock(registry.mutex);
+                ThreadTrace*    trace = nullptr;
+                if (registry.spareTraces.empty()) {
+                    trace       = &registry.traces.emplace_back();
+                    trace->size = registry.traceEvents;
+                    // not initialized, so only the pages that get used cost memory
+                    trace->ring = std::make_unique_for_overwrite<TraceEvent[]>(trace->size);
+                } else {
+                    trace = registry.spareTraces.back();
+                    registry.spareTraces.pop_back();
+                }
+                trace->tid = ++registry.traceThreads;
+                return *trace;
+            }
+
+            ThreadTrace& trace;
+        };
     } // namespace
+
+    static ThreadTimers& LeaseTimers() {
+        auto&           registry = TheRegistry();
+        std::lock_guard lock(registry.mutex);
+        if (registry.spareTimers.empty())
+            return registry.threads.emplace_back();
+        auto& timers = *registry.spareTimers.back();
+        registry.spareTimers.pop_back();
+        return timers;
+    }
+
+    LocalTimerBlock::LocalTimerBlock() : timers(LeaseTimers()) {}
+
+    LocalTimerBlock::~LocalTimerBlock() {
+        auto&           registry = TheRegistry();
+        std::lock_guard lock(registry.mutex);
+        for (size_t id = 0; id < registry.names.size(); ++id) {
+            Add(registry.exited[id], timers[id]);
+            timers[id] = {};
+        }
+        registry.spareTimers.push_back(&timers);
+    }
+
+    TimerSlot::TimerSlot(std::string_view name) {
+        auto&           registry = TheRegistry();
+        std::lock_guard lock(registry.mutex);
+        if (registry.names.size() == kMaxTimers)
+            throw std::length_error("Too many TIMED call sites, raise kMaxTimers");
+        id_ = registry.names.size();
+        registry.names.push_back(name);
+    }
+
+    void ReportTo(std::ostream* os) {
+        auto&           registry = TheRegistry();
+        std::lock_guard lock(registry.mutex);
+        registry.report = os;
+    }
+
+    void StartTracing(std::filesystem::path const& file, size_t eventsPerThread) {
+        auto& registry = TheRegistry();
+        {
+            std::lock_guard lock(registry.mutex);
+            registry.traceFile   = file;
+            registry.traceEvents = std::max<size_t>(eventsPerThread, 1);
+        }
+        gTracing = true;
+    }
+
+    uint64_t PeakRss() {
+#if __has_include(<sys/resource.h>)
+        rusage usage;
+        if (getrusage(RUSAGE_SELF, &usage) != 0)
+            return 0;
+    #ifdef __APPLE__
+        return usage.ru_maxrss / 1024; // bytes
+    #else
+        return usage.ru_maxrss;
+    #endif
+#else
+        return 0;
+#endif
+    }
+
+    bool StartPerfCounters() {
+#ifdef __linux__
+        {
+            auto&           registry = TheRegistry();
+            std::lock_guard lock(registry.mutex);
+            registry.perfEvents = (1u << kPerfEvents) - 1;
+        }
+        auto const& group = LocalPerfGroup();
+        if (!group.events()) {
+            std::cerr << "Hardware counters are not available: " << std::strerror(group.error());
+            if (group.error() == EACCES || group.error() == EPERM)
+                std::cerr << " (see /proc/sys/kernel/perf_event_paranoid)";
+            std::cerr << "\n";
+            return false;
+        }
+        gPerfCounting = true;
+        return true;
+#else
+        std::cerr << "Hardware counters are only available on Linux\n";
+        return false;
+#endif
+    }
+
+    bool ReadPerfCounters(PerfCounts& counts) {
+#ifdef __linux__
+        return LocalPerfGroup().read(counts);
+#else
+        return false;
+#endif
+    }
+
+    void AddPerfCounters(TimerCounters& c) {
+        PerfCounts now;
+        if (!ReadPerfCounters(now))
+            return;
+        for (size_t i = 0; i < kPerfEvents; ++i)
+            c.perf[i] += now[i] > c.perfStarted[i] ? now[i] - c.perfStarted[i] : 0; // scaled, may go back
+        ++c.samples;
+    }
+
+    // lock free: each thread appends to its own ring
+    void Trace(size_t slot, uint64_t begin, uint64_t end) {
+        thread_local LocalTrace local;
+        auto&                   trace = local.trace;
+
+        auto const n               = trace.written.load(std::memory_order_relaxed);
+        trace.ring[n % trace.size] = {begin, end, slot};
+        trace.written.store(n + 1, std::memory_order_release);
+    }
 } // namespace pgn2pgc::support
@@ -13,17 +13,86 @@
 //	accuracy.  If you need more accuracy, see "Zen of Code Optimization"
 //	for a non-portable timer in assembly that has a very high accuracy.
 //
+//	TIMED(expression) and TIMER("name").timed(callable) time call sites
+//	with a TimerSlot each.  The slot is registered once, the first time the
+//	call site is reached; after that a call costs two reads of the clock and
+//	updates of counters local to the thread.  The counters of a thread are
+//	added to the totals when it exits, and its block of counters goes to the
+//	next thread, so threads started for a unit of work cost no memory that
+//	lasts.  The totals and the counters of the threads still running are
+//	added up in the report at program exit.
+//
+//	StartTracing(file) additionally records every timed call as a complete
+//	event in a ring buffer of the calling thread, and writes them in the
+//	Chrome trace event format (chrome://tracing, ui.perfetto.dev), where
+//	nested TIMED calls show up nested.  Older events are overwritten when a
+//	ring is full.  The events of a thread are written when it exits, and its
+//	ring goes to the next thread; those of the threads still running are
+//	written at exit.
+//
+//	StartPerfCounters() adds hardware counters to the report: a Linux perf
+//	event group of each thread (cycles, instructions, branch misses, L1 data
+//	and last level cache misses) is read when the outermost call of a site
+//	starts and stops, and the report shows the IPC and the misses per call.
+//	Reading the group is a system call, so this is for finding out why a
+//	call site is slow rather than how slow.  Where perf events are not
+//	available, e.g. in most containers, it says so and the report is as
+//	before.
+//
+//	LatencyHistogram collects many durations, e.g. one per game, in the
+//	manner of HdrHistogram: the buckets grow with the value so that each is
+//	within 1/32 of it, and any percentile is read back to that precision.
+//
+//	PGN2PGC_TIMER_CLOCK picks the clock of the slots:
+//	  0  std::chrono::steady_clock (default)
+//	  1  CLOCK_MONOTONIC_COARSE, a few ms resolution but very cheap
+//	  2  the time stamp counter, calibrated against steady_clock at exit
+//
+//	PGN2PGC_COUNT_ALLOCS 1 links newcount.cpp, a replacement of the global
+//	operator new that counts the allocations and bytes of each thread.  A
+//	call site adds up what was allocated between start and stop, including
+//	nested calls.  The outermost timed call of a thread is a phase, e.g. the
+//	conversion, and only its start and stop read the peak RSS of the
+//	process, as that is a system call; the report shows the allocations and
+//	bytes per call and how much the peak RSS rose in a phase of the site.
+//
 //	ABOUT THIS FILE: Please send any questions, comments, suggestions, bug
 //		reports, bug fixes, and useful modifications to joallen@trentu.ca.
 //		Released to the public domain.
 //		For more information visit www.trentu.ca/~joallen.
 //
 ///////////////////////////////////////////////////////////////////////////////
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
 #include <chrono>
-#include <map>
+#include <cmath>
+#include <concepts>
+#include <cstdint>
+#include <filesystem>
+#include <iosfwd>
 #include <string_view>
 #include <utility> // std::exchange
 
+#ifndef PGN2PGC_TIMER_CLOCK
+    #define PGN2PGC_TIMER_CLOCK 0
+#endif
+
+#ifndef PGN2PGC_COUNT_ALLOCS
+    #define PGN2PGC_COUNT_ALLOCS 0
+#endif
+
+#if PGN2PGC_TIMER_CLOCK == 1
+    #include <time.h>
+#elif PGN2PGC_TIMER_CLOCK == 2
+    #if defined(__x86_64__) || defined(__i386__)
+        #include <x86intrin.h>
+    #else
+        #error "PGN2PGC_TIMER_CLOCK 2 needs the x86 time stamp counter"
+    #endif
+#endif
+
 namespace pgn2pgc::support {
     class StopWatch {
       public:
@@ -58,7 +127,7 @@ namespace pgn2pgc::support {
             } else {
                 auto r = action();
                 stop();
-                return std::move(r);
+                return r;
             }
         } catch (...) {
             stop();
@@ -71,7 +140,206 @@ namespace pgn2pgc::support {
         Duration          cumTime_ = std::chrono::seconds(0); // the cummulative time
     };
 
-    extern std::map<std::string_view, StopWatch> gTimers;
+    //-----------------------------------------------------------------------------
+    class LatencyHistogram {
+      public:
+        static constexpr unsigned kSubBits = 5; // values below 2 << kSubBits are exact
+
+        void record(uint64_t value) {
+            ++counts_[bucket(value)];
+            ++count_;
+            max_ = std::max(max_, value);
+        }
+
+        uint64_t count() const { return count_; }
+        uint64_t max() const { return max_; }
+
+        // the value that a fraction q of the recorded values does not exceed, rounded up to its bucket
+        uint64_t percentile(double q) const {
+            uint64_t const rank = std::clamp<uint64_t>(uint64_t(std::ceil(q * count_)), 1, count_);
+            uint64_t       seen = 0;
+            for (unsigned b = 0; b < kBuckets; ++b)
+                if ((seen += counts_[b]) >= rank)
+                    return std::min(highest(b), max_);
+            return max_;
+        }
+
+      private:
+        static constexpr unsigned kBuckets = (65 - kSubBits) << kSubBits;
+
+        // the top kSubBits + 1 bits of the value, and how far they are shifted
+        static unsigned bucket(uint64_t value) {
+            unsigned const shift = std::max<int>(std::bit_width(value) - kSubBits - 1, 0);
+            return (shift << kSubBits) + unsigned(value >> shift);
+        }
+
+        static uint64_t highest(unsigned b) {
+            if (b < 2u << kSubBits)
+                return b;
+            unsigned const shift = (b >> kSubBits) - 1;
+            uint64_t const top   = b - (shift << kSubBits);
+            return ((top + 1) << shift) - 1;
+        }
+
+        std::array<uint64_t, kBuckets> counts_{};
+        uint64_t                       count_ = 0;
+        uint64_t                       max_   = 0;
+    };
+
+    //-----------------------------------------------------------------------------
+    // ticks of the clock chosen with PGN2PGC_TIMER_CLOCK, nanoseconds unless it is the TSC
+    inline uint64_t Ticks() {
+#if PGN2PGC_TIMER_CLOCK == 1
+        timespec ts;
+        clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+        return uint64_t(ts.tv_sec) * 1'000'000'000 + ts.tv_nsec;
+#elif PGN2PGC_TIMER_CLOCK == 2
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+                   std::chrono::steady_clock::now().time_since_epoch())
+            .count();
+#endif
+    }
+
+    static constexpr size_t kMaxTimers = 256; // call sites
+
+    enum PerfEvent : unsigned {
+        perfCycles,
+        perfInstructions,
+        perfBranchMisses,
+        perfL1dMisses,
+        perfLlcMisses
+    };
+    static constexpr size_t kPerfEvents = 5;
+    using PerfCounts                    = std::array<uint64_t, kPerfEvents>;
+
+    // what operator new has done in the calling thread, counted only if newcount.cpp is linked
+    struct AllocCounts {
+        uint64_t allocs = 0;
+        uint64_t bytes  = 0;
+    };
+
+    inline AllocCounts& LocalAllocs() {
+        thread_local AllocCounts counts;
+        return counts;
+    }
+
+    // outermost calls of the sites running in the calling thread, the first of them is a phase
+    inline unsigned& LocalPhaseDepth() {
+        thread_local unsigned depth = 0;
+        return depth;
+    }
+
+    uint64_t PeakRss(); // of the process, in KiB, 0 if unknown
+
+    // what one thread has measured at one call site
+    struct TimerCounters {
+        uint64_t    ticks   = 0;
+        uint64_t    calls   = 0;
+        uint64_t    started = 0;
+        unsigned    depth   = 0; // only the outermost of recursive calls is timed
+        bool        sampled = false;
+        uint64_t    samples = 0; // calls with hardware counters
+        PerfCounts  perf{}, perfStarted{};
+        AllocCounts allocs, allocsStarted;
+        uint64_t    rssRise = 0, rssStarted = 0; // KiB of peak RSS, the most a phase of the site added
+    };
+
+    using ThreadTimers = std::array<TimerCounters, kMaxTimers>;
+
+    // the counters of the calling thread, a block from a pool: when the thread exits they are added to the
+    // totals of the exit report, and the block is cleared for the next thread
+    struct LocalTimerBlock {
+        LocalTimerBlock();
+        ~LocalTimerBlock();
+        LocalTimerBlock(LocalTimerBlock const&) = delete;
+
+        ThreadTimers& timers;
+    };
+
+    inline ThreadTimers& LocalTimers() {
+        thread_local LocalTimerBlock block;
+        return block.timers;
+    }
+
+    static constexpr size_t kTraceEvents = 1 << 20; // per thread
+
+    // where the exit report goes, std::cout unless said otherwise, nowhere if nullptr; e.g. for a program
+    // whose output is std::cout
+    void ReportTo(std::ostream* os);
+
+    // from now until the program exits; the file is written by the exit report
+    void StartTracing(std::filesystem::path const& file, size_t eventsPerThread = kTraceEvents);
+
+    extern std::atomic<bool> gTracing;
+    void                     Trace(size_t slot, uint64_t begin, uint64_t end);
+
+    // from now until the program exits; returns false, with a note on std::cerr, if there are none
+    bool StartPerfCounters();
+
+    extern std::atomic<bool> gPerfCounting;
+    bool ReadPerfCounters(PerfCounts& counts); // of the calling thread, false if it has none
+    void AddPerfCounters(TimerCounters& c);    // since c.perfStarted
+
+    class TimerSlot {
+      public:
+        explicit TimerSlot(std::string_view name); // the name must outlive the program, e.g. a literal
+
+        void start() {
+            auto& c = LocalTimers()[id_];
+            if (c.depth++ == 0) {
+                c.sampled = gPerfCounting.load(std::memory_order_relaxed) && ReadPerfCounters(c.perfStarted);
+                if constexpr (PGN2PGC_COUNT_ALLOCS) {
+                    if (LocalPhaseDepth()++ == 0)
+                        c.rssStarted = PeakRss();
+                    c.allocsStarted = LocalAllocs();
+                }
+                c.started = Ticks();
+            }
+        }
+
+        void stop() {
+            auto& c = LocalTimers()[id_];
+            if (--c.depth == 0) {
+                auto const now = Ticks();
+                c.ticks += now - c.started;
+                ++c.calls;
+                if constexpr (PGN2PGC_COUNT_ALLOCS) {
+                    auto const& a = LocalAllocs(); // before tracing, which allocates once per thread
+                    c.allocs.allocs += a.allocs - c.allocsStarted.allocs;
+                    c.allocs.bytes += a.bytes - c.allocsStarted.bytes;
+                    if (--LocalPhaseDepth() == 0)
+                        c.rssRise = std::max(c.rssRise, PeakRss() - c.rssStarted);
+                }
+                if (gTracing.load(std::memory_order_relaxed))
+                    Trace(id_, c.started, now);
+                if (c.sampled)
+                    AddPerfCounters(c);
+            }
+        }
+
+        template <std::invocable F>
+            requires(not std::is_reference_v<std::invoke_result_t<F>>)
+        decltype(auto) timed(F action) {
+            struct Scope {
+                TimerSlot& slot;
+                Scope(TimerSlot& s) : slot(s) { slot.start(); }
+                ~Scope() { slot.stop(); }
+            } scope{*this};
+            return action();
+        }
+
+      private:
+        size_t id_;
+    };
 } // namespace pgn2pgc::support
 
-#define TIMED(action) ::pgn2pgc::support::gTimers[#action].timed([&] -> decltype(auto) { return action; })
+// a TimerSlot of its own for every place the macro is used
+#define TIMER(name)                                                                                        \
+    ([]() -> ::pgn2pgc::support::TimerSlot& {                                                              \
+        static ::pgn2pgc::support::TimerSlot slot(name);                                                   \
+        return slot;                                                                                       \
+    }())
+
+#define TIMED(action) TIMER(#action).timed([&] -> decltype(auto) { return action; })